@@ -0,0 +1,429 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+#include "profiles.h"
+
+/*
+ * Fork-free states from systemd's cgroup tree (cgroup v2). Every running
+ * instance of a unit template has a cgroup in the template's slice below
+ * OPENVPN_CGROUP_ROOT, e.g. system-openvpn.slice/openvpn@X.service, whose
+ * cgroup.events reads "populated 1" while any process of the unit is
+ * alive. A probe reads that file per unit, nothing is spawned. Once
+ * subscribed, inotify on the slices (unit cgroups created and removed) and
+ * on the cgroup.events of every watched unit (populated flipping) pushes
+ * the changes. A slice only exists once one of its units has run, so the
+ * root is watched for slices to appear.
+ *
+ * The cgroup cannot tell activating from active, so units are never
+ * reported as transitioning. Profiles and start/stop are those of the
+ * systemctl backend. OPENVPN_TRAY_CGROUP_ROOT replaces the root, e.g.
+ * with a fake tree of <slice>/<unit>/cgroup.events files.
+ */
+
+#define CGROUP_EVENTS_FILE "cgroup.events"
+
+struct cgroup_unit {
+    char *name;
+    int wd;                 // Watch on cgroup.events, -1 if the cgroup does not exist
+    int active;             // Last state read or pushed
+};
+
+static int inotify_fd = -1;
+static int root_wd = -1;                // Where the slices appear
+static int *slice_wd = NULL;            // Per profile root, -1 if the slice does not exist
+static const struct profile_root *roots = NULL;
+static int root_count = 0;
+static guint inotify_id = 0;
+static GHashTable *watched = NULL;      // VPN name -> struct cgroup_unit
+static GHashTable *by_wd = NULL;        // GINT_TO_POINTER(wd) -> struct cgroup_unit
+static backend_state_cb on_state = NULL;
+static gpointer callback_data = NULL;
+static int subscribed = 0;
+
+static const char *cgroup_root(void);
+static int open_root(void);
+static int unit_path(const char *vpn_name, char *path, size_t size);
+static int read_populated(int root_fd, const char *vpn_name);
+static const char *profile_dir(void);
+static int cgroup_enumerate(GPtrArray *names);
+static int cgroup_probe(struct vpn_probe *units, int count, int all);
+static int cgroup_start(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static int cgroup_stop(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static void cgroup_subscribe(backend_state_cb state_cb, backend_ready_cb ready_cb, gpointer data);
+static void cgroup_watch_units(const char *names[], int count);
+static int cgroup_is_subscribed(void);
+static void cgroup_cleanup(void);
+static void watch_slice(int root);
+static void watch_unit(struct cgroup_unit *unit);
+static void unwatch_unit(struct cgroup_unit *unit);
+static void refresh(struct cgroup_unit *unit, int root_fd);
+static int slice_of_wd(int wd);
+static gboolean on_inotify(gint fd, GIOCondition condition, gpointer data);
+static void free_unit(gpointer data);
+
+const struct vpn_backend backend_cgroup = {
+    .name = "cgroup",
+    .profile_dir = profile_dir,
+    .enumerate = cgroup_enumerate,
+    .probe = cgroup_probe,
+    .start = cgroup_start,
+    .stop = cgroup_stop,
+    .subscribe = cgroup_subscribe,
+    .watch_units = cgroup_watch_units,
+    .is_subscribed = cgroup_is_subscribed,
+    .cleanup = cgroup_cleanup,
+};
+
+// Not cached: probes call this on the worker thread
+static const char *cgroup_root(void)
+{
+    const char *env = getenv("OPENVPN_TRAY_CGROUP_ROOT");
+
+    return (env != NULL && *env != '\0') ? env : OPENVPN_CGROUP_ROOT;
+}
+
+// The root directory, -1 if it does not exist
+static int open_root(void)
+{
+    return open(cgroup_root(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// "<slice>/<unit>/cgroup.events" of the VPN relative to the root, -1 if too long
+static int unit_path(const char *vpn_name, char *path, size_t size)
+{
+    const struct profile_root *root = profiles_root_of(vpn_name);
+
+    return snprintf(path, size, "%s/%s%s" OPENVPN_UNIT_SUFFIX "/" CGROUP_EVENTS_FILE, root->slice,
+                    root->unit_prefix, profiles_instance(vpn_name)) < size ? 0 : -1;
+}
+
+/*
+ * 1 if the unit's cgroup has live processes, 0 if not or if it does not
+ * exist. Relative to the root so a probe costs no path allocation.
+ */
+static int read_populated(int root_fd, const char *vpn_name)
+{
+    char path[PATH_MAX];
+    char buf[128];
+    const char *populated;
+    ssize_t len;
+    int fd;
+
+    if (root_fd < 0 || unit_path(vpn_name, path, sizeof(path)) < 0 ||
+        (fd = openat(root_fd, path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return 0;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+
+    populated = strstr(buf, "populated ");
+    return populated != NULL && populated[10] == '1';
+}
+
+static const char *profile_dir(void)
+{
+    return backend_systemctl.profile_dir();
+}
+
+static int cgroup_enumerate(GPtrArray *names)
+{
+    return backend_systemctl.enumerate(names);
+}
+
+// Without the root nothing can be told apart from a stopped unit
+static int cgroup_probe(struct vpn_probe *units, int count, int all)
+{
+    int root_fd = open_root();
+    int i;
+
+    if (root_fd < 0) {
+        return BACKEND_ERR_PROBE;
+    }
+    for (i = 0; i < count; i++) {
+        units[i].state = read_populated(root_fd, units[i].name);
+        units[i].transitioning = 0;
+    }
+    close(root_fd);
+    return BACKEND_OK;
+}
+
+static int cgroup_start(const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    return backend_systemctl.start(vpn_name, done_cb, data);
+}
+
+static int cgroup_stop(const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    return backend_systemctl.stop(vpn_name, done_cb, data);
+}
+
+static void cgroup_subscribe(backend_state_cb state_cb, backend_ready_cb ready_cb, gpointer data)
+{
+    int i;
+
+    on_state = state_cb;
+    callback_data = data;
+
+    if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        g_print("%s: WARNING: Unable to watch cgroups, probing only: %s\n", APP_NAME, g_strerror(errno));
+        return;
+    }
+    root_wd = inotify_add_watch(inotify_fd, cgroup_root(), IN_CREATE | IN_ONLYDIR);
+    if (root_wd < 0) {
+        g_print("%s: WARNING: Unable to watch %s, probing only: %s\n", APP_NAME, cgroup_root(),
+                g_strerror(errno));
+        close(inotify_fd);
+        inotify_fd = -1;
+        return;
+    }
+
+    watched = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_unit);
+    by_wd = g_hash_table_new(g_direct_hash, g_direct_equal);
+    roots = profiles_roots(&root_count);
+    slice_wd = g_new(int, root_count);
+    for (i = 0; i < root_count; i++) {
+        slice_wd[i] = -1;
+        watch_slice(i);
+    }
+    inotify_id = g_unix_fd_add(inotify_fd, G_IO_IN, on_inotify, NULL);
+
+    subscribed = 1;
+    if (ready_cb) {
+        ready_cb(data);
+    }
+}
+
+// Watch exactly the given units, called after every rescan
+static void cgroup_watch_units(const char *names[], int count)
+{
+    GHashTable *wanted;
+    GHashTableIter iter;
+    struct cgroup_unit *unit;
+    int root_fd;
+    int i;
+
+    if (watched == NULL) {
+        return;
+    }
+
+    wanted = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < count; i++) {
+        g_hash_table_add(wanted, (gpointer)names[i]);
+    }
+
+    g_hash_table_iter_init(&iter, watched);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&unit)) {
+        if (!g_hash_table_contains(wanted, unit->name)) {
+            unwatch_unit(unit);
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    root_fd = open_root();
+    for (i = 0; i < count; i++) {
+        if (g_hash_table_contains(watched, names[i])) {
+            continue;
+        }
+        unit = g_new0(struct cgroup_unit, 1);
+        unit->name = g_strdup(names[i]);
+        unit->wd = -1;
+        // The tray has just probed it, only later changes are pushed
+        unit->active = read_populated(root_fd, unit->name);
+        g_hash_table_insert(watched, unit->name, unit);
+        watch_unit(unit);
+    }
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+    g_hash_table_destroy(wanted);
+}
+
+static int cgroup_is_subscribed(void)
+{
+    return subscribed;
+}
+
+static void cgroup_cleanup(void)
+{
+    if (inotify_id) {
+        g_source_remove(inotify_id);
+        inotify_id = 0;
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    if (by_wd) {
+        g_hash_table_destroy(by_wd);
+        by_wd = NULL;
+    }
+    if (watched) {
+        g_hash_table_destroy(watched);
+        watched = NULL;
+    }
+    g_free(slice_wd);
+    slice_wd = NULL;
+    root_wd = -1;
+    subscribed = 0;
+    on_state = NULL;
+}
+
+// Watch the slice of a profile root if it exists, then the unit cgroups already in it
+static void watch_slice(int root)
+{
+    GHashTableIter iter;
+    struct cgroup_unit *unit;
+    gchar *path;
+    int root_fd;
+
+    if (slice_wd[root] >= 0) {
+        return;
+    }
+    path = g_build_filename(cgroup_root(), roots[root].slice, NULL);
+    slice_wd[root] = inotify_add_watch(inotify_fd, path, IN_CREATE | IN_DELETE | IN_ONLYDIR);
+    g_free(path);
+    if (slice_wd[root] < 0) {
+        return;
+    }
+
+    root_fd = open_root();
+    g_hash_table_iter_init(&iter, watched);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&unit)) {
+        if (profiles_root_of(unit->name) == &roots[root]) {
+            watch_unit(unit);
+            refresh(unit, root_fd);
+        }
+    }
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+}
+
+static void watch_unit(struct cgroup_unit *unit)
+{
+    char path[PATH_MAX];
+    int len;
+
+    if (unit->wd >= 0 || slice_wd[profiles_root_of(unit->name) - roots] < 0) {
+        return;
+    }
+    len = snprintf(path, sizeof(path), "%s/", cgroup_root());
+    if (len >= sizeof(path) || unit_path(unit->name, path + len, sizeof(path) - len) < 0) {
+        return;
+    }
+    unit->wd = inotify_add_watch(inotify_fd, path, IN_MODIFY);
+    if (unit->wd >= 0) {
+        g_hash_table_insert(by_wd, GINT_TO_POINTER(unit->wd), unit);
+    }
+}
+
+static void unwatch_unit(struct cgroup_unit *unit)
+{
+    if (unit->wd >= 0) {
+        g_hash_table_remove(by_wd, GINT_TO_POINTER(unit->wd));
+        inotify_rm_watch(inotify_fd, unit->wd);
+        unit->wd = -1;
+    }
+}
+
+// Push the unit's state if it changed
+static void refresh(struct cgroup_unit *unit, int root_fd)
+{
+    int active = read_populated(root_fd, unit->name);
+
+    if (active != unit->active) {
+        unit->active = active;
+        if (on_state) {
+            on_state(unit->name, active, 0, callback_data);
+        }
+    }
+}
+
+// Profile root whose slice is watched by wd, -1 if none
+static int slice_of_wd(int wd)
+{
+    int i;
+
+    for (i = 0; i < root_count; i++) {
+        if (slice_wd[i] == wd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static gboolean on_inotify(gint fd, GIOCondition condition, gpointer data)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    struct cgroup_unit *unit;
+    int root_fd = open_root();
+    ssize_t len;
+    char *p;
+    int i;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)p;
+
+            if (event->wd == root_wd) {
+                // A slice appeared
+                for (i = 0; event->len && i < root_count; i++) {
+                    if (strcmp(event->name, roots[i].slice) == 0) {
+                        watch_slice(i);
+                    }
+                }
+                continue;
+            }
+
+            if ((i = slice_of_wd(event->wd)) >= 0) {
+                gchar *vpn_name;
+
+                if (event->mask & IN_IGNORED) {
+                    // The slice is gone and with it every unit cgroup in it
+                    slice_wd[i] = -1;
+                } else if (event->len && (vpn_name = profiles_name_of_unit(event->name)) != NULL) {
+                    if ((unit = g_hash_table_lookup(watched, vpn_name)) != NULL) {
+                        if (event->mask & IN_CREATE) {
+                            watch_unit(unit);
+                        }
+                        refresh(unit, root_fd);
+                    }
+                    g_free(vpn_name);
+                }
+            } else if ((unit = g_hash_table_lookup(by_wd, GINT_TO_POINTER(event->wd))) != NULL) {
+                if (event->mask & IN_IGNORED) {
+                    // The cgroup was removed, the unit has stopped
+                    g_hash_table_remove(by_wd, GINT_TO_POINTER(unit->wd));
+                    unit->wd = -1;
+                }
+                refresh(unit, root_fd);
+            }
+        }
+    }
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void free_unit(gpointer data)
+{
+    struct cgroup_unit *unit = data;
+
+    g_free(unit->name);
+    g_free(unit);
+}
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+
+/*
+ * In-memory backend for benchmarks and for exercising the UI without root
+ * or real units. It serves profiles fake-0000 ... fake-NNNN, every third
+ * of them initially ON. Start/stop jobs complete after a configurable
+ * latency and fail with a configurable probability; the random sequence
+ * is seeded with a constant, so a run is reproducible.
+ *
+ * Configured by backend_fake_configure() or the environment variables
+ * OPENVPN_TRAY_FAKE_PROFILES, OPENVPN_TRAY_FAKE_LATENCY (milliseconds)
+ * and OPENVPN_TRAY_FAKE_FAILURES (percent). OPENVPN_TRAY_FAKE_PROBE_LATENCY
+ * (milliseconds) or backend_fake_set_probe_latency() make every probe
+ * take that long, like systemd under load.
+ *
+ * Probes run on the probe worker, so the units are guarded by a lock.
+ */
+
+#define FAKE_DEFAULT_PROFILES 20
+#define FAKE_DEFAULT_LATENCY 500
+#define FAKE_SEED 0x6f76706e
+
+struct fake_unit {
+    char *name;
+    int active;
+    int transitioning;
+};
+
+struct fake_job {
+    char *vpn_name;
+    int target;
+    int fail;
+    backend_done_cb done_cb;
+    gpointer data;
+};
+
+static GHashTable *units = NULL;        // VPN name -> struct fake_unit
+static int profile_count = -1;
+static int latency_ms = FAKE_DEFAULT_LATENCY;
+static int failure_percent = 0;
+static int probe_latency_ms = 0;
+static GMutex lock;                     // Guards units and the settings above
+static GRand *job_rand = NULL;
+static backend_state_cb on_state = NULL;
+static gpointer callback_data = NULL;
+static int subscribed = 0;
+
+static void ensure_units(void);
+static int env_int(const char *name, int fallback);
+static void free_unit(gpointer data);
+static int fake_enumerate(GPtrArray *names);
+static int fake_probe(struct vpn_probe *probes, int count, int all);
+static int fake_start(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static int fake_stop(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static int submit(const char *vpn_name, int target, backend_done_cb done_cb, gpointer data);
+static gboolean on_job_done(gpointer data);
+static void fake_subscribe(backend_state_cb state_cb, backend_ready_cb ready_cb, gpointer data);
+static void fake_watch_units(const char *names[], int count);
+static int fake_is_subscribed(void);
+static const char *fake_profile_dir(void);
+static void fake_cleanup(void);
+
+const struct vpn_backend backend_fake = {
+    .name = "fake",
+    .profile_dir = fake_profile_dir,
+    .enumerate = fake_enumerate,
+    .probe = fake_probe,
+    .start = fake_start,
+    .stop = fake_stop,
+    .subscribe = fake_subscribe,
+    .watch_units = fake_watch_units,
+    .is_subscribed = fake_is_subscribed,
+    .cleanup = fake_cleanup,
+};
+
+/*
+ * Set the number of profiles, the job latency and the job failure rate.
+ * Takes effect on the next enumerate; existing units keep their state.
+ */
+void backend_fake_configure(int profiles, int latency, int failures)
+{
+    g_mutex_lock(&lock);
+    profile_count = profiles;
+    latency_ms = latency;
+    failure_percent = failures;
+    ensure_units();
+    g_mutex_unlock(&lock);
+}
+
+void backend_fake_set_probe_latency(int latency)
+{
+    g_mutex_lock(&lock);
+    ensure_units();
+    probe_latency_ms = latency;
+    g_mutex_unlock(&lock);
+}
+
+// Change a unit's state behind the tray's back, like an external systemctl
+void backend_fake_set_state(const char *vpn_name, int active)
+{
+    struct fake_unit *unit;
+    int changed;
+
+    g_mutex_lock(&lock);
+    ensure_units();
+    unit = g_hash_table_lookup(units, vpn_name);
+    changed = unit != NULL && unit->active != active;
+    if (changed) {
+        unit->active = active;
+    }
+    g_mutex_unlock(&lock);
+
+    if (changed && subscribed && on_state) {
+        on_state(vpn_name, active, 0, callback_data);
+    }
+}
+
+// Called with the lock held
+static void ensure_units(void)
+{
+    int i;
+
+    if (profile_count < 0) {
+        profile_count = env_int("OPENVPN_TRAY_FAKE_PROFILES", FAKE_DEFAULT_PROFILES);
+        latency_ms = env_int("OPENVPN_TRAY_FAKE_LATENCY", FAKE_DEFAULT_LATENCY);
+        failure_percent = env_int("OPENVPN_TRAY_FAKE_FAILURES", 0);
+        probe_latency_ms = env_int("OPENVPN_TRAY_FAKE_PROBE_LATENCY", 0);
+    }
+    if (units == NULL) {
+        units = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_unit);
+        job_rand = g_rand_new_with_seed(FAKE_SEED);
+    }
+
+    for (i = g_hash_table_size(units); i < profile_count; i++) {
+        struct fake_unit *unit = g_new0(struct fake_unit, 1);
+
+        unit->name = g_strdup_printf("fake-%04d", i);
+        unit->active = i % 3 == 0;
+        g_hash_table_insert(units, unit->name, unit);
+    }
+}
+
+static int env_int(const char *name, int fallback)
+{
+    const char *env = getenv(name);
+
+    return (env != NULL && *env != '\0') ? atoi(env) : fallback;
+}
+
+static void free_unit(gpointer data)
+{
+    struct fake_unit *unit = data;
+
+    g_free(unit->name);
+    g_free(unit);
+}
+
+static const char *fake_profile_dir(void)
+{
+    return NULL;
+}
+
+static int fake_enumerate(GPtrArray *names)
+{
+    int count, i;
+
+    g_mutex_lock(&lock);
+    ensure_units();
+    count = profile_count;
+    g_mutex_unlock(&lock);
+
+    for (i = 0; i < count; i++) {
+        g_ptr_array_add(names, g_strdup_printf("fake-%04d", i));
+    }
+    return BACKEND_OK;
+}
+
+static int fake_probe(struct vpn_probe *probes, int count, int all)
+{
+    struct fake_unit *unit;
+    int latency, i;
+
+    g_mutex_lock(&lock);
+    ensure_units();
+    latency = probe_latency_ms;
+    for (i = 0; i < count; i++) {
+        unit = g_hash_table_lookup(units, probes[i].name);
+        probes[i].state = unit ? unit->active : 0;
+        probes[i].transitioning = unit ? unit->transitioning : 0;
+    }
+    g_mutex_unlock(&lock);
+
+    if (latency > 0) {
+        g_usleep((gulong)latency * 1000);
+    }
+    return BACKEND_OK;
+}
+
+static int fake_start(const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    return submit(vpn_name, 1, done_cb, data);
+}
+
+static int fake_stop(const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    return submit(vpn_name, 0, done_cb, data);
+}
+
+static int submit(const char *vpn_name, int target, backend_done_cb done_cb, gpointer data)
+{
+    struct fake_job *job;
+    struct fake_unit *unit;
+
+    g_mutex_lock(&lock);
+    ensure_units();
+    if ((unit = g_hash_table_lookup(units, vpn_name)) == NULL) {
+        g_mutex_unlock(&lock);
+        g_print("%s: ERROR: Unable to %s VPN %s: no such unit\n", APP_NAME, target ? "start" : "stop", vpn_name);
+        return -1;
+    }
+
+    job = g_new0(struct fake_job, 1);
+    job->vpn_name = g_strdup(vpn_name);
+    job->target = target;
+    job->fail = g_rand_int_range(job_rand, 0, 100) < failure_percent;
+    job->done_cb = done_cb;
+    job->data = data;
+
+    unit->transitioning = 1;
+    g_timeout_add(latency_ms, on_job_done, job);
+    g_mutex_unlock(&lock);
+    return 0;
+}
+
+static gboolean on_job_done(gpointer data)
+{
+    struct fake_job *job = data;
+    struct fake_unit *unit;
+
+    g_mutex_lock(&lock);
+    if (units && (unit = g_hash_table_lookup(units, job->vpn_name)) != NULL) {
+        unit->transitioning = 0;
+    }
+    g_mutex_unlock(&lock);
+    if (job->fail) {
+        g_print("%s: ERROR: Unable to %s VPN %s: injected failure\n", APP_NAME,
+                job->target ? "start" : "stop", job->vpn_name);
+    } else {
+        backend_fake_set_state(job->vpn_name, job->target);
+    }
+
+    job->done_cb(!job->fail, job->data);
+    g_free(job->vpn_name);
+    g_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void fake_subscribe(backend_state_cb state_cb, backend_ready_cb ready_cb, gpointer data)
+{
+    on_state = state_cb;
+    callback_data = data;
+    subscribed = 1;
+    if (ready_cb) {
+        ready_cb(data);
+    }
+}
+
+// Every unit is watched, there is nothing to set up
+static void fake_watch_units(const char *names[], int count)
+{
+}
+
+static int fake_is_subscribed(void)
+{
+    return subscribed;
+}
+
+static void fake_cleanup(void)
+{
+    g_mutex_lock(&lock);
+    if (units) {
+        g_hash_table_destroy(units);
+        units = NULL;
+    }
+    if (job_rand) {
+        g_rand_free(job_rand);
+        job_rand = NULL;
+    }
+    g_mutex_unlock(&lock);
+    subscribed = 0;
+    on_state = NULL;
+}
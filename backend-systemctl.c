@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <gio/gio.h>
+#include "openvpn-tray.h"
+#include "systemd-dbus.h"
+#include "profiles.h"
+#include "backend.h"
+
+/*
+ * The systemd backend: profiles are the *.conf files of the configuration
+ * directory and its client/ and server/ subdirectories (profiles.c),
+ * states are queried with systemctl and pushed by systemd over D-Bus
+ * (systemd-dbus.c), start/stop run systemctl as a child process.
+ */
+
+struct systemctl_job {
+    char *vpn_name;
+    const char *verb;
+    backend_done_cb done_cb;
+    gpointer data;
+};
+
+static const char *systemctl_profile_dir(void);
+static int systemctl_enumerate(GPtrArray *names);
+static int systemctl_probe(struct vpn_probe *units, int count, int all);
+static int systemctl_start(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static int systemctl_stop(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static int run_job(const char *verb, const char *vpn_name, backend_done_cb done_cb, gpointer data);
+static void on_job_exited(GObject *source, GAsyncResult *result, gpointer data);
+
+const struct vpn_backend backend_systemctl = {
+    .name = "systemctl",
+    .profile_dir = systemctl_profile_dir,
+    .enumerate = systemctl_enumerate,
+    .probe = systemctl_probe,
+    .start = systemctl_start,
+    .stop = systemctl_stop,
+    .subscribe = systemd_dbus_init,
+    .watch_units = systemd_dbus_sync_units,
+    .is_subscribed = systemd_dbus_is_active,
+    .cleanup = systemd_dbus_cleanup,
+};
+
+/*
+ * Directory holding the *.conf profiles, OPENVPN_CONF_DIR unless overridden
+ * by the OPENVPN_TRAY_CONF_DIR environment variable.
+ */
+static const char *systemctl_profile_dir(void)
+{
+    static const char *conf_dir = NULL;
+
+    if (conf_dir == NULL) {
+        const char *env = getenv("OPENVPN_TRAY_CONF_DIR");
+
+        conf_dir = (env != NULL && *env != '\0') ? env : OPENVPN_CONF_DIR;
+    }
+    return conf_dir;
+}
+
+static int systemctl_enumerate(GPtrArray *names)
+{
+    const char *conf_dir = systemctl_profile_dir();
+    int ret = profiles_scan(conf_dir, names);
+
+    if (ret == BACKEND_ERR_NO_DIR) {
+        g_print("%s: ERROR: OpenVPN directory does not exist: %s\n", APP_NAME, conf_dir);
+    } else if (ret == BACKEND_ERR_READ_DIR) {
+        g_print("%s: ERROR: Unable to read OpenVPN directory: %s\n", APP_NAME, conf_dir);
+    }
+    return ret;
+}
+
+/*
+ * Query the state of the given VPNs with a single systemctl call, so the
+ * cost of one probe does not grow with the number of units in it. Units
+ * which are not loaded are not listed and are reported OFF; if systemctl
+ * cannot be run or fails, nothing is reported at all.
+ */
+static int systemctl_probe(struct vpn_probe *units, int count, int all)
+{
+    const char *args[] = { "systemctl", "list-units", "--all", "--plain", "--full", "--no-legend", "--no-pager" };
+    GPtrArray *argv;
+    GHashTable *by_name;
+    gchar *output = NULL;
+    GError *error = NULL;
+    gchar **lines;
+    const struct profile_root *roots;
+    int root_count;
+    int status;
+    int i;
+
+    // Without unit names systemctl would list every unit
+    if (count == 0) {
+        return BACKEND_OK;
+    }
+    argv = g_ptr_array_new_with_free_func(g_free);
+    by_name = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (i = 0; i < G_N_ELEMENTS(args); i++) {
+        g_ptr_array_add(argv, g_strdup(args[i]));
+    }
+
+    for (i = 0; i < count; i++) {
+        g_hash_table_insert(by_name, (gpointer)units[i].name, &units[i]);
+        if (!all) {
+            g_ptr_array_add(argv, profiles_unit_name(units[i].name));
+        }
+    }
+    if (all) {
+        roots = profiles_roots(&root_count);
+        for (i = 0; i < root_count; i++) {
+            g_ptr_array_add(argv, g_strconcat(roots[i].unit_prefix, "*", NULL));
+        }
+    }
+    g_ptr_array_add(argv, NULL);
+
+    __atomic_add_fetch(&backend_spawn_count, 1, __ATOMIC_RELAXED);
+    if (!g_spawn_sync(NULL, (gchar **)argv->pdata, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL,
+                      NULL, NULL, &output, NULL, &status, &error)) {
+        g_print("%s: ERROR: Unable to query VPN states: %s\n", APP_NAME, error->message);
+        g_error_free(error);
+        g_hash_table_destroy(by_name);
+        g_ptr_array_free(argv, TRUE);
+        return BACKEND_ERR_PROBE;
+    }
+    g_ptr_array_free(argv, TRUE);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        g_print("%s: ERROR: Unable to query VPN states: systemctl failed\n", APP_NAME);
+        g_free(output);
+        g_hash_table_destroy(by_name);
+        return BACKEND_ERR_PROBE;
+    }
+
+    // Only now that the output can be trusted: what is not listed is OFF
+    for (i = 0; i < count; i++) {
+        units[i].state = 0;
+        units[i].transitioning = 0;
+    }
+
+    // Each line reads: UNIT LOAD ACTIVE SUB DESCRIPTION
+    lines = g_strsplit(output, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        char unit[256], load[32], active[32];
+        struct vpn_probe *probe;
+        gchar *vpn_name;
+
+        if (sscanf(lines[i], "%255s %31s %31s", unit, load, active) != 3 ||
+            (vpn_name = profiles_name_of_unit(unit)) == NULL) {
+            continue;
+        }
+
+        if ((probe = g_hash_table_lookup(by_name, vpn_name)) != NULL) {
+            probe->state = strcmp(active, "active") == 0 || strcmp(active, "reloading") == 0;
+            probe->transitioning = strcmp(active, "activating") == 0
+                || strcmp(active, "deactivating") == 0 || strcmp(active, "reloading") == 0;
+        }
+        g_free(vpn_name);
+    }
+
+    g_strfreev(lines);
+    g_free(output);
+    g_hash_table_destroy(by_name);
+    return BACKEND_OK;
+}
+
+static int systemctl_start(const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    return run_job("start", vpn_name, done_cb, data);
+}
+
+static int systemctl_stop(const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    return run_job("stop", vpn_name, done_cb, data);
+}
+
+// Run "systemctl start|stop" without waiting for it to exit
+static int run_job(const char *verb, const char *vpn_name, backend_done_cb done_cb, gpointer data)
+{
+    struct systemctl_job *job;
+    GError *error = NULL;
+    GSubprocess *proc;
+    char *unit;
+
+    unit = profiles_unit_name(vpn_name);
+    const gchar *argv[] = { "systemctl", verb, unit, NULL };
+    __atomic_add_fetch(&backend_spawn_count, 1, __ATOMIC_RELAXED);
+    proc = g_subprocess_newv(argv, G_SUBPROCESS_FLAGS_STDOUT_SILENCE, &error);
+    g_free(unit);
+
+    if (!proc) {
+        g_print("%s: ERROR: Unable to run systemctl for VPN %s: %s\n", APP_NAME, vpn_name, error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    job = g_new0(struct systemctl_job, 1);
+    job->vpn_name = g_strdup(vpn_name);
+    job->verb = verb;
+    job->done_cb = done_cb;
+    job->data = data;
+    g_subprocess_wait_check_async(proc, NULL, on_job_exited, job);
+    return 0;
+}
+
+static void on_job_exited(GObject *source, GAsyncResult *result, gpointer data)
+{
+    struct systemctl_job *job = data;
+    GError *error = NULL;
+    int success = g_subprocess_wait_check_finish(G_SUBPROCESS(source), result, &error);
+
+    if (!success) {
+        g_print("%s: ERROR: Unable to %s VPN %s: %s\n", APP_NAME, job->verb, job->vpn_name, error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(source);
+    job->done_cb(success, job->data);
+    g_free(job->vpn_name);
+    g_free(job);
+}
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+
+/*
+ * Environment variable selecting the state backend: "systemctl" (default),
+ * "cgroup", which reads states from the cgroup tree (backend-cgroup.c), or
+ * "fake", the in-memory backend of backend-fake.c.
+ */
+#define BACKEND_ENV "OPENVPN_TRAY_BACKEND"
+
+unsigned long backend_spawn_count = 0;
+
+static const struct vpn_backend *backends[] = { &backend_systemctl, &backend_cgroup, &backend_fake };
+
+const struct vpn_backend *backend_get(void)
+{
+    static const struct vpn_backend *backend = NULL;
+    const char *env;
+    int i;
+
+    if (backend != NULL) {
+        return backend;
+    }
+
+    backend = &backend_systemctl;
+    env = getenv(BACKEND_ENV);
+    if (env != NULL && *env != '\0') {
+        for (i = 0; i < G_N_ELEMENTS(backends); i++) {
+            if (strcmp(env, backends[i]->name) == 0) {
+                backend = backends[i];
+                break;
+            }
+        }
+        if (i == G_N_ELEMENTS(backends)) {
+            g_print("%s: WARNING: Unknown %s=%s, using %s\n", APP_NAME, BACKEND_ENV, env, backend->name);
+        }
+    }
+    return backend;
+}
@@ -0,0 +1,84 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <glib.h>
+
+// Return codes of enumerate()
+#define BACKEND_OK 0
+#define BACKEND_ERR_NO_DIR -1
+#define BACKEND_ERR_READ_DIR -2
+
+// Return code of probe()
+#define BACKEND_ERR_PROBE -3
+
+typedef void (*backend_done_cb)(int success, gpointer data);
+typedef void (*backend_state_cb)(const char *vpn_name, int active, int transitioning, gpointer data);
+typedef void (*backend_ready_cb)(gpointer data);
+
+// One unit of a probe: the name goes in, the state comes out
+struct vpn_probe {
+    const char *name;
+    int state;              // 1 if the unit is active
+    int transitioning;      // Unit is activating, deactivating or reloading
+};
+
+/*
+ * Source of VPN profiles and unit states. Everything above this interface
+ * (the tray, the menu, the job pipeline, logging) works on the registry
+ * only and never knows how states are obtained. All operations must be
+ * implemented. enumerate() and probe() run on the probe worker thread
+ * (prober.c), one at a time, and must not touch the registry or anything
+ * else of the main loop; all other operations are called from the main
+ * loop.
+ */
+struct vpn_backend {
+    const char *name;
+
+    // Directory to monitor for profile changes, NULL if there is none
+    const char *(*profile_dir)(void);
+
+    // Append the names of all profiles to names (char *, owned by the array)
+    int (*enumerate)(GPtrArray *names);
+
+    /*
+     * Fill in state and transitioning of the given units; all is set when
+     * they are every known profile, so the backend may query them in one go.
+     * Returns BACKEND_OK, or BACKEND_ERR_PROBE if the states could not be
+     * obtained, in which case the units must be ignored.
+     */
+    int (*probe)(struct vpn_probe *units, int count, int all);
+
+    /*
+     * Start or stop a VPN asynchronously. done_cb is called once the job
+     * has finished; if 0 is not returned, the job was not started and
+     * done_cb is never called.
+     */
+    int (*start)(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+    int (*stop)(const char *vpn_name, backend_done_cb done_cb, gpointer data);
+
+    /*
+     * Push state changes of the units passed to watch_units() to state_cb.
+     * ready_cb is called once changes are actually delivered, from then on
+     * is_subscribed() returns 1.
+     */
+    void (*subscribe)(backend_state_cb state_cb, backend_ready_cb ready_cb, gpointer data);
+    void (*watch_units)(const char *names[], int count);
+    int (*is_subscribed)(void);
+
+    void (*cleanup)(void);
+};
+
+// Number of processes spawned by backends so far
+extern unsigned long backend_spawn_count;
+
+extern const struct vpn_backend backend_systemctl;
+extern const struct vpn_backend backend_cgroup;
+extern const struct vpn_backend backend_fake;
+
+const struct vpn_backend *backend_get(void);
+
+void backend_fake_configure(int profiles, int latency_ms, int failure_percent);
+void backend_fake_set_state(const char *vpn_name, int active);
+void backend_fake_set_probe_latency(int latency_ms);
+
+#endif
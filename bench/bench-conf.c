@@ -0,0 +1,210 @@
+/*
+ * Benchmark of the profile parser and its cache (conf.c) over generated
+ * profiles: plain ones referring to certificate files, ones with the
+ * usual inline <ca>/<cert>/<key>/<tls-auth> blocks and, for every tenth
+ * profile, a long inline CA bundle. Compared against reading each file
+ * whole and splitting it into lines, which is what the tray did before.
+ *
+ * Phases: baseline (read + split), cold (parse of every profile),
+ * warm (all cached, one stat() each) and churn (1% of the profiles
+ * rewritten, then all looked up again).
+ *
+ * Usage: bench-conf [profiles]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../conf.h"
+
+#define DEFAULT_PROFILES 3000
+#define WARM_ROUNDS 10
+#define CHURN_PERCENT 1
+#define CERT_LINES 30           // Base64 lines of one PEM certificate
+#define LONG_CHAIN_CERTS 40     // Long inline CA bundle, large enough to be mmap()ed
+
+static void append_pem(GString *conf, const char *type, int count, int seed)
+{
+    int i, line;
+
+    for (i = 0; i < count; i++) {
+        g_string_append_printf(conf, "-----BEGIN %s-----\n", type);
+        for (line = 0; line < CERT_LINES; line++) {
+            // 64 characters of base64-looking noise
+            for (int c = 0; c < 64; c++) {
+                g_string_append_c(conf, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+                                  [(seed * 31 + i * 17 + line * 7 + c * 13) & 63]);
+            }
+            g_string_append_c(conf, '\n');
+        }
+        g_string_append_printf(conf, "-----END %s-----\n", type);
+    }
+}
+
+static void write_profile(const char *conf_dir, int i, int port)
+{
+    GString *conf = g_string_new(NULL);
+    gchar *path = g_strdup_printf("%s/site-%05d.conf", conf_dir, i);
+
+    g_string_append_printf(conf,
+                           "# Generated profile %d\n"
+                           "client\n"
+                           "dev tun%d\n"
+                           "proto %s\n"
+                           "remote gw-%05d.vpn.example.com %d\n"
+                           "remote gw-%05d-backup.vpn.example.com %d\n"
+                           "resolv-retry infinite\n"
+                           "nobind\n"
+                           "persist-key\n"
+                           "persist-tun\n"
+                           "remote-cert-tls server\n"
+                           "cipher AES-256-GCM\n"
+                           "verb 3\n",
+                           i, i % 64, i % 2 ? "tcp-client" : "udp", i, port, i, port);
+
+    if (i % 3 == 0) {
+        g_string_append(conf, "ca ca.crt\ncert client.crt\nkey client.key\ntls-auth ta.key 1\n");
+    } else {
+        g_string_append(conf, "key-direction 1\n<ca>\n");
+        append_pem(conf, "CERTIFICATE", i % 10 == 1 ? LONG_CHAIN_CERTS : 1, i);
+        g_string_append(conf, "</ca>\n<cert>\n");
+        append_pem(conf, "CERTIFICATE", 1, i + 1);
+        g_string_append(conf, "</cert>\n<key>\n");
+        append_pem(conf, "PRIVATE KEY", 1, i + 2);
+        g_string_append(conf, "</key>\n<tls-auth>\n");
+        append_pem(conf, "OpenVPN Static key V1", 1, i + 3);
+        g_string_append(conf, "</tls-auth>\n");
+    }
+    g_string_append_printf(conf, "management /run/openvpn/site-%05d.sock unix\n", i);
+
+    g_file_set_contents(path, conf->str, conf->len, NULL);
+    g_free(path);
+    g_string_free(conf, TRUE);
+}
+
+// The previous approach: read the whole file, split into lines, track inline blocks
+static int baseline_parse(const char *path)
+{
+    gchar *contents = NULL;
+    gchar **lines;
+    int inline_block = 0;
+    int found = 0;
+    int i;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        return 0;
+    }
+    lines = g_strsplit(contents, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        char *line = g_strstrip(lines[i]);
+
+        if (line[0] == '<') {
+            inline_block = line[1] != '/';
+            continue;
+        }
+        if (!inline_block && (strncmp(line, "remote ", 7) == 0 || strncmp(line, "dev ", 4) == 0 ||
+                              strncmp(line, "proto ", 6) == 0 || strncmp(line, "management ", 11) == 0)) {
+            found++;
+        }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    return found;
+}
+
+static double per_profile_us(gint64 start, long ops)
+{
+    return (double)(g_get_monotonic_time() - start) / ops;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_PROFILES;
+    gchar *base_dir = g_dir_make_tmp("bench-conf-XXXXXX", NULL);
+    gchar **names = g_new(gchar *, count);
+    guint64 bytes = 0;
+    long checksum = 0;
+    gint64 start;
+    int i, round, churned;
+
+    if (base_dir == NULL || count <= 0) {
+        fprintf(stderr, "Usage: %s [profiles]\n", argv[0]);
+        return 1;
+    }
+    g_setenv("OPENVPN_TRAY_CONF_DIR", base_dir, TRUE);
+    g_setenv("OPENVPN_TRAY_BACKEND", "systemctl", TRUE);
+
+    for (i = 0; i < count; i++) {
+        GStatBuf st;
+        gchar *path;
+
+        write_profile(base_dir, i, 1194);
+        names[i] = g_strdup_printf("site-%05d", i);
+        path = g_strdup_printf("%s/%s.conf", base_dir, names[i]);
+        if (g_stat(path, &st) == 0) {
+            bytes += st.st_size;
+        }
+        g_free(path);
+    }
+    printf("profiles: %d, %.1f MB, %.1f kB average\n", count, bytes / 1e6, bytes / 1e3 / count);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i++) {
+        gchar *path = g_strdup_printf("%s/%s.conf", base_dir, names[i]);
+
+        checksum += baseline_parse(path);
+        g_free(path);
+    }
+    printf("baseline: %8.2f us/profile (read + split)\n", per_profile_us(start, count));
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i++) {
+        const struct conf_info *info = conf_lookup(names[i]);
+
+        // The backup remote, the inline blocks and the proto of odd profiles must not leak in
+        if (info == NULL || info->port != 1194 || info->dev == NULL || info->mgmt_address == NULL ||
+            strstr(info->remote, "backup") != NULL || strcmp(info->proto, i % 2 ? "tcp-client" : "udp") != 0) {
+            fprintf(stderr, "bad parse of %s\n", names[i]);
+            return 1;
+        }
+    }
+    printf("cold:     %8.2f us/profile (read or mmap + parse)\n", per_profile_us(start, count));
+
+    start = g_get_monotonic_time();
+    for (round = 0; round < WARM_ROUNDS; round++) {
+        for (i = 0; i < count; i++) {
+            checksum += conf_lookup(names[i])->port;
+        }
+    }
+    printf("warm:     %8.2f us/profile (cached, stat only)\n", per_profile_us(start, (long)count * WARM_ROUNDS));
+
+    churned = MAX(count * CHURN_PERCENT / 100, 1);
+    for (i = 0; i < churned; i++) {
+        write_profile(base_dir, i * (count / churned), 1195);
+    }
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i++) {
+        const struct conf_info *info = conf_lookup(names[i]);
+
+        if (info->port != (i % (count / churned) == 0 && i / (count / churned) < churned ? 1195 : 1194)) {
+            fprintf(stderr, "stale cache entry for %s\n", names[i]);
+            return 1;
+        }
+    }
+    printf("churn:    %8.2f us/profile (%d rewritten)\n", per_profile_us(start, count), churned);
+
+    conf_cleanup();
+    for (i = 0; i < count; i++) {
+        gchar *path = g_strdup_printf("%s/%s.conf", base_dir, names[i]);
+
+        g_unlink(path);
+        g_free(path);
+        g_free(names[i]);
+    }
+    g_rmdir(base_dir);
+    g_free(base_dir);
+    g_free(names);
+
+    return checksum == -1;
+}
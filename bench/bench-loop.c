@@ -0,0 +1,161 @@
+/*
+ * Main-loop latency while probes are slow. The fake backend answers every
+ * probe after a fixed delay, like systemd during boot or with a busy D-Bus
+ * broker, and a 10 ms tick stands in for the events the tray has to
+ * handle, such as a click on the icon: how late each tick is dispatched is
+ * how long the menu popup would wait.
+ *
+ * "inline" rescans and probes in a timer callback on the main loop, the
+ * way the tray used to (vpnlist_scan() and vpnlist_probe()). "worker"
+ * hands the same work to the probe worker and applies the result from its
+ * idle callback (prober.c and vpnlist_apply()).
+ *
+ * Reported per mode: probe cycles run and p50, p99 and max tick lateness.
+ *
+ * Usage: bench-loop [-l probe_ms] [-c cycles] [profiles]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib.h>
+#include "../openvpn-tray.h"
+#include "../registry.h"
+#include "../changes.h"
+#include "../vpnlist.h"
+#include "../backend.h"
+#include "../prober.h"
+
+#define DEFAULT_PROFILES 100
+#define DEFAULT_PROBE_MS 1000
+#define DEFAULT_CYCLES 3
+#define TICK_MS 10
+#define CYCLE_GAP_MS 200    // Between the end of one probe cycle and the next
+
+// Globals otherwise owned by openvpn-tray.c
+time_t last_log_time = 0;
+int first_run = 1;
+int read_only_mode = 1;
+
+static GMainLoop *loop = NULL;
+static GArray *lateness = NULL;     // gint64 us, one per tick
+static gint64 tick_due = 0;
+static int cycles_left = 0;
+
+static gboolean on_tick(gpointer data)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 late = MAX(now - tick_due, 0);
+
+    g_array_append_val(lateness, late);
+    tick_due = now + TICK_MS * 1000;
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_inline_due(gpointer data)
+{
+    vpnlist_scan(NULL, NULL, NULL);
+    vpnlist_probe(NULL, -1);
+    changes_commit();
+
+    if (--cycles_left == 0) {
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_worker_due(gpointer data)
+{
+    prober_rescan();
+    return G_SOURCE_REMOVE;
+}
+
+static void on_probe_done(const struct probe_result *result, gpointer data)
+{
+    vpnlist_apply(result, NULL, NULL, NULL);
+    changes_commit();
+
+    if (--cycles_left == 0) {
+        g_main_loop_quit(loop);
+    } else {
+        g_timeout_add(CYCLE_GAP_MS, on_worker_due, NULL);
+    }
+}
+
+static int compare_us(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void run(const char *mode, int worker, int profiles, int probe_ms, int cycles)
+{
+    guint tick_id;
+    gint64 *late;
+    guint n;
+
+    backend_fake_configure(profiles, 0, 0);
+    backend_fake_set_probe_latency(probe_ms);
+    lateness = g_array_new(FALSE, FALSE, sizeof(gint64));
+    loop = g_main_loop_new(NULL, FALSE);
+    cycles_left = cycles;
+
+    tick_due = g_get_monotonic_time() + TICK_MS * 1000;
+    tick_id = g_timeout_add(TICK_MS, on_tick, NULL);
+    if (worker) {
+        prober_init(on_probe_done, NULL);
+        g_timeout_add(CYCLE_GAP_MS, on_worker_due, NULL);
+    } else {
+        g_timeout_add(CYCLE_GAP_MS, on_inline_due, NULL);
+    }
+    g_main_loop_run(loop);
+
+    g_source_remove(tick_id);
+    if (worker) {
+        prober_cleanup();
+    }
+
+    late = (gint64 *)lateness->data;
+    n = lateness->len;
+    qsort(late, n, sizeof(gint64), compare_us);
+    printf("%-8s %7d %7u %9.1f %9.1f %9.1f\n", mode, cycles, n,
+           n ? late[n / 2] / 1000.0 : 0.0, n ? late[n * 99 / 100] / 1000.0 : 0.0,
+           n ? late[n - 1] / 1000.0 : 0.0);
+
+    g_array_free(lateness, TRUE);
+    g_main_loop_unref(loop);
+    registry_clear();
+    changes_cleanup();
+    backend_get()->cleanup();
+}
+
+int main(int argc, char *argv[])
+{
+    int profiles = DEFAULT_PROFILES;
+    int probe_ms = DEFAULT_PROBE_MS;
+    int cycles = DEFAULT_CYCLES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:c:")) != -1) {
+        if (opt == 'l' && atoi(optarg) >= 0) {
+            probe_ms = atoi(optarg);
+        } else if (opt == 'c' && atoi(optarg) > 0) {
+            cycles = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-l probe_ms] [-c cycles] [profiles]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc && atoi(argv[optind]) > 0) {
+        profiles = atoi(argv[optind]);
+    }
+    g_setenv("OPENVPN_TRAY_BACKEND", "fake", TRUE);
+
+    printf("%d profiles, probes take %d ms, tick every %d ms, lateness in ms\n", profiles, probe_ms, TICK_MS);
+    printf("%-8s %7s %7s %9s %9s %9s\n", "mode", "cycles", "ticks", "p50", "p99", "max");
+    run("inline", 0, profiles, probe_ms, cycles);
+    run("worker", 1, profiles, probe_ms, cycles);
+
+    return 0;
+}
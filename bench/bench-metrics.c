@@ -0,0 +1,204 @@
+/*
+ * Benchmark of the metrics endpoint (metrics.c) over generated profiles:
+ * rendering the exposition with every VPN to render (cold), with nothing
+ * changed since the last render (idle), after one VPN changed state
+ * (one change), and a full HTTP scrape from a client on loopback TCP.
+ * The scrapes also check the response: status line, one up series per
+ * VPN and the histogram of the probes.
+ *
+ * Usage: bench-metrics [profiles]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "../registry.h"
+#include "../changes.h"
+#include "../history.h"
+#include "../stats.h"
+#include "../metrics.h"
+
+#define DEFAULT_PROFILES 1000
+#define ROUNDS 1000
+#define SCRAPES 100
+
+struct scrape {
+    guint16 port;
+    int count;              // Scrapes to run
+    int failed;
+    gint64 elapsed_us;
+    gchar *last;            // Last response
+    volatile int done;
+};
+
+// A free loopback port; the tiny window before metrics_init() binds it is fine here
+static guint16 free_port(void)
+{
+    GSocket *socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL);
+    GSocketAddress *address = g_inet_socket_address_new_from_string("127.0.0.1", 0);
+    GSocketAddress *bound;
+    guint16 port = 0;
+
+    if (socket && g_socket_bind(socket, address, TRUE, NULL) &&
+        (bound = g_socket_get_local_address(socket, NULL)) != NULL) {
+        port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound));
+        g_object_unref(bound);
+    }
+    g_object_unref(address);
+    if (socket) {
+        g_object_unref(socket);
+    }
+    return port;
+}
+
+// Blocking HTTP client, runs on its own thread while the main loop serves
+static gpointer run_scrapes(gpointer data)
+{
+    static const char request[] = "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: bench-metrics\r\n\r\n";
+    struct scrape *scrape = data;
+    GSocketClient *client = g_socket_client_new();
+    gint64 start = g_get_monotonic_time();
+    int i;
+
+    for (i = 0; i < scrape->count; i++) {
+        GSocketConnection *connection = g_socket_client_connect_to_host(client, "127.0.0.1", scrape->port, NULL, NULL);
+        GString *response = g_string_new(NULL);
+        char buf[65536];
+        gssize len;
+
+        if (connection == NULL ||
+            !g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(connection)),
+                                       request, sizeof(request) - 1, NULL, NULL, NULL)) {
+            scrape->failed++;
+        } else {
+            while ((len = g_input_stream_read(g_io_stream_get_input_stream(G_IO_STREAM(connection)),
+                                              buf, sizeof(buf), NULL, NULL)) > 0) {
+                g_string_append_len(response, buf, len);
+            }
+        }
+        if (connection) {
+            g_object_unref(connection);
+        }
+        g_free(scrape->last);
+        scrape->last = g_string_free(response, FALSE);
+    }
+
+    scrape->elapsed_us = g_get_monotonic_time() - start;
+    g_object_unref(client);
+    scrape->done = 1;
+    g_main_context_wakeup(NULL);
+    return NULL;
+}
+
+static int count_lines(const char *text, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    const char *line;
+    int count = 0;
+
+    for (line = text; *line; line++) {
+        count += strncmp(line, prefix, len) == 0;
+        if ((line = strchr(line, '\n')) == NULL) {
+            break;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_PROFILES;
+    struct scrape scrape = { 0 };
+    GString *out = g_string_new(NULL);
+    struct vpn_entry *entry;
+    gchar *address;
+    GThread *thread;
+    gint64 start, cold_us, idle_us, change_us;
+    int i, round;
+
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [profiles]\n", argv[0]);
+        return 1;
+    }
+
+    stats_init(0, NULL);
+    changes_listen(history_apply_changes, NULL);
+    changes_listen(metrics_apply_changes, NULL);
+    for (i = 0; i < count; i++) {
+        gchar *name = g_strdup_printf(i % 3 ? "site-%05d" : "client/site-%05d", i);
+        int vpn_index = registry_add(name);
+
+        history_attach(vpn_index);
+        registry_get(vpn_index)->state = i % 4 == 0;
+        changes_added(vpn_index);
+        g_free(name);
+    }
+    changes_commit();
+    for (i = 0; i < ROUNDS; i++) {
+        stats_record(STATS_PROBE, g_random_int_range(200, 50000));
+    }
+
+    start = g_get_monotonic_time();
+    metrics_render(out);
+    cold_us = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    for (round = 0; round < ROUNDS; round++) {
+        g_string_truncate(out, 0);
+        metrics_render(out);
+    }
+    idle_us = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    for (round = 0; round < ROUNDS; round++) {
+        int vpn_index = round % count;
+
+        entry = registry_get(vpn_index);
+        entry->state = !entry->state;
+        changes_check(vpn_index);
+        changes_commit();
+        g_string_truncate(out, 0);
+        metrics_render(out);
+    }
+    change_us = g_get_monotonic_time() - start;
+
+    printf("profiles: %d, exposition %.1f kB, %d lines\n", count, out->len / 1e3, count_lines(out->str, ""));
+    printf("cold:       %8.1f us/render (every VPN rendered)\n", (double)cold_us);
+    printf("idle:       %8.1f us/render (nothing changed)\n", (double)idle_us / ROUNDS);
+    printf("one change: %8.1f us/render (state flip + commit + render)\n", (double)change_us / ROUNDS);
+
+    scrape.port = free_port();
+    scrape.count = SCRAPES;
+    address = g_strdup_printf("127.0.0.1:%u", scrape.port);
+    if (scrape.port == 0 || metrics_init(address) < 0) {
+        fprintf(stderr, "unable to listen on %s\n", address);
+        return 1;
+    }
+    thread = g_thread_new("scrape", run_scrapes, &scrape);
+    while (!scrape.done) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_thread_join(thread);
+    printf("scrape:     %8.1f us/scrape (HTTP over loopback, %d scrapes)\n",
+           (double)scrape.elapsed_us / SCRAPES, SCRAPES);
+
+    if (scrape.failed || scrape.last == NULL || strncmp(scrape.last, "HTTP/1.0 200 OK\r\n", 17) != 0 ||
+        count_lines(scrape.last, "openvpn_tray_vpn_up{") != count ||
+        count_lines(scrape.last, "openvpn_tray_duration_seconds_count{path=\"probe\"} ") != 1) {
+        fprintf(stderr, "bad scrape, %d failed\n", scrape.failed);
+        return 1;
+    }
+
+    metrics_cleanup();
+    registry_foreach(i, entry) {
+        history_detach(i);
+    }
+    registry_clear();
+    changes_cleanup();
+    stats_cleanup();
+    g_free(scrape.last);
+    g_free(address);
+    g_string_free(out, TRUE);
+    return 0;
+}
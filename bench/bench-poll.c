@@ -0,0 +1,342 @@
+/*
+ * Headless driver for the discovery and probe path. For each profile count
+ * a synthetic configuration directory is generated, OPENVPN_TRAY_CONF_DIR
+ * points the code at it and bench/systemctl stands in for systemctl with
+ * states scripted here; a small share of the units changes state between
+ * polls. Every poll is a rescan, a full probe, the change set commit with
+ * the logging and history listeners ("log") and the tooltip text, the same
+ * as fetch_vpn_list() minus the GTK calls.
+ *
+ * Reported per poll: wall time of each phase, processes spawned and heap
+ * allocations (malloc, calloc and realloc calls, counted by interposing
+ * the glibc allocator). Syscalls are counted by bench/syscalls.sh, which
+ * runs this driver under strace.
+ *
+ * "cold" is the first poll, which fills the registry: the time until the
+ * menu could show real states at startup. "restore" is loading the same
+ * registry from the state snapshot instead (see snapshot.c), the time
+ * until it shows the last known ones.
+ *
+ * With -f the in-memory fake backend answers instead of systemctl, which
+ * leaves just the cost of the tray's own bookkeeping. With -c the cgroup
+ * backend reads the states from a generated cgroup tree, one
+ * system-openvpn.slice/openvpn@X.service/cgroup.events per unit.
+ *
+ * Usage: bench-poll [-f|-c] [-p polls] [profiles...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../openvpn-tray.h"
+#include "../logging.h"
+#include "../registry.h"
+#include "../changes.h"
+#include "../history.h"
+#include "../vpnlist.h"
+#include "../backend.h"
+#include "../snapshot.h"
+#include "../profiles.h"
+
+#define DEFAULT_POLLS 20
+#define FLIP_PERIOD 100     // One unit in FLIP_PERIOD changes state per poll
+
+// Globals otherwise owned by openvpn-tray.c
+time_t last_log_time = 0;
+int first_run = 1;
+int read_only_mode = 1;
+
+enum phase { PHASE_SCAN, PHASE_PROBE, PHASE_LOG, PHASE_STATUS, PHASE_COUNT };
+
+static unsigned long alloc_count = 0;
+static int use_fake = 0;
+static int use_cgroup = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static void write_states(const char *path, int count, int poll)
+{
+    FILE *fp = fopen(path, "w");
+    int i;
+
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    for (i = 0; i < count; i++) {
+        const char *active = (i + poll) % FLIP_PERIOD == 0 ? "activating" : i % 3 == 0 ? "active" : "inactive";
+
+        fprintf(fp, OPENVPN_UNIT_PREFIX "bench-%06d" OPENVPN_UNIT_SUFFIX " loaded %s %s OpenVPN connection to bench-%06d\n",
+                i, active, strcmp(active, "inactive") == 0 ? "dead" : "running", i);
+    }
+    fclose(fp);
+}
+
+static int unit_active(int i, int poll)
+{
+    return (i + poll) % FLIP_PERIOD == 0 ? i % 3 != 0 : i % 3 == 0;
+}
+
+// States as for the fake backend, only the cgroup.events which changed are rewritten
+static void write_cgroups(const char *root, int count, int poll)
+{
+    const char *slice = profiles_root_of("bench")->slice;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        gchar *dir, *path, *events;
+
+        if (poll > 0 && unit_active(i, poll) == unit_active(i, poll - 1)) {
+            continue;
+        }
+        dir = g_strdup_printf("%s/%s/" OPENVPN_UNIT_PREFIX "bench-%06d" OPENVPN_UNIT_SUFFIX, root, slice, i);
+        path = g_build_filename(dir, "cgroup.events", NULL);
+        events = g_strdup_printf("populated %d\nfrozen 0\n", unit_active(i, poll));
+        g_mkdir_with_parents(dir, 0755);
+        g_file_set_contents(path, events, -1, NULL);
+        g_free(events);
+        g_free(path);
+        g_free(dir);
+    }
+}
+
+static void remove_cgroups(const char *root, int count)
+{
+    const char *slice = profiles_root_of("bench")->slice;
+    gchar *slice_dir = g_build_filename(root, slice, NULL);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        gchar *dir = g_strdup_printf("%s/%s/" OPENVPN_UNIT_PREFIX "bench-%06d" OPENVPN_UNIT_SUFFIX, root, slice, i);
+        gchar *path = g_build_filename(dir, "cgroup.events", NULL);
+
+        g_unlink(path);
+        g_rmdir(dir);
+        g_free(path);
+        g_free(dir);
+    }
+    g_rmdir(slice_dir);
+    g_rmdir(root);
+    g_free(slice_dir);
+}
+
+static void flip_fake(int count, int poll)
+{
+    char name[32];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "fake-%04d", i);
+        backend_fake_set_state(name, unit_active(i, poll));
+    }
+}
+
+static void run(const char *base_dir, int count, int polls)
+{
+    gchar *conf_dir = g_build_filename(base_dir, "conf", NULL);
+    gchar *states = g_build_filename(base_dir, "states", NULL);
+    gchar *cgroup_root = g_build_filename(base_dir, "cgroup", NULL);
+    gint64 elapsed[PHASE_COUNT] = { 0 };
+    gint64 cold = 0, restore;
+    unsigned long spawns = 0, allocs = 0;
+    char tooltip[160];
+    int null_fd, stdout_fd;
+    int poll, i;
+
+    if (use_fake) {
+        backend_fake_configure(count, 0, 0);
+    }
+    g_mkdir_with_parents(conf_dir, 0755);
+    for (i = 0; !use_fake && i < count; i++) {
+        gchar *path = g_strdup_printf("%s/bench-%06d.conf", conf_dir, i);
+
+        g_file_set_contents(path, "client\nremote vpn.example.com 1194\n", -1, NULL);
+        g_free(path);
+    }
+
+    // Log output is part of the measured work, but not of the report
+    fflush(stdout);
+    stdout_fd = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+
+    changes_listen(log_vpn_status_changes, NULL);
+    changes_listen(history_apply_changes, NULL);
+    first_run = 1;
+    last_log_time = 0;
+    for (poll = 0; poll <= polls; poll++) {
+        unsigned long spawns_before = backend_spawn_count;
+        unsigned long allocs_before;
+        gint64 t[PHASE_COUNT + 1];
+
+        if (use_fake) {
+            flip_fake(count, poll);
+        } else if (use_cgroup) {
+            write_cgroups(cgroup_root, count, poll);
+        } else {
+            write_states(states, count, poll);
+        }
+
+        allocs_before = alloc_count;
+        t[PHASE_SCAN] = g_get_monotonic_time();
+        vpnlist_scan(NULL, NULL, NULL);
+        t[PHASE_PROBE] = g_get_monotonic_time();
+        vpnlist_probe(NULL, -1);
+        t[PHASE_LOG] = g_get_monotonic_time();
+        changes_commit();
+        t[PHASE_STATUS] = g_get_monotonic_time();
+        vpnlist_status_text(tooltip, sizeof(tooltip));
+        t[PHASE_COUNT] = g_get_monotonic_time();
+
+        // The first poll fills the registry and is reported on its own
+        if (poll == 0) {
+            cold = t[PHASE_COUNT] - t[PHASE_SCAN];
+            continue;
+        }
+        for (i = 0; i < PHASE_COUNT; i++) {
+            elapsed[i] += t[i + 1] - t[i];
+        }
+        spawns += backend_spawn_count - spawns_before;
+        allocs += alloc_count - allocs_before;
+    }
+
+    // Startup from the snapshot of the final state
+    snapshot_save();
+    registry_clear();
+    changes_cleanup();
+    restore = g_get_monotonic_time();
+    snapshot_load(NULL, NULL);
+    changes_commit();
+    restore = g_get_monotonic_time() - restore;
+    snapshot_cleanup();
+
+    fflush(stdout);
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+    close(null_fd);
+
+    printf("%8d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %7.1f %9.1f\n", count,
+           cold / 1000.0, restore / 1000.0,
+           (elapsed[PHASE_SCAN] + elapsed[PHASE_PROBE] + elapsed[PHASE_LOG] + elapsed[PHASE_STATUS]) / 1000.0 / polls,
+           elapsed[PHASE_SCAN] / 1000.0 / polls, elapsed[PHASE_PROBE] / 1000.0 / polls,
+           elapsed[PHASE_LOG] / 1000.0 / polls, elapsed[PHASE_STATUS] / 1000.0 / polls,
+           (double)spawns / polls, (double)allocs / polls);
+
+    registry_clear();
+    changes_cleanup();
+    backend_get()->cleanup();
+    for (i = 0; !use_fake && i < count; i++) {
+        gchar *path = g_strdup_printf("%s/bench-%06d.conf", conf_dir, i);
+
+        g_unlink(path);
+        g_free(path);
+    }
+    g_rmdir(conf_dir);
+    g_unlink(states);
+    if (use_cgroup) {
+        remove_cgroups(cgroup_root, count);
+    }
+    g_free(conf_dir);
+    g_free(states);
+    g_free(cgroup_root);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int default_counts[] = { 10, 100, 1000, 10000 };
+    int polls = DEFAULT_POLLS;
+    gchar *bench_dir, *base_dir, *conf_dir, *states, *path, *snapshot, *cgroup_root;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "fcp:")) != -1) {
+        if (opt == 'f') {
+            use_fake = 1;
+        } else if (opt == 'c') {
+            use_cgroup = 1;
+        } else if (opt == 'p' && atoi(optarg) > 0) {
+            polls = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-f|-c] [-p polls] [profiles...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The stub systemctl lives next to this binary
+    bench_dir = g_path_get_dirname(argv[0]);
+    if (!g_path_is_absolute(bench_dir)) {
+        gchar *cwd = g_get_current_dir();
+        gchar *abs_dir = g_build_filename(cwd, bench_dir, NULL);
+
+        g_free(cwd);
+        g_free(bench_dir);
+        bench_dir = abs_dir;
+    }
+    path = g_strdup_printf("%s:%s", bench_dir, g_getenv("PATH") ? g_getenv("PATH") : "/usr/bin:/bin");
+    g_setenv("PATH", path, TRUE);
+
+    base_dir = g_dir_make_tmp("bench-poll-XXXXXX", NULL);
+    if (!base_dir) {
+        fprintf(stderr, "Unable to create a temporary directory\n");
+        return 1;
+    }
+    conf_dir = g_build_filename(base_dir, "conf", NULL);
+    states = g_build_filename(base_dir, "states", NULL);
+    g_setenv("OPENVPN_TRAY_CONF_DIR", conf_dir, TRUE);
+    g_setenv("BENCH_STATES", states, TRUE);
+    g_setenv("XDG_CACHE_HOME", base_dir, TRUE);
+    cgroup_root = g_build_filename(base_dir, "cgroup", NULL);
+    g_setenv("OPENVPN_TRAY_CGROUP_ROOT", cgroup_root, TRUE);
+    g_setenv("OPENVPN_TRAY_BACKEND", use_fake ? "fake" : use_cgroup ? "cgroup" : "systemctl", TRUE);
+
+    printf("%s backend, %d polls per profile count, times in ms per poll\n", backend_get()->name, polls);
+    printf("%8s %9s %9s %9s %9s %9s %9s %9s %7s %9s\n",
+           "profiles", "cold", "restore", "poll", "scan", "probe", "log", "status", "spawns", "allocs");
+    if (optind < argc) {
+        for (i = optind; i < argc; i++) {
+            run(base_dir, atoi(argv[i]), polls);
+        }
+    } else {
+        for (i = 0; i < G_N_ELEMENTS(default_counts); i++) {
+            run(base_dir, default_counts[i], polls);
+        }
+    }
+
+    snapshot = g_build_filename(base_dir, APP_NAME, "state", NULL);
+    g_unlink(snapshot);
+    g_free(snapshot);
+    snapshot = g_build_filename(base_dir, APP_NAME, NULL);
+    g_rmdir(snapshot);
+    g_free(snapshot);
+    g_rmdir(base_dir);
+    g_free(base_dir);
+    g_free(conf_dir);
+    g_free(states);
+    g_free(cgroup_root);
+    g_free(bench_dir);
+    g_free(path);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Microbenchmark of the VPN profile registry: insert, lookup by name,
+ * iteration and remove/re-add churn for a large number of profiles.
+ *
+ * Usage: bench-registry [profiles]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include "../registry.h"
+
+#define DEFAULT_PROFILES 10000
+#define LOOKUP_ROUNDS 100
+#define ITERATE_ROUNDS 1000
+
+static double elapsed_ns(gint64 start, long ops)
+{
+    return (g_get_monotonic_time() - start) * 1000.0 / ops;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_PROFILES;
+    char **names = g_new(char *, count);
+    struct vpn_entry *entry;
+    long checksum = 0;
+    gint64 start;
+    int i;
+
+    // Long names, well past the old 31 character limit
+    for (i = 0; i < count; i++) {
+        names[i] = g_strdup_printf("site-to-site-datacenter-%06d-primary-uplink", i);
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i++) {
+        if (registry_add(names[i]) < 0) {
+            fprintf(stderr, "duplicate or truncated name: %s\n", names[i]);
+            return 1;
+        }
+    }
+    printf("profiles: %d\n", registry_count());
+    printf("insert:   %8.1f ns/op\n", elapsed_ns(start, count));
+
+    start = g_get_monotonic_time();
+    for (int round = 0; round < LOOKUP_ROUNDS; round++) {
+        for (i = 0; i < count; i++) {
+            checksum += registry_lookup(names[i]);
+        }
+    }
+    printf("lookup:   %8.1f ns/op\n", elapsed_ns(start, (long)count * LOOKUP_ROUNDS));
+
+    start = g_get_monotonic_time();
+    for (int round = 0; round < ITERATE_ROUNDS; round++) {
+        registry_foreach(i, entry) {
+            checksum += entry->state;
+        }
+    }
+    printf("iterate:  %8.1f ns/entry\n", elapsed_ns(start, (long)count * ITERATE_ROUNDS));
+
+    // Every other profile removed and added back, slots get reused
+    start = g_get_monotonic_time();
+    for (i = 0; i < count; i += 2) {
+        registry_remove(names[i]);
+    }
+    for (i = 0; i < count; i += 2) {
+        registry_add(names[i]);
+    }
+    printf("churn:    %8.1f ns/op\n", elapsed_ns(start, count));
+    printf("slots:    %d (%d live)\n", registry_size(), registry_count());
+
+    registry_clear();
+    for (i = 0; i < count; i++) {
+        g_free(names[i]);
+    }
+    g_free(names);
+
+    return checksum == -1;
+}
@@ -0,0 +1,180 @@
+/*
+ * Benchmark of profile discovery (profiles.c) over a generated profile
+ * directory with client/ and server/ roots, each holding the profiles
+ * plus the certificates, keys and scripts that usually sit next to them.
+ * Compared against what the tray did before: access(), chdir() and glob()
+ * of "*.conf", then strrchr() on every path, done here for all roots.
+ *
+ * Phases: glob (the old scan), cold (first scan, every root read), warm
+ * (roots unchanged, one fstat() each) and touched (one profile added to
+ * client/, so that root is read again on every scan until it settles).
+ *
+ * Usage: bench-scan [profiles]
+ */
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "../backend.h"
+#include "../profiles.h"
+
+#define DEFAULT_PROFILES 3000
+#define ROUNDS 20
+#define AGE 3600                // Seconds the generated roots are backdated by
+
+static const char *subdirs[] = { "", "client", "server" };
+static const char *extras[] = { ".crt", ".key", "-up.sh" };     // Per profile, not profiles
+
+static void touch_file(const char *path)
+{
+    g_file_set_contents(path, "", 0, NULL);
+}
+
+// An old directory, as profile directories are; fresh ones are never cached
+static void backdate(const char *dir)
+{
+    struct utimbuf times;
+
+    times.actime = times.modtime = time(NULL) - AGE;
+    g_utime(dir, &times);
+}
+
+static void make_tree(const char *base_dir, int count)
+{
+    int i, r, e;
+
+    for (r = 0; r < G_N_ELEMENTS(subdirs); r++) {
+        gchar *dir = g_build_filename(base_dir, subdirs[r], NULL);
+
+        g_mkdir_with_parents(dir, 0755);
+        for (i = r; i < count; i += G_N_ELEMENTS(subdirs)) {
+            gchar *path = g_strdup_printf("%s/site-%05d.conf", dir, i);
+
+            touch_file(path);
+            g_free(path);
+            for (e = 0; e < G_N_ELEMENTS(extras); e++) {
+                path = g_strdup_printf("%s/site-%05d%s", dir, i, extras[e]);
+                touch_file(path);
+                g_free(path);
+            }
+        }
+        backdate(dir);
+        g_free(dir);
+    }
+}
+
+static void remove_tree(const char *base_dir)
+{
+    int r;
+
+    for (r = G_N_ELEMENTS(subdirs) - 1; r >= 0; r--) {
+        gchar *dir_path = g_build_filename(base_dir, subdirs[r], NULL);
+        GDir *dir = g_dir_open(dir_path, 0, NULL);
+        const char *entry;
+
+        while (dir && (entry = g_dir_read_name(dir)) != NULL) {
+            gchar *path = g_build_filename(dir_path, entry, NULL);
+
+            if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                g_unlink(path);
+            }
+            g_free(path);
+        }
+        if (dir) {
+            g_dir_close(dir);
+        }
+        g_rmdir(dir_path);
+        g_free(dir_path);
+    }
+}
+
+// The previous approach, one chdir() and glob() per root
+static int glob_scan(const char *base_dir, GPtrArray *names)
+{
+    int r, i;
+
+    if (access(base_dir, F_OK) != 0 || chdir(base_dir) != 0) {
+        return BACKEND_ERR_NO_DIR;
+    }
+    for (r = 0; r < G_N_ELEMENTS(subdirs); r++) {
+        gchar *pattern = g_build_filename(base_dir, subdirs[r], "*.conf", NULL);
+        glob_t glob_result;
+
+        glob(pattern, 0, NULL, &glob_result);
+        g_free(pattern);
+        for (i = 0; i < glob_result.gl_pathc; i++) {
+            char *filename = strrchr(glob_result.gl_pathv[i], '/') + 1;
+
+            if (subdirs[r][0]) {
+                g_ptr_array_add(names, g_strdup_printf("%s/%.*s", subdirs[r], (int)strlen(filename) - 5, filename));
+            } else {
+                g_ptr_array_add(names, g_strndup(filename, strlen(filename) - 5));
+            }
+        }
+        globfree(&glob_result);
+    }
+    return BACKEND_OK;
+}
+
+// Milliseconds per scan of rounds scans, -1 if one of them missed profiles
+static double time_scans(int (*scan)(const char *, GPtrArray *), const char *base_dir, int rounds, int expected)
+{
+    gint64 start = g_get_monotonic_time();
+    int round;
+
+    for (round = 0; round < rounds; round++) {
+        GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+        int found;
+
+        scan(base_dir, names);
+        found = names->len;
+        g_ptr_array_free(names, TRUE);
+        if (found != expected) {
+            fprintf(stderr, "found %d profiles, expected %d\n", found, expected);
+            return -1;
+        }
+    }
+    return (g_get_monotonic_time() - start) / 1e3 / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_PROFILES;
+    gchar *base_dir = g_dir_make_tmp("bench-scan-XXXXXX", NULL);
+    gchar *added;
+    double glob_ms, cold_ms, warm_ms, touched_ms;
+
+    if (base_dir == NULL || count <= 0) {
+        fprintf(stderr, "Usage: %s [profiles]\n", argv[0]);
+        return 1;
+    }
+    make_tree(base_dir, count);
+    printf("profiles: %d in %d roots, %d directory entries\n", count, (int)G_N_ELEMENTS(subdirs),
+           count * (int)(1 + G_N_ELEMENTS(extras)));
+
+    glob_ms = time_scans(glob_scan, base_dir, ROUNDS, count);
+    cold_ms = time_scans(profiles_scan, base_dir, 1, count);
+    warm_ms = time_scans(profiles_scan, base_dir, ROUNDS, count);
+
+    added = g_build_filename(base_dir, "client", "added.conf", NULL);
+    touch_file(added);
+    touched_ms = time_scans(profiles_scan, base_dir, ROUNDS, count + 1);
+    g_unlink(added);
+    g_free(added);
+
+    printf("glob:    %8.3f ms/scan (chdir + glob + strrchr)\n", glob_ms);
+    printf("cold:    %8.3f ms/scan (openat + readdir)\n", cold_ms);
+    printf("warm:    %8.3f ms/scan (cached, fstat only)\n", warm_ms);
+    printf("touched: %8.3f ms/scan (client/ just modified)\n", touched_ms);
+
+    profiles_cleanup();
+    remove_tree(base_dir);
+    g_free(base_dir);
+
+    return glob_ms < 0 || cold_ms < 0 || warm_ms < 0 || touched_ms < 0;
+}
@@ -0,0 +1,136 @@
+#!/bin/sh
+#
+# State events of the systemd backend against bench/mock-systemd on a
+# private session bus (dbus-run-session, OPENVPN_TRAY_SYSTEMD_BUS=session).
+# The mock walks the units of PROFILES profiles one at a time through
+# activating, active, reloading, deactivating and inactive. The stub
+# systemctl on PATH always fails, so every probe is discarded and only
+# LoadUnit, Get and PropertiesChanged can move a state: each step must
+# show up in "openvpn-tray status" within TIMEOUT_MS.
+#
+PROFILES=${PROFILES:-3}
+TIMEOUT_MS=${TIMEOUT_MS:-1000}
+DIR=`cd \`dirname "$0"\` && pwd`
+TRAY="$DIR/../openvpn-tray"
+MOCK="$DIR/mock-systemd"
+
+if [ -z "$DISPLAY" ] && [ -z "$WAYLAND_DISPLAY" ]; then
+    echo "dbus: no display, skipped"
+    exit 0
+fi
+if ! command -v dbus-run-session >/dev/null 2>&1; then
+    echo "dbus: dbus-run-session not found, skipped"
+    exit 0
+fi
+
+# Everything below runs on a bus of its own
+if [ -z "$DBUS_BENCH_SESSION" ]; then
+    export DBUS_BENCH_SESSION=1
+    exec dbus-run-session -- "$0" "$@"
+fi
+
+# Wait up to 5 s for at least COUNT lines matching PATTERN in FILE
+wait_lines() {
+    for i in `seq 1 50`; do
+        [ `grep -c "$2" "$1" 2>/dev/null` -ge $3 ] && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# What the tray shows for a VPN, e.g. "on" or "off busy"
+shown() {
+    "$TRAY" status "$1" | sed -n "s/^vpn $1 //p"
+}
+
+# Set the unit of VPN NAME to STATE in the mock, then wait for the tray to show EXPECTED
+step() {
+    echo "openvpn@$1.service $2" >&3
+    start=`date +%s%N`
+    while :; do
+        got=`shown "$1"`
+        ms=`expr \( \`date +%s%N\` - $start \) / 1000000`
+        [ "$got" = "$3" ] && break
+        if [ $ms -gt $TIMEOUT_MS ]; then
+            echo "dbus: $1 $2: tray shows \"$got\" after $ms ms, expected \"$3\""
+            failed=1
+            return
+        fi
+        sleep 0.01
+    done
+    steps=`expr $steps + 1`
+    [ $ms -gt $max_ms ] && max_ms=$ms
+}
+
+tmp=`mktemp -d`
+mkdir "$tmp/bin" "$tmp/conf"
+cat > "$tmp/bin/systemctl" <<EOF
+#!/bin/sh
+echo "\$*" >> "$tmp/systemctl.calls"
+exit 1
+EOF
+chmod +x "$tmp/bin/systemctl"
+
+names=
+for i in `seq 1 $PROFILES`; do
+    name=`printf "bench-%02d" $i`
+    touch "$tmp/conf/$name.conf"
+    names="$names $name"
+done
+
+failed=0
+steps=0
+max_ms=0
+
+# The first unit starts active, the others inactive
+mkfifo "$tmp/mock.in"
+"$MOCK" openvpn@bench-01.service=active < "$tmp/mock.in" > "$tmp/mock.log" &
+mock=$!
+exec 3> "$tmp/mock.in"
+if ! wait_lines "$tmp/mock.log" "^ready" 1; then
+    echo "dbus: mock systemd did not start"
+    failed=1
+fi
+
+export PATH="$tmp/bin:$PATH" OPENVPN_TRAY_CONF_DIR="$tmp/conf" OPENVPN_TRAY_SYSTEMD_BUS=session
+export OPENVPN_TRAY_CONTROL_SOCKET="$tmp/control.sock" XDG_CACHE_HOME="$tmp"
+"$TRAY" > "$tmp/tray.log" &
+pid=$!
+
+if [ $failed -eq 0 ] && ! { wait_lines "$tmp/mock.log" "^subscribed" 1 && wait_lines "$tmp/mock.log" "^loaded " $PROFILES; }; then
+    echo "dbus: the tray did not subscribe and load every unit"
+    failed=1
+fi
+if [ $failed -eq 0 ]; then
+    # Initial states come from Get, the probes all failed
+    for name in $names; do
+        expected=off
+        [ $name = bench-01 ] && expected=on
+        for i in `seq 1 50`; do
+            [ "`shown $name`" = $expected ] && break
+            sleep 0.1
+        done
+        if [ "`shown $name`" != $expected ]; then
+            echo "dbus: $name: initial state \"`shown $name`\", expected \"$expected\""
+            failed=1
+        fi
+    done
+    for name in $names; do
+        step $name activating "off busy"
+        step $name active on
+        step $name reloading "on busy"
+        step $name active on
+        step $name deactivating "off busy"
+        step $name inactive off
+    done
+fi
+
+exec 3>&-
+kill $pid
+wait $pid $mock 2>/dev/null
+probes=`cat "$tmp/systemctl.calls" 2>/dev/null | grep -c list-units`
+rm -rf "$tmp"
+
+printf "%8s %6s %7s %15s\n" profiles steps max_ms failed_probes
+printf "%8d %6d %7d %15d\n" $PROFILES $steps $max_ms $probes
+exit $failed
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# Main-loop latency of the tray while systemctl is slow. A stub systemctl
+# on PATH sleeps SLOW seconds on every call; the tray probes PROFILES
+# profiles through it for DURATION seconds and, when run as root (the tray
+# is read-only otherwise), starts and stops half of them through the
+# control socket. The stats snapshot taken on SIGUSR1 must then show no
+# stall and no heartbeat later than STATS_STALL_THRESHOLD_MS.
+#
+SLOW=${SLOW:-2}
+DURATION=${DURATION:-10}
+PROFILES=${PROFILES:-20}
+DIR=`cd \`dirname "$0"\` && pwd`
+TRAY="$DIR/../openvpn-tray"
+THRESHOLD_MS=`sed -n "s/^#define STATS_STALL_THRESHOLD_MS //p" "$DIR/../openvpn-tray.h"`
+
+if [ -z "$DISPLAY" ] && [ -z "$WAYLAND_DISPLAY" ]; then
+    echo "latency: no display, skipped"
+    exit 0
+fi
+
+tmp=`mktemp -d`
+mkdir "$tmp/bin" "$tmp/conf"
+cat > "$tmp/bin/systemctl" <<EOF
+#!/bin/sh
+sleep $SLOW
+case "\$1" in
+    list-units) exec "$DIR/systemctl" "\$@" ;;
+esac
+exit 0
+EOF
+chmod +x "$tmp/bin/systemctl"
+
+: > "$tmp/states"
+names=
+for i in `seq 1 $PROFILES`; do
+    name=`printf "bench-%06d" $i`
+    touch "$tmp/conf/$name.conf"
+    echo "openvpn@$name.service loaded inactive dead OpenVPN connection to $name" >> "$tmp/states"
+    [ `expr $i % 2` -eq 0 ] && names="$names${names:+,}$name"
+done
+
+export PATH="$tmp/bin:$PATH" BENCH_STATES="$tmp/states" OPENVPN_TRAY_CONF_DIR="$tmp/conf"
+export OPENVPN_TRAY_SYSTEMD_BUS=none OPENVPN_TRAY_CONTROL_SOCKET="$tmp/control.sock" XDG_CACHE_HOME="$tmp"
+"$TRAY" --stats="$tmp/stats.json" > "$tmp/tray.log" &
+pid=$!
+
+# The control socket is up once the tray has started
+for i in `seq 1 50`; do
+    [ -S "$tmp/control.sock" ] && break
+    sleep 0.1
+done
+if [ `id -u` -eq 0 ]; then
+    "$TRAY" start "$names" > /dev/null
+    sleep $SLOW
+    "$TRAY" stop "$names" > /dev/null
+    jobs=yes
+else
+    jobs="no (not root)"
+fi
+sleep $DURATION
+
+kill -USR1 $pid
+for i in `seq 1 50`; do
+    [ -s "$tmp/stats.json" ] && break
+    sleep 0.1
+done
+kill $pid
+wait $pid 2>/dev/null
+
+json=`cat "$tmp/stats.json" 2>/dev/null`
+stalls=`echo "$json" | sed -n 's/.*"stall":{"count":\([0-9]*\),.*/\1/p'`
+latency_max=`echo "$json" | sed -n 's/.*"loop_latency":{"count":[0-9]*,"total_us":[0-9]*,"max_us":\([0-9]*\),.*/\1/p'`
+probes=`echo "$json" | sed -n 's/.*"probe":{"count":\([0-9]*\),.*/\1/p'`
+rm -rf "$tmp"
+
+printf "%8s %6s %7s %6s %12s  %s\n" profiles slow_s probes stalls max_late_ms jobs
+printf "%8d %6d %7s %6s %12s  %s\n" $PROFILES $SLOW "$probes" "$stalls" \
+    "`expr ${latency_max:-0} / 1000`" "$jobs"
+
+if [ -z "$stalls" ] || [ -z "$latency_max" ]; then
+    echo "latency: no stats snapshot"
+    exit 1
+fi
+if [ "$stalls" -gt 0 ] || [ "$latency_max" -gt `expr $THRESHOLD_MS \* 1000` ]; then
+    echo "latency: main loop stalled behind systemctl"
+    exit 1
+fi
+exit 0
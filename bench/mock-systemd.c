@@ -0,0 +1,218 @@
+/*
+ * Minimal stand-in for systemd on a private session bus, used by
+ * bench/dbus.sh: owns org.freedesktop.systemd1 and implements what
+ * systemd-dbus.c calls, Manager.LoadUnit and Manager.Subscribe, plus
+ * Properties.Get of a unit's ActiveState. Units start in the states
+ * given on the command line, any other unit is loaded inactive.
+ *
+ * Each line "UNIT STATE" on stdin sets the unit's ActiveState and, once
+ * a client has subscribed, emits PropertiesChanged for it, as systemd
+ * does. What happens is printed one line at a time: "ready", "subscribed",
+ * "loaded UNIT", "set UNIT STATE".
+ *
+ * Usage: mock-systemd [UNIT=STATE...]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#define SYSTEMD_BUS_NAME "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_PATH "/org/freedesktop/systemd1"
+#define SYSTEMD_UNIT_IFACE "org.freedesktop.systemd1.Unit"
+
+static const char introspection_xml[] =
+    "<node>"
+    "  <interface name='org.freedesktop.systemd1.Manager'>"
+    "    <method name='LoadUnit'>"
+    "      <arg type='s' name='name' direction='in'/>"
+    "      <arg type='o' name='unit' direction='out'/>"
+    "    </method>"
+    "    <method name='Subscribe'/>"
+    "  </interface>"
+    "  <interface name='org.freedesktop.systemd1.Unit'>"
+    "    <property name='Id' type='s' access='read'/>"
+    "    <property name='ActiveState' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+struct unit {
+    char *name;
+    char *path;
+    char *active_state;
+    guint registration;
+};
+
+static GDBusNodeInfo *introspection = NULL;
+static GDBusConnection *connection = NULL;
+static GHashTable *units = NULL;        // Unit name -> struct unit
+static GMainLoop *loop = NULL;
+static int subscribed = 0;
+
+static struct unit *get_unit(const char *name);
+static void on_manager_call(GDBusConnection *conn, const gchar *sender, const gchar *path,
+                            const gchar *iface, const gchar *method, GVariant *params,
+                            GDBusMethodInvocation *invocation, gpointer data);
+static GVariant *on_unit_get(GDBusConnection *conn, const gchar *sender, const gchar *path,
+                             const gchar *iface, const gchar *property, GError **error, gpointer data);
+static gboolean on_stdin(GIOChannel *channel, GIOCondition condition, gpointer data);
+
+static const GDBusInterfaceVTable manager_vtable = { on_manager_call, NULL, NULL };
+static const GDBusInterfaceVTable unit_vtable = { NULL, on_unit_get, NULL };
+
+// Object path as systemd builds it: every byte but [A-Za-z0-9] as _XX
+static char *unit_path(const char *name)
+{
+    GString *path = g_string_new(SYSTEMD_OBJECT_PATH "/unit/");
+
+    for (; *name; name++) {
+        if (g_ascii_isalnum(*name)) {
+            g_string_append_c(path, *name);
+        } else {
+            g_string_append_printf(path, "_%02x", (unsigned char)*name);
+        }
+    }
+    return g_string_free(path, FALSE);
+}
+
+// The unit of that name, registered on the bus on first use
+static struct unit *get_unit(const char *name)
+{
+    struct unit *unit = g_hash_table_lookup(units, name);
+
+    if (unit == NULL) {
+        unit = g_new0(struct unit, 1);
+        unit->name = g_strdup(name);
+        unit->path = unit_path(name);
+        unit->active_state = g_strdup("inactive");
+        g_hash_table_insert(units, unit->name, unit);
+    }
+    if (unit->registration == 0 && connection != NULL) {
+        unit->registration = g_dbus_connection_register_object(connection, unit->path,
+                                                               introspection->interfaces[1], &unit_vtable,
+                                                               unit, NULL, NULL);
+    }
+    return unit;
+}
+
+static void set_state(struct unit *unit, const char *active_state)
+{
+    GVariantBuilder changed;
+
+    g_free(unit->active_state);
+    unit->active_state = g_strdup(active_state);
+    printf("set %s %s\n", unit->name, active_state);
+
+    if (!subscribed || unit->registration == 0) {
+        return;
+    }
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "ActiveState", g_variant_new_string(active_state));
+    g_dbus_connection_emit_signal(connection, NULL, unit->path, "org.freedesktop.DBus.Properties",
+                                  "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", SYSTEMD_UNIT_IFACE, &changed, NULL), NULL);
+}
+
+static void on_manager_call(GDBusConnection *conn, const gchar *sender, const gchar *path,
+                            const gchar *iface, const gchar *method, GVariant *params,
+                            GDBusMethodInvocation *invocation, gpointer data)
+{
+    if (strcmp(method, "LoadUnit") == 0) {
+        const char *name;
+        struct unit *unit;
+
+        g_variant_get(params, "(&s)", &name);
+        unit = get_unit(name);
+        printf("loaded %s\n", name);
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", unit->path));
+    } else if (strcmp(method, "Subscribe") == 0) {
+        subscribed = 1;
+        printf("subscribed\n");
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+}
+
+static GVariant *on_unit_get(GDBusConnection *conn, const gchar *sender, const gchar *path,
+                             const gchar *iface, const gchar *property, GError **error, gpointer data)
+{
+    struct unit *unit = data;
+
+    if (strcmp(property, "Id") == 0) {
+        return g_variant_new_string(unit->name);
+    }
+    return g_variant_new_string(unit->active_state);
+}
+
+static void on_bus_acquired(GDBusConnection *conn, const gchar *name, gpointer data)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    connection = conn;
+    g_dbus_connection_register_object(conn, SYSTEMD_OBJECT_PATH, introspection->interfaces[0],
+                                      &manager_vtable, NULL, NULL, NULL);
+    g_hash_table_iter_init(&iter, units);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        get_unit(((struct unit *)value)->name);
+    }
+}
+
+static void on_name_acquired(GDBusConnection *conn, const gchar *name, gpointer data)
+{
+    printf("ready\n");
+}
+
+static void on_name_lost(GDBusConnection *conn, const gchar *name, gpointer data)
+{
+    fprintf(stderr, "mock-systemd: unable to own %s\n", name);
+    g_main_loop_quit(loop);
+}
+
+// "UNIT STATE" per line, end of input stops the mock
+static gboolean on_stdin(GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    gchar *line = NULL;
+    gchar **words;
+
+    if (g_io_channel_read_line(channel, &line, NULL, NULL, NULL) != G_IO_STATUS_NORMAL) {
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+    words = g_strsplit(g_strstrip(line), " ", 2);
+    if (words[0] && words[1]) {
+        set_state(get_unit(words[0]), words[1]);
+    }
+    g_strfreev(words);
+    g_free(line);
+    return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char *argv[])
+{
+    GIOChannel *input;
+    int i;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    introspection = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+    units = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 1; i < argc; i++) {
+        gchar **pair = g_strsplit(argv[i], "=", 2);
+
+        if (pair[0] && pair[1]) {
+            struct unit *unit = get_unit(pair[0]);
+
+            g_free(unit->active_state);
+            unit->active_state = g_strdup(pair[1]);
+        }
+        g_strfreev(pair);
+    }
+
+    loop = g_main_loop_new(NULL, FALSE);
+    g_bus_own_name(G_BUS_TYPE_SESSION, SYSTEMD_BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+                   on_bus_acquired, on_name_acquired, on_name_lost, NULL, NULL);
+    input = g_io_channel_unix_new(0);
+    g_io_add_watch(input, G_IO_IN | G_IO_HUP, on_stdin, NULL);
+
+    g_main_loop_run(loop);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Latency and resident memory of opening the VPN menu OPENS times, on a
+# private Xvfb server with PROFILES profiles of the fake backend. The tray
+# (--popup-bench) prints both per tenth of the opens and fails unless they
+# stay flat, see vpn_menu_bench().
+#
+OPENS=${OPENS:-10000}
+PROFILES=${PROFILES:-500}
+DIR=`dirname "$0"`
+TRAY="$DIR/../openvpn-tray"
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+    echo "popup: Xvfb not found, skipped"
+    exit 0
+fi
+
+tmp=`mktemp -d`
+Xvfb -displayfd 3 -nolisten tcp 3> "$tmp/display" 2>/dev/null &
+xvfb=$!
+for i in `seq 1 50`; do
+    [ -s "$tmp/display" ] && break
+    sleep 0.1
+done
+if [ ! -s "$tmp/display" ]; then
+    echo "popup: Xvfb did not start"
+    kill $xvfb 2>/dev/null
+    rm -rf "$tmp"
+    exit 1
+fi
+
+DISPLAY=:`cat "$tmp/display"` XDG_CACHE_HOME="$tmp" OPENVPN_TRAY_CONTROL_SOCKET="$tmp/control.sock" \
+    OPENVPN_TRAY_BACKEND=fake OPENVPN_TRAY_FAKE_PROFILES=$PROFILES \
+    "$TRAY" --popup-bench=$OPENS > "$tmp/tray.log"
+status=$?
+sed -n '/Opening the VPN menu/,$p' "$tmp/tray.log"
+
+kill $xvfb
+wait $xvfb 2>/dev/null
+rm -rf "$tmp"
+exit $status
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Time to interactive of the tray, as reported by --startup-trace=exit:
+# from main() to the first probe being through. The fake backend serves
+# the profiles; the first run starts without a state snapshot, the others
+# with the one it left behind. Fails if a run is over STARTUP_TTI_BUDGET_MS.
+#
+RUNS=5
+DIR=`dirname "$0"`
+TRAY="$DIR/../openvpn-tray"
+
+if [ -z "$DISPLAY" ] && [ -z "$WAYLAND_DISPLAY" ]; then
+    echo "startup: no display, skipped"
+    exit 0
+fi
+
+cache=`mktemp -d`
+status=0
+printf "%8s %9s %9s\n" run snapshot tti_ms
+for run in `seq 1 $RUNS`; do
+    out=`XDG_CACHE_HOME="$cache" OPENVPN_TRAY_BACKEND=fake OPENVPN_TRAY_FAKE_PROFILES=${PROFILES:-200} \
+        "$TRAY" --startup-trace=exit`
+    [ $? -eq 0 ] || status=1
+    tti=`echo "$out" | sed -n 's/.*Interactive after \([0-9.]*\) ms.*/\1/p'`
+    snapshot=no
+    echo "$out" | grep -q "Showing .* VPN states of" && snapshot=yes
+    printf "%8d %9s %9s\n" $run $snapshot "$tti"
+done
+rm -rf "$cache"
+[ $status -eq 0 ] || echo "startup: over the time-to-interactive budget"
+exit $status
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Syscalls per poll of bench-poll, child processes included. Each profile
+# count is traced twice, with one and with 1 + POLLS polls, so the setup
+# and the cold first poll cancel out.
+#
+POLLS=10
+DIR=`dirname "$0"`
+
+if ! command -v strace >/dev/null 2>&1; then
+    echo "syscalls: strace not found, skipped"
+    exit 0
+fi
+
+total_calls() {
+    out=`mktemp`
+    strace -f -q -c -o "$out" "$DIR/bench-poll" -p "$1" "$2" >/dev/null
+    awk '/ total$/ { print $4 }' "$out"
+    rm -f "$out"
+}
+
+printf "%8s %9s\n" profiles syscalls
+for n in ${@:-10 100 1000 10000}; do
+    base=`total_calls 1 $n`
+    more=`total_calls \`expr 1 + $POLLS\` $n`
+    printf "%8d %9d\n" $n `expr \( $more - $base \) / $POLLS`
+done
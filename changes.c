@@ -0,0 +1,258 @@
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "jobs.h"
+#include "changes.h"
+
+/*
+ * One name-keyed change set per tick. Whatever may change a VPN (scan,
+ * probe, backend event, job, management interface) notes the slot here;
+ * changes_commit() compares each noted entry with its state at the
+ * previous commit and hands the resulting list to every listener once.
+ * Listeners (logging, history, icon, menu, management interface) thus
+ * work per change, and a tick in which nothing changed costs them nothing
+ * however many profiles there are. Removed profiles are reported by name,
+ * so nothing downstream ever diffs by slot index.
+ */
+
+struct listener {
+    changes_listener func;
+    gpointer data;
+};
+
+static GArray *listeners = NULL;    // struct listener, in registration order
+static GArray *pending = NULL;      // struct vpn_change noted since the last commit
+static GArray *dispatching = NULL;  // The set being handed to the listeners
+static struct changes_summary summary;
+
+static void ensure_arrays(void);
+static void note(int vpn_index, enum change_kind kind);
+static int is_busy(const struct vpn_entry *entry);
+static void settle(struct vpn_change *change);
+
+void changes_listen(changes_listener listener, gpointer data)
+{
+    struct listener entry = { listener, data };
+
+    ensure_arrays();
+    g_array_append_val(listeners, entry);
+}
+
+// A profile entered the registry
+void changes_added(int vpn_index)
+{
+    note(vpn_index, CHANGE_ADDED);
+}
+
+/*
+ * A profile is about to leave the registry. Its share of the summary goes
+ * right away; a profile added within the same tick is simply forgotten.
+ */
+void changes_removed(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+    struct vpn_change *change;
+
+    ensure_arrays();
+    if (entry->change_pos) {
+        change = &g_array_index(pending, struct vpn_change, entry->change_pos - 1);
+        if (change->kind == CHANGE_ADDED) {
+            guint last = pending->len - 1;
+            guint pos = entry->change_pos - 1;
+
+            g_array_remove_index_fast(pending, pos);
+            if (pos < last) {
+                change = &g_array_index(pending, struct vpn_change, pos);
+                if (change->vpn_index >= 0) {
+                    registry_get(change->vpn_index)->change_pos = pos + 1;
+                }
+            }
+            entry->change_pos = 0;
+            return;
+        }
+    } else {
+        struct vpn_change empty = { 0 };
+
+        g_array_append_val(pending, empty);
+        change = &g_array_index(pending, struct vpn_change, pending->len - 1);
+    }
+
+    change->kind = CHANGE_REMOVED;
+    change->vpn_index = -1;
+    change->name = g_strdup(entry->name);
+    change->state = 0;
+    change->previous_state = entry->previous_state;
+    entry->change_pos = 0;
+
+    summary.total--;
+    summary.active -= entry->previous_state;
+    summary.busy -= entry->previous_busy;
+}
+
+// Note the VPN if its state or transition differs from the last commit, O(1)
+void changes_check(int vpn_index)
+{
+    struct vpn_entry *entry;
+
+    if (vpn_index < 0) {
+        return;
+    }
+    entry = registry_get(vpn_index);
+    if (!entry->change_pos &&
+        (entry->state != entry->previous_state || is_busy(entry) != entry->previous_busy)) {
+        note(vpn_index, CHANGE_STATE);
+    }
+}
+
+// Note the VPN unconditionally, e.g. its pending job or link state changed
+void changes_touch(int vpn_index)
+{
+    if (vpn_index >= 0) {
+        note(vpn_index, CHANGE_STATE);
+    }
+}
+
+/*
+ * Settle the noted changes and pass them to the listeners. Listeners are
+ * called even for an empty set, so time-based work such as the periodic
+ * status summary can hang off the tick.
+ */
+void changes_commit(void)
+{
+    struct vpn_change *changes;
+    GArray *swap;
+    guint i;
+
+    ensure_arrays();
+
+    // Notes made by the listeners themselves go into the next set
+    swap = dispatching;
+    dispatching = pending;
+    pending = swap;
+
+    changes = (struct vpn_change *)dispatching->data;
+    for (i = 0; i < dispatching->len; i++) {
+        if (changes[i].vpn_index >= 0) {
+            settle(&changes[i]);
+        }
+    }
+
+    for (i = 0; i < listeners->len; i++) {
+        struct listener *listener = &g_array_index(listeners, struct listener, i);
+
+        listener->func(changes, dispatching->len, listener->data);
+    }
+
+    for (i = 0; i < dispatching->len; i++) {
+        if (changes[i].kind == CHANGE_REMOVED) {
+            g_free((char *)changes[i].name);
+        }
+    }
+    g_array_set_size(dispatching, 0);
+}
+
+/*
+ * Report every profile as CHANGE_ADDED with the next commit, as if the
+ * registry had just been filled, and recount the summary from there; a
+ * profile removed before that commit is forgotten. Used when the states
+ * loaded from the snapshot are about to be probed for real, so listeners
+ * see the first real states rather than differences to stale ones.
+ */
+void changes_reset(void)
+{
+    struct vpn_entry *entry;
+    guint pos;
+    int i;
+
+    ensure_arrays();
+    memset(&summary, 0, sizeof(summary));
+    for (pos = 0; pos < pending->len; pos++) {
+        struct vpn_change *change = &g_array_index(pending, struct vpn_change, pos);
+
+        if (change->vpn_index >= 0) {
+            change->kind = CHANGE_ADDED;
+        }
+    }
+    registry_foreach(i, entry) {
+        note(i, CHANGE_ADDED);
+    }
+}
+
+void changes_get_summary(struct changes_summary *out)
+{
+    *out = summary;
+}
+
+void changes_cleanup(void)
+{
+    guint i;
+
+    if (pending == NULL) {
+        return;
+    }
+    for (i = 0; i < pending->len; i++) {
+        struct vpn_change *change = &g_array_index(pending, struct vpn_change, i);
+
+        if (change->kind == CHANGE_REMOVED) {
+            g_free((char *)change->name);
+        }
+    }
+    g_array_free(pending, TRUE);
+    g_array_free(dispatching, TRUE);
+    g_array_free(listeners, TRUE);
+    pending = dispatching = listeners = NULL;
+    memset(&summary, 0, sizeof(summary));
+}
+
+static void ensure_arrays(void)
+{
+    if (pending == NULL) {
+        pending = g_array_new(FALSE, FALSE, sizeof(struct vpn_change));
+        dispatching = g_array_new(FALSE, FALSE, sizeof(struct vpn_change));
+        listeners = g_array_new(FALSE, FALSE, sizeof(struct listener));
+    }
+}
+
+// Add the slot to the pending set, once per tick
+static void note(int vpn_index, enum change_kind kind)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+    struct vpn_change change = { kind, vpn_index, NULL, 0, 0 };
+
+    ensure_arrays();
+    if (entry->change_pos) {
+        return;
+    }
+    g_array_append_val(pending, change);
+    entry->change_pos = pending->len;
+}
+
+static int is_busy(const struct vpn_entry *entry)
+{
+    return entry->transitioning || (jobs_in_flight() > 0 && jobs_pending(entry->name) != VPN_JOB_NONE);
+}
+
+// Fill in the change from the entry and account it in the summary
+static void settle(struct vpn_change *change)
+{
+    struct vpn_entry *entry = registry_get(change->vpn_index);
+    int busy = is_busy(entry);
+
+    change->name = entry->name;
+    change->state = entry->state;
+    if (change->kind == CHANGE_ADDED) {
+        change->previous_state = 0;
+        summary.total++;
+        summary.active += entry->state;
+        summary.busy += busy;
+    } else {
+        change->previous_state = entry->previous_state;
+        change->kind = entry->state != entry->previous_state ? CHANGE_STATE : CHANGE_DETAIL;
+        summary.active += entry->state - entry->previous_state;
+        summary.busy += busy - entry->previous_busy;
+    }
+    entry->previous_state = entry->state;
+    entry->previous_busy = busy;
+    entry->change_pos = 0;
+}
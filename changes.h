@@ -0,0 +1,40 @@
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include <glib.h>
+
+enum change_kind {
+    CHANGE_ADDED,           // New profile
+    CHANGE_REMOVED,         // Profile gone, vpn_index is -1
+    CHANGE_STATE,           // Unit turned ON or OFF
+    CHANGE_DETAIL,          // Same state, but a job, transition or link state changed
+};
+
+struct vpn_change {
+    enum change_kind kind;
+    int vpn_index;          // Slot in the registry, -1 for CHANGE_REMOVED
+    const char *name;       // Valid during the listener call only
+    int state;
+    int previous_state;     // State at the previous commit, 0 for CHANGE_ADDED
+};
+
+// Aggregate states as of the last commit, kept up to date incrementally
+struct changes_summary {
+    int total;              // Profiles
+    int active;             // VPNs ON
+    int busy;               // Units activating/deactivating or with a pending job
+};
+
+typedef void (*changes_listener)(const struct vpn_change *changes, int count, gpointer data);
+
+void changes_listen(changes_listener listener, gpointer data);
+void changes_added(int vpn_index);
+void changes_removed(int vpn_index);
+void changes_check(int vpn_index);
+void changes_touch(int vpn_index);
+void changes_commit(void);
+void changes_reset(void);
+void changes_get_summary(struct changes_summary *summary);
+void changes_cleanup(void);
+
+#endif
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+#include "conf.h"
+
+/*
+ * Parser for the few profile directives the tray shows or needs (remote,
+ * port, proto, dev, management). A profile is read with one pread() into
+ * a static buffer, or mapped into memory if it is larger, and scanned line
+ * by line in place; inline data blocks such as <ca> or <cert> are skipped
+ * with a single search for their closing tag, so a profile with a large
+ * certificate chain costs little more than one without. Results are
+ * cached per profile and keyed by the file's (device, inode, mtime,
+ * size): a lookup of an unchanged profile is one stat() and no parsing.
+ */
+
+#define CONF_MAX_ARGS 4
+#define CONF_MAX_TAG 32
+// Larger profiles are mmap()ed; below this a read into read_buf is cheaper
+#define CONF_MMAP_THRESHOLD 65536
+
+struct conf_cached {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    struct conf_info info;
+};
+
+struct conf_token {
+    const char *str;
+    size_t len;
+};
+
+static GHashTable *cache = NULL;    // VPN name -> struct conf_cached
+static GString *path_buf = NULL;    // Profile path, reused between lookups
+static char read_buf[CONF_MMAP_THRESHOLD];
+
+static int parse_fd(int fd, struct stat *st, struct conf_info *info);
+static void parse(const char *p, const char *end, struct conf_info *info);
+static int split(const char *p, const char *eol, struct conf_token *args);
+static const char *skip_block(const struct conf_token *tag, const char *p, const char *end);
+static int is(const struct conf_token *token, const char *word);
+static int to_port(const struct conf_token *token);
+static void free_cached(gpointer data);
+
+/*
+ * Directives of the profile, re-parsed only if the file changed since
+ * the last lookup. NULL if there is no profile file, it cannot be read
+ * (tried again on the next lookup) or the backend has no profile
+ * directory. The result stays valid until the next lookup or
+ * conf_forget() of the same name.
+ */
+const struct conf_info *conf_lookup(const char *vpn_name)
+{
+    const char *conf_dir = backend_get()->profile_dir();
+    struct conf_cached *cached;
+    struct stat st;
+    int fd;
+
+    if (conf_dir == NULL) {
+        return NULL;
+    }
+    if (cache == NULL) {
+        cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cached);
+        path_buf = g_string_new(NULL);
+    }
+
+    g_string_printf(path_buf, "%s/%s.conf", conf_dir, vpn_name);
+    cached = g_hash_table_lookup(cache, vpn_name);
+    if (stat(path_buf->str, &st) < 0) {
+        g_hash_table_remove(cache, vpn_name);
+        return NULL;
+    }
+    if (cached && cached->dev == st.st_dev && cached->ino == st.st_ino && cached->size == st.st_size &&
+        cached->mtime.tv_sec == st.st_mtim.tv_sec && cached->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return &cached->info;
+    }
+
+    if ((fd = open(path_buf->str, O_RDONLY | O_CLOEXEC)) < 0) {
+        g_hash_table_remove(cache, vpn_name);
+        return NULL;
+    }
+    if (cached == NULL) {
+        cached = g_new0(struct conf_cached, 1);
+        g_hash_table_insert(cache, g_strdup(vpn_name), cached);
+    } else {
+        conf_info_clear(&cached->info);
+    }
+
+    // Key by what was actually parsed, the file may have changed since stat()
+    if (parse_fd(fd, &st, &cached->info) < 0) {
+        close(fd);
+        g_hash_table_remove(cache, vpn_name);
+        return NULL;
+    }
+    close(fd);
+    cached->dev = st.st_dev;
+    cached->ino = st.st_ino;
+    cached->mtime = st.st_mtim;
+    cached->size = st.st_size;
+
+    return &cached->info;
+}
+
+// Parse a profile without caching, returns -1 if it cannot be read
+int conf_parse_file(const char *path, struct conf_info *info)
+{
+    struct stat st;
+    int fd, ret;
+
+    memset(info, 0, sizeof(*info));
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    ret = parse_fd(fd, &st, info);
+    close(fd);
+    return ret;
+}
+
+void conf_info_clear(struct conf_info *info)
+{
+    g_free(info->remote);
+    g_free(info->proto);
+    g_free(info->dev);
+    g_free(info->mgmt_address);
+    g_free(info->mgmt_port);
+    g_free(info->mgmt_pw_file);
+    memset(info, 0, sizeof(*info));
+}
+
+// Append e.g. "vpn.example.com:1194/udp, dev tun0"; nothing if none is set
+void conf_format(const struct conf_info *info, GString *out)
+{
+    gsize len = out->len;
+
+    if (info->remote) {
+        g_string_append(out, info->remote);
+        if (info->port) {
+            g_string_append_printf(out, ":%d", info->port);
+        }
+    }
+    if (info->proto) {
+        g_string_append_printf(out, "%s%s", info->remote ? "/" : "", info->proto);
+    }
+    if (info->dev) {
+        g_string_append_printf(out, "%sdev %s", out->len > len ? ", " : "", info->dev);
+    }
+}
+
+void conf_forget(const char *vpn_name)
+{
+    if (cache) {
+        g_hash_table_remove(cache, vpn_name);
+    }
+}
+
+void conf_cleanup(void)
+{
+    if (cache) {
+        g_hash_table_destroy(cache);
+        g_string_free(path_buf, TRUE);
+        cache = NULL;
+        path_buf = NULL;
+    }
+}
+
+static int parse_fd(int fd, struct stat *st, struct conf_info *info)
+{
+    ssize_t len;
+    void *map;
+
+    if (fstat(fd, st) < 0) {
+        return -1;
+    }
+    if (st->st_size <= CONF_MMAP_THRESHOLD) {
+        if ((len = pread(fd, read_buf, st->st_size, 0)) < 0) {
+            return -1;
+        }
+        parse(read_buf, read_buf + len, info);
+        return 0;
+    }
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    parse(map, (const char *)map + st->st_size, info);
+    munmap(map, st->st_size);
+    return 0;
+}
+
+/*
+ * The first "remote" wins, as OpenVPN tries them in order; its port and
+ * protocol override "port" and "proto". <connection> blocks hold regular
+ * directives and are read, any other inline block is data and skipped.
+ */
+static void parse(const char *p, const char *end, struct conf_info *info)
+{
+    struct conf_token args[CONF_MAX_ARGS];
+    int remote_port = 0, default_port = 0;
+    char *remote_proto = NULL, *default_proto = NULL;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        int argc;
+
+        if (eol == NULL) {
+            eol = end;
+        }
+        argc = split(p, eol, args);
+        p = eol < end ? eol + 1 : end;
+        if (argc == 0) {
+            continue;
+        }
+
+        if (args[0].str[0] == '<') {
+            p = skip_block(&args[0], p, end);
+        } else if (is(&args[0], "remote") && argc > 1 && info->remote == NULL) {
+            info->remote = g_strndup(args[1].str, args[1].len);
+            remote_port = argc > 2 ? to_port(&args[2]) : 0;
+            remote_proto = argc > 3 ? g_strndup(args[3].str, args[3].len) : NULL;
+        } else if ((is(&args[0], "port") || is(&args[0], "rport")) && argc > 1) {
+            default_port = to_port(&args[1]);
+        } else if (is(&args[0], "proto") && argc > 1) {
+            g_free(default_proto);
+            default_proto = g_strndup(args[1].str, args[1].len);
+        } else if (is(&args[0], "dev") && argc > 1 && info->dev == NULL) {
+            info->dev = g_strndup(args[1].str, args[1].len);
+        } else if (is(&args[0], "management") && argc > 2 && info->mgmt_address == NULL) {
+            info->mgmt_address = g_strndup(args[1].str, args[1].len);
+            info->mgmt_port = g_strndup(args[2].str, args[2].len);
+            info->mgmt_pw_file = argc > 3 ? g_strndup(args[3].str, args[3].len) : NULL;
+        }
+    }
+
+    info->port = remote_port ? remote_port : default_port;
+    if (remote_proto) {
+        info->proto = remote_proto;
+        g_free(default_proto);
+    } else {
+        info->proto = default_proto;
+    }
+}
+
+// Split a line into up to CONF_MAX_ARGS words, stopping at a comment
+static int split(const char *p, const char *eol, struct conf_token *args)
+{
+    int argc = 0;
+
+    while (argc < CONF_MAX_ARGS) {
+        while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        if (p == eol || *p == '#' || *p == ';') {
+            break;
+        }
+        args[argc].str = p;
+        while (p < eol && *p != ' ' && *p != '\t' && *p != '\r') {
+            p++;
+        }
+        args[argc].len = p - args[argc].str;
+        argc++;
+    }
+    return argc;
+}
+
+// Continue after the closing tag of an inline data block, p is past the opening line
+static const char *skip_block(const struct conf_token *tag, const char *p, const char *end)
+{
+    char closing[CONF_MAX_TAG + 3];
+    const char *found;
+    size_t name_len;
+
+    if (tag->len < 3 || tag->str[1] == '/' || tag->str[tag->len - 1] != '>' ||
+        is(tag, "<connection>") || tag->len - 2 > CONF_MAX_TAG) {
+        return p;
+    }
+    name_len = tag->len - 2;
+    closing[0] = '<';
+    closing[1] = '/';
+    memcpy(closing + 2, tag->str + 1, name_len + 1);
+
+    found = p < end ? memmem(p, end - p, closing, name_len + 3) : NULL;
+    if (found == NULL) {
+        return end;
+    }
+    found = memchr(found, '\n', end - found);
+    return found ? found + 1 : end;
+}
+
+static int is(const struct conf_token *token, const char *word)
+{
+    size_t len = strlen(word);
+
+    return token->len == len && memcmp(token->str, word, len) == 0;
+}
+
+static int to_port(const struct conf_token *token)
+{
+    int port = 0;
+    size_t i;
+
+    for (i = 0; i < token->len; i++) {
+        if (token->str[i] < '0' || token->str[i] > '9') {
+            return 0;
+        }
+        port = port * 10 + token->str[i] - '0';
+        if (port > 65535) {
+            return 0;
+        }
+    }
+    return port;
+}
+
+static void free_cached(gpointer data)
+{
+    struct conf_cached *cached = data;
+
+    conf_info_clear(&cached->info);
+    g_free(cached);
+}
@@ -0,0 +1,24 @@
+#ifndef CONF_H
+#define CONF_H
+
+#include <glib.h>
+
+// Directives of an OpenVPN profile the tray cares about, NULL/0 if absent
+struct conf_info {
+    char *remote;           // Host of the first "remote"
+    int port;               // Port of the first "remote", else "port"/"rport"
+    char *proto;            // Protocol of the first "remote", else "proto"
+    char *dev;              // "dev", e.g. tun0 or tun
+    char *mgmt_address;     // "management <address> <port|unix> [pw-file]"
+    char *mgmt_port;
+    char *mgmt_pw_file;
+};
+
+const struct conf_info *conf_lookup(const char *vpn_name);
+int conf_parse_file(const char *path, struct conf_info *info);
+void conf_info_clear(struct conf_info *info);
+void conf_format(const struct conf_info *info, GString *out);
+void conf_forget(const char *vpn_name);
+void conf_cleanup(void);
+
+#endif
@@ -0,0 +1,550 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "jobs.h"
+#include "changes.h"
+#include "snapshot.h"
+#include "control.h"
+
+/*
+ * Control socket for scripts, so they can ask the running tray instead of
+ * running systemctl themselves. A unix socket, one command per line:
+ *
+ *   status [NAME,...]  "vpn NAME on|off [starting|stopping|busy]" per VPN,
+ *                      answered from the registry, nothing is probed
+ *   start NAME,...     turn the VPNs ON, as the menu would
+ *   stop NAME,...      turn the VPNs OFF
+ *   watch              from now on, one line per entry of every committed
+ *                      change set: "added|state|detail NAME on|off [...]"
+ *                      or "removed NAME"
+ *
+ * Every reply ends with "ok" ("ok stale" while the states are still those
+ * of the on-disk snapshot) or "error MESSAGE". Output is queued per client
+ * and written asynchronously; a client which lets more than
+ * CONTROL_MAX_BACKLOG bytes pile up is dropped rather than stalling the
+ * tray.
+ *
+ * The socket also keeps the tray single-instance: control_forward() runs
+ * first thing and hands the command line of a second launch to the
+ * instance already listening.
+ *
+ * start and stop run systemctl with the tray's privileges, so the socket
+ * is made 0600 and every peer whose uid is not the tray's effective uid
+ * is hung up on, whatever the directory permissions.
+ */
+
+#define CONTROL_SOCKET_ENV "OPENVPN_TRAY_CONTROL_SOCKET"
+
+struct control_client {
+    int refs;                       // The client list and every read or write in flight
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GCancellable *cancellable;      // Cancels the pending read and write
+    GString *queued;                // Output not handed to the stream yet
+    GString *sending;               // Output being written, empty if none
+    int watching;
+    int closed;
+};
+
+static GSocketService *service = NULL;
+static gchar *socket_path = NULL;   // Bound by this instance, removed at cleanup
+static GList *clients = NULL;       // struct control_client
+static GArray *order = NULL;        // Slots sorted by name, reused by status
+static control_toggle_cb on_toggle = NULL;
+static gpointer callback_data = NULL;
+
+static gchar *control_socket_path(void);
+static int is_listening(const char *path);
+static int is_own_peer(GSocketConnection *connection);
+static gboolean on_incoming(GSocketService *svc, GSocketConnection *connection, GObject *source, gpointer data);
+static void read_next(struct control_client *client);
+static void on_line(GObject *source, GAsyncResult *result, gpointer data);
+static void handle_command(struct control_client *client, char *line);
+static void reply_status(GString *reply, const char *arg);
+static void reply_toggle(GString *reply, const char *arg, int on);
+static int lookup_names(GString *reply, const char *arg, GArray *slots);
+static void append_vpn(GString *out, const char *kind, const struct vpn_entry *entry);
+static void queue(struct control_client *client, const GString *text);
+static void flush(struct control_client *client);
+static void on_written(GObject *source, GAsyncResult *result, gpointer data);
+static void drop_client(struct control_client *client);
+static void unref_client(struct control_client *client);
+
+/*
+ * Forward the command words of the command line (everything but --options)
+ * to a running instance and print its reply. Returns the exit status for
+ * this process, or -1 if no instance is running and this one should start.
+ */
+int control_forward(int argc, char *argv[])
+{
+    GString *command = g_string_new(NULL);
+    gchar *path = control_socket_path();
+    GSocketAddress *address = g_unix_socket_address_new(path);
+    GSocketClient *socket_client = g_socket_client_new();
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GError *error = NULL;
+    char *line;
+    int status = 1;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            g_string_append_printf(command, "%s%s", command->len ? " " : "", argv[i]);
+        }
+    }
+
+    connection = g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+    g_object_unref(socket_client);
+    g_object_unref(address);
+    g_free(path);
+
+    if (connection == NULL) {
+        if (command->len == 0) {
+            g_string_free(command, TRUE);
+            return -1;
+        }
+        g_print("%s: ERROR: Not running, cannot forward: %s\n", APP_NAME, command->str);
+        g_string_free(command, TRUE);
+        return 1;
+    }
+    if (command->len == 0) {
+        g_print("%s: Already running, see \"%s status\"\n", APP_NAME, argv[0]);
+        g_object_unref(connection);
+        g_string_free(command, TRUE);
+        return 0;
+    }
+
+    g_string_append_c(command, '\n');
+    if (!g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(connection)),
+                                   command->str, command->len, NULL, NULL, &error)) {
+        g_print("%s: ERROR: Unable to forward command: %s\n", APP_NAME, error->message);
+        g_error_free(error);
+        g_object_unref(connection);
+        g_string_free(command, TRUE);
+        return 1;
+    }
+
+    // Everything up to "ok" or "error"; watch goes on until the tray hangs up
+    input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    while ((line = g_data_input_stream_read_line(input, NULL, NULL, NULL)) != NULL) {
+        if (strcmp(line, "ok") == 0 || strncmp(line, "ok ", 3) == 0) {
+            status = 0;
+            if (strcmp(command->str, "watch\n") != 0) {
+                g_free(line);
+                break;
+            }
+        } else if (strncmp(line, "error ", 6) == 0) {
+            g_print("%s: ERROR: %s\n", APP_NAME, line + 6);
+            g_free(line);
+            break;
+        } else {
+            g_print("%s\n", line);
+        }
+        g_free(line);
+    }
+
+    g_object_unref(input);
+    g_object_unref(connection);
+    g_string_free(command, TRUE);
+    return status;
+}
+
+/*
+ * Listen on the control socket. control_forward() found no instance
+ * listening, so a socket left behind is removed first, unless another
+ * instance started meanwhile and answers on it.
+ */
+int control_init(control_toggle_cb toggle_cb, gpointer data)
+{
+    GSocketAddress *address;
+    GError *error = NULL;
+    GStatBuf st;
+    gchar *dir;
+
+    on_toggle = toggle_cb;
+    callback_data = data;
+
+    socket_path = control_socket_path();
+    dir = g_path_get_dirname(socket_path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    if (g_lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (is_listening(socket_path)) {
+            g_print("%s: WARNING: Another instance listens on %s, no control socket\n", APP_NAME, socket_path);
+            g_free(socket_path);
+            socket_path = NULL;
+            return -1;
+        }
+        g_unlink(socket_path);
+    }
+
+    address = g_unix_socket_address_new(socket_path);
+    service = g_socket_service_new();
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error)) {
+        g_print("%s: WARNING: Unable to listen on %s, no control socket: %s\n",
+                APP_NAME, socket_path, error->message);
+        g_error_free(error);
+        g_object_unref(address);
+        g_clear_object(&service);
+        g_free(socket_path);
+        socket_path = NULL;
+        return -1;
+    }
+    g_object_unref(address);
+
+    // Not left to the umask; peers are checked in on_incoming() as well
+    if (g_chmod(socket_path, 0600) < 0) {
+        g_print("%s: WARNING: Unable to restrict %s, no control socket: %s\n",
+                APP_NAME, socket_path, g_strerror(errno));
+        control_cleanup();
+        return -1;
+    }
+
+    g_signal_connect(service, "incoming", G_CALLBACK(on_incoming), NULL);
+    g_socket_service_start(service);
+    return 0;
+}
+
+// Change set listener: stream the changes to the clients which asked to watch
+void control_apply_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    static const char *kinds[] = { "added", "removed", "state", "detail" };
+    GString *events = NULL;
+    GList *link, *next;
+    int i;
+
+    for (link = clients; link != NULL; link = next) {
+        struct control_client *client = link->data;
+
+        next = link->next;      // queue() may drop the client
+        if (!client->watching) {
+            continue;
+        }
+        if (events == NULL) {
+            events = g_string_new(NULL);
+            for (i = 0; i < count; i++) {
+                if (changes[i].kind == CHANGE_REMOVED) {
+                    g_string_append_printf(events, "removed %s\n", changes[i].name);
+                } else {
+                    append_vpn(events, kinds[changes[i].kind], registry_get(changes[i].vpn_index));
+                }
+            }
+        }
+        queue(client, events);
+    }
+
+    if (events) {
+        g_string_free(events, TRUE);
+    }
+}
+
+void control_cleanup(void)
+{
+    while (clients) {
+        drop_client(clients->data);
+    }
+    if (service) {
+        g_socket_service_stop(service);
+        g_socket_listener_close(G_SOCKET_LISTENER(service));
+        g_clear_object(&service);
+    }
+    if (socket_path) {
+        g_unlink(socket_path);
+        g_free(socket_path);
+        socket_path = NULL;
+    }
+    if (order) {
+        g_array_free(order, TRUE);
+        order = NULL;
+    }
+}
+
+static gchar *control_socket_path(void)
+{
+    const char *env = g_getenv(CONTROL_SOCKET_ENV);
+
+    if (env != NULL && *env != '\0') {
+        return g_strdup(env);
+    }
+    return g_build_filename(g_get_user_runtime_dir(), APP_NAME, CONTROL_SOCKET_NAME, NULL);
+}
+
+// A tray answers on the socket, as opposed to a stale file left behind
+static int is_listening(const char *path)
+{
+    GSocketAddress *address = g_unix_socket_address_new(path);
+    GSocketClient *socket_client = g_socket_client_new();
+    GSocketConnection *connection;
+
+    connection = g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+    g_object_unref(socket_client);
+    g_object_unref(address);
+    if (connection == NULL) {
+        return 0;
+    }
+    g_object_unref(connection);
+    return 1;
+}
+
+// SO_PEERCRED: only processes of the tray's own effective uid may control it
+static int is_own_peer(GSocketConnection *connection)
+{
+    GCredentials *credentials = g_socket_get_credentials(g_socket_connection_get_socket(connection), NULL);
+    int own;
+
+    if (credentials == NULL) {
+        return 0;
+    }
+    own = g_credentials_get_unix_user(credentials, NULL) == geteuid();
+    g_object_unref(credentials);
+    return own;
+}
+
+static gboolean on_incoming(GSocketService *svc, GSocketConnection *connection, GObject *source, gpointer data)
+{
+    struct control_client *client;
+
+    // Returning without a reference closes the connection
+    if (!is_own_peer(connection)) {
+        g_print("%s: WARNING: Control socket connection from another user refused\n", APP_NAME);
+        return TRUE;
+    }
+
+    client = g_new0(struct control_client, 1);
+    client->refs = 1;
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+    client->cancellable = g_cancellable_new();
+    client->queued = g_string_new(NULL);
+    client->sending = g_string_new(NULL);
+    clients = g_list_prepend(clients, client);
+
+    read_next(client);
+    return TRUE;
+}
+
+static void read_next(struct control_client *client)
+{
+    client->refs++;
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, client->cancellable, on_line, client);
+}
+
+static void on_line(GObject *source, GAsyncResult *result, gpointer data)
+{
+    struct control_client *client = data;
+    char *line = g_data_input_stream_read_line_finish(G_DATA_INPUT_STREAM(source), result, NULL, NULL);
+
+    if (line == NULL) {
+        drop_client(client);
+    } else if (!client->closed) {
+        handle_command(client, line);
+        if (!client->closed) {
+            read_next(client);
+        }
+    }
+    g_free(line);
+    unref_client(client);
+}
+
+static void handle_command(struct control_client *client, char *line)
+{
+    GString *reply = g_string_new(NULL);
+    char *verb = g_strstrip(line);
+    char *arg = strchr(verb, ' ');
+
+    if (arg != NULL) {
+        *arg++ = '\0';
+        arg = g_strstrip(arg);
+    }
+
+    if (*verb == '\0') {
+        // Blank line
+    } else if (strcmp(verb, "status") == 0) {
+        reply_status(reply, arg);
+    } else if (strcmp(verb, "start") == 0 || strcmp(verb, "stop") == 0) {
+        reply_toggle(reply, arg, strcmp(verb, "start") == 0);
+    } else if (strcmp(verb, "watch") == 0) {
+        client->watching = 1;
+        g_string_append(reply, "ok\n");
+    } else {
+        g_string_append_printf(reply, "error Unknown command: %s\n", verb);
+    }
+
+    queue(client, reply);
+    g_string_free(reply, TRUE);
+}
+
+static void reply_status(GString *reply, const char *arg)
+{
+    int i;
+
+    if (order == NULL) {
+        order = g_array_new(FALSE, FALSE, sizeof(int));
+    }
+    if (arg != NULL && *arg != '\0') {
+        if (lookup_names(reply, arg, order) < 0) {
+            return;
+        }
+    } else {
+        registry_sorted(order);
+    }
+
+    for (i = 0; i < order->len; i++) {
+        append_vpn(reply, "vpn", registry_get(g_array_index(order, int, i)));
+    }
+    g_string_append(reply, snapshot_is_stale() ? "ok stale\n" : "ok\n");
+}
+
+// Nothing is started or stopped unless all names are known
+static void reply_toggle(GString *reply, const char *arg, int on)
+{
+    GArray *slots;
+    int i;
+
+    if (arg == NULL || *arg == '\0') {
+        g_string_append_printf(reply, "error Usage: %s NAME[,NAME...]\n", on ? "start" : "stop");
+        return;
+    }
+    if (read_only_mode) {
+        g_string_append(reply, "error Read-only mode, need sudo privileges\n");
+        return;
+    }
+
+    slots = g_array_new(FALSE, FALSE, sizeof(int));
+    if (lookup_names(reply, arg, slots) == 0) {
+        for (i = 0; i < slots->len; i++) {
+            struct vpn_entry *entry = registry_get(g_array_index(slots, int, i));
+
+            if (entry->state != on) {
+                on_toggle(entry->name, on, callback_data);
+            }
+        }
+        changes_commit();
+        g_string_append(reply, "ok\n");
+    }
+    g_array_free(slots, TRUE);
+}
+
+// Slots of the comma separated names; -1 with an error reply if one is unknown
+static int lookup_names(GString *reply, const char *arg, GArray *slots)
+{
+    gchar **names = g_strsplit(arg, ",", -1);
+    int ret = 0;
+    int i;
+
+    g_array_set_size(slots, 0);
+    for (i = 0; names[i] != NULL; i++) {
+        char *name = g_strstrip(names[i]);
+        int vpn_index;
+
+        if (*name == '\0') {
+            continue;
+        }
+        if ((vpn_index = registry_lookup(name)) < 0) {
+            g_string_append_printf(reply, "error Unknown VPN: %s\n", name);
+            ret = -1;
+            break;
+        }
+        g_array_append_val(slots, vpn_index);
+    }
+
+    g_strfreev(names);
+    return ret;
+}
+
+// "KIND NAME on|off", plus the pending job or transition if any
+static void append_vpn(GString *out, const char *kind, const struct vpn_entry *entry)
+{
+    enum vpn_job job = jobs_pending(entry->name);
+
+    g_string_append_printf(out, "%s %s %s", kind, entry->name, entry->state ? "on" : "off");
+    if (job == VPN_JOB_STARTING) {
+        g_string_append(out, " starting");
+    } else if (job == VPN_JOB_STOPPING) {
+        g_string_append(out, " stopping");
+    } else if (entry->transitioning) {
+        g_string_append(out, " busy");
+    }
+    g_string_append_c(out, '\n');
+}
+
+static void queue(struct control_client *client, const GString *text)
+{
+    if (client->closed || text->len == 0) {
+        return;
+    }
+    if (client->queued->len + client->sending->len + text->len > CONTROL_MAX_BACKLOG) {
+        g_print("%s: WARNING: Control client not reading, dropped\n", APP_NAME);
+        drop_client(client);
+        return;
+    }
+    g_string_append_len(client->queued, text->str, text->len);
+    flush(client);
+}
+
+// Hand the queued output to the stream, one write in flight at a time
+static void flush(struct control_client *client)
+{
+    GString *swap;
+
+    if (client->closed || client->sending->len > 0 || client->queued->len == 0) {
+        return;
+    }
+    swap = client->sending;
+    client->sending = client->queued;
+    client->queued = swap;
+
+    client->refs++;
+    g_output_stream_write_all_async(g_io_stream_get_output_stream(G_IO_STREAM(client->connection)),
+                                    client->sending->str, client->sending->len, G_PRIORITY_DEFAULT,
+                                    client->cancellable, on_written, client);
+}
+
+static void on_written(GObject *source, GAsyncResult *result, gpointer data)
+{
+    struct control_client *client = data;
+    gboolean written = g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, NULL);
+
+    g_string_truncate(client->sending, 0);
+    if (!written) {
+        drop_client(client);
+    } else {
+        flush(client);
+    }
+    unref_client(client);
+}
+
+// Cancel whatever is in flight; the client is freed once that has finished
+static void drop_client(struct control_client *client)
+{
+    if (client->closed) {
+        return;
+    }
+    client->closed = 1;
+    g_cancellable_cancel(client->cancellable);
+    clients = g_list_remove(clients, client);
+    unref_client(client);
+}
+
+static void unref_client(struct control_client *client)
+{
+    if (--client->refs > 0) {
+        return;
+    }
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_object_unref(client->cancellable);
+    g_string_free(client->queued, TRUE);
+    g_string_free(client->sending, TRUE);
+    g_free(client);
+}
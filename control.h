@@ -0,0 +1,14 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <glib.h>
+#include "changes.h"
+
+typedef void (*control_toggle_cb)(const char *vpn_name, int on, gpointer data);
+
+int control_forward(int argc, char *argv[]);
+int control_init(control_toggle_cb toggle_cb, gpointer data);
+void control_apply_changes(const struct vpn_change *changes, int count, gpointer data);
+void control_cleanup(void);
+
+#endif
@@ -0,0 +1,180 @@
+#include <string.h>
+#include <gio/gio.h>
+#include "openvpn-tray.h"
+#include "discovery.h"
+#include "profiles.h"
+
+/*
+ * Watch the OpenVPN configuration directory and its client/ and server/
+ * roots (profiles.c) and report added and removed *.conf profiles as they
+ * happen, so the list does not have to be rescanned on every refresh. A
+ * root that is created or removed later is reported as a whole with a
+ * NULL name, the caller rescans.
+ */
+
+static GFile *base_dir = NULL;
+static GFileMonitor **monitors = NULL;      // Per profile root, NULL while it is not watched
+static const struct profile_root *roots = NULL;
+static int root_count = 0;
+static discovery_cb on_profile = NULL;
+static gpointer callback_data = NULL;
+
+static GFileMonitor *watch_root(int root);
+static int root_of_dir(GFile *file);
+static char *profile_name(GFile *file, int root);
+static void report(GFile *file, int root, int added);
+static void on_dir_changed(GFileMonitor *mon, GFile *file, GFile *other_file,
+                           GFileMonitorEvent event, gpointer data);
+
+int discovery_watch(const char *conf_dir, discovery_cb cb, gpointer data)
+{
+    GError *error = NULL;
+    int i;
+
+    on_profile = cb;
+    callback_data = data;
+    base_dir = g_file_new_for_path(conf_dir);
+    roots = profiles_roots(&root_count);
+    monitors = g_new0(GFileMonitor *, root_count);
+
+    monitors[0] = g_file_monitor_directory(base_dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (!monitors[0]) {
+        g_print("%s: WARNING: Unable to watch %s, rescanning on every refresh: %s\n",
+                APP_NAME, conf_dir, error->message);
+        g_error_free(error);
+        discovery_cleanup();
+        return -1;
+    }
+    g_signal_connect(monitors[0], "changed", G_CALLBACK(on_dir_changed), GINT_TO_POINTER(0));
+
+    for (i = 1; i < root_count; i++) {
+        monitors[i] = watch_root(i);
+    }
+    return 0;
+}
+
+int discovery_is_watching(void)
+{
+    return monitors != NULL;
+}
+
+void discovery_cleanup(void)
+{
+    int i;
+
+    if (monitors) {
+        for (i = 0; i < root_count; i++) {
+            if (monitors[i]) {
+                g_file_monitor_cancel(monitors[i]);
+                g_object_unref(monitors[i]);
+            }
+        }
+        g_free(monitors);
+        monitors = NULL;
+    }
+    g_clear_object(&base_dir);
+}
+
+// Monitor of a subdirectory root, NULL if it does not exist (yet)
+static GFileMonitor *watch_root(int root)
+{
+    GFile *dir = g_file_get_child(base_dir, roots[root].subdir);
+    GFileMonitor *monitor = NULL;
+
+    if (g_file_query_file_type(dir, G_FILE_QUERY_INFO_NONE, NULL) == G_FILE_TYPE_DIRECTORY) {
+        monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+    }
+    if (monitor) {
+        g_signal_connect(monitor, "changed", G_CALLBACK(on_dir_changed), GINT_TO_POINTER(root));
+    }
+    g_object_unref(dir);
+    return monitor;
+}
+
+// The subdirectory root a file of the profile directory is, -1 if none
+static int root_of_dir(GFile *file)
+{
+    char *basename = g_file_get_basename(file);
+    int root = -1;
+    int i;
+
+    for (i = 1; basename && i < root_count; i++) {
+        if (strcmp(basename, roots[i].subdir) == 0) {
+            root = i;
+            break;
+        }
+    }
+    g_free(basename);
+    return root;
+}
+
+// Returns the VPN name for a *.conf file in the root, NULL for any other file
+static char *profile_name(GFile *file, int root)
+{
+    char *basename = g_file_get_basename(file);
+    size_t len = basename ? strlen(basename) : 0;
+    char *name = NULL;
+
+    if (len > 5 && strcmp(basename + len - 5, ".conf") == 0) {
+        if (roots[root].subdir[0]) {
+            name = g_strdup_printf("%s/%.*s", roots[root].subdir, (int)(len - 5), basename);
+        } else {
+            name = g_strndup(basename, len - 5);
+        }
+    }
+
+    g_free(basename);
+    return name;
+}
+
+static void report(GFile *file, int root, int added)
+{
+    char *name;
+    int sub;
+
+    if (!file) {
+        return;
+    }
+
+    // A subdirectory root came or went with whatever it holds
+    if (root == 0 && (sub = root_of_dir(file)) > 0) {
+        if (monitors[sub]) {
+            g_file_monitor_cancel(monitors[sub]);
+            g_clear_object(&monitors[sub]);
+        }
+        if (added) {
+            monitors[sub] = watch_root(sub);
+        }
+        on_profile(NULL, added, callback_data);
+        return;
+    }
+
+    if (!(name = profile_name(file, root))) {
+        return;
+    }
+    on_profile(name, added, callback_data);
+    g_free(name);
+}
+
+static void on_dir_changed(GFileMonitor *mon, GFile *file, GFile *other_file,
+                           GFileMonitorEvent event, gpointer data)
+{
+    int root = GPOINTER_TO_INT(data);
+
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+        report(file, root, 1);
+        break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        report(file, root, 0);
+        break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        report(file, root, 0);
+        report(other_file, root, 1);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <glib.h>
+
+// vpn_name is NULL when a whole profile root appeared or vanished
+typedef void (*discovery_cb)(const char *vpn_name, int added, gpointer data);
+
+int discovery_watch(const char *conf_dir, discovery_cb cb, gpointer data);
+int discovery_is_watching(void);
+void discovery_cleanup(void);
+
+#endif
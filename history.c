@@ -0,0 +1,254 @@
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "changes.h"
+#include "history.h"
+
+/*
+ * Per-VPN state history: a fixed ring of timestamped transitions plus
+ * hourly buckets of up time and state changes covering the last
+ * HISTORY_HOURS hours. Each VPN gets one block of fixed size when its
+ * profile is added; recording a transition on the poll path is O(1) and
+ * never allocates, so memory use does not grow with uptime.
+ */
+
+struct vpn_history {
+    gint64 ring[HISTORY_RING_SIZE];     // time << 1 | state
+    int head;                           // Next ring position to write
+    int count;                          // Valid ring entries
+    int state;                          // Last recorded state, -1 if none yet
+    guint64 transitions;                // Since the first observation
+    gint64 observed_since;              // First observation
+    gint64 accounted_to;                // Up time is in the buckets up to here
+    gint64 bucket_hour;                 // Hour (time / 3600) of the newest bucket
+    guint32 up_seconds[HISTORY_HOURS];
+    guint16 flaps[HISTORY_HOURS];
+};
+
+static void roll(struct vpn_history *history, gint64 now);
+static void account(struct vpn_history *history, gint64 now);
+static void format_duration(GString *out, gint64 seconds);
+static gint compare_lines(gconstpointer a, gconstpointer b);
+
+void history_attach(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+
+    if (entry->history == NULL) {
+        struct vpn_history *history = g_new0(struct vpn_history, 1);
+
+        history->state = -1;
+        entry->history = history;
+    }
+}
+
+void history_detach(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+
+    g_free(entry->history);
+    entry->history = NULL;
+}
+
+// Change set listener: record new profiles and state changes
+void history_apply_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    gint64 now = history_now();
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (changes[i].kind == CHANGE_ADDED || changes[i].kind == CHANGE_STATE) {
+            history_record(registry_get(changes[i].vpn_index), now);
+        }
+    }
+}
+
+/*
+ * Note the entry's current state; an unchanged state returns after one
+ * compare.
+ */
+void history_record(struct vpn_entry *entry, gint64 now)
+{
+    struct vpn_history *history = entry->history;
+
+    if (history == NULL || history->state == entry->state) {
+        return;
+    }
+
+    if (history->state < 0) {
+        history->observed_since = now;
+        history->accounted_to = now;
+        history->bucket_hour = now / 3600;
+    } else {
+        account(history, now);
+        history->flaps[history->bucket_hour % HISTORY_HOURS]++;
+        history->transitions++;
+    }
+
+    history->ring[history->head] = now << 1 | (entry->state ? 1 : 0);
+    history->head = (history->head + 1) % HISTORY_RING_SIZE;
+    if (history->count < HISTORY_RING_SIZE) {
+        history->count++;
+    }
+    history->state = entry->state;
+}
+
+// Drop the buckets which fell out of the window
+static void roll(struct vpn_history *history, gint64 now)
+{
+    gint64 hour = now / 3600;
+
+    if (hour - history->bucket_hour >= HISTORY_HOURS) {
+        memset(history->up_seconds, 0, sizeof(history->up_seconds));
+        memset(history->flaps, 0, sizeof(history->flaps));
+        history->bucket_hour = hour;
+        return;
+    }
+    while (history->bucket_hour < hour) {
+        history->bucket_hour++;
+        history->up_seconds[history->bucket_hour % HISTORY_HOURS] = 0;
+        history->flaps[history->bucket_hour % HISTORY_HOURS] = 0;
+    }
+}
+
+// Move the up time since accounted_to into the hourly buckets
+static void account(struct vpn_history *history, gint64 now)
+{
+    gint64 from = history->accounted_to;
+
+    roll(history, now);
+    if (history->state == 1) {
+        from = MAX(from, (history->bucket_hour - HISTORY_HOURS + 1) * 3600);
+        while (from < now) {
+            gint64 hour_end = (from / 3600 + 1) * 3600;
+            gint64 to = MIN(hour_end, now);
+
+            history->up_seconds[(from / 3600) % HISTORY_HOURS] += to - from;
+            from = to;
+        }
+    }
+    history->accounted_to = MAX(history->accounted_to, now);
+}
+
+// Returns -1 if the entry has no history
+int history_get(struct vpn_entry *entry, gint64 now, struct history_summary *summary)
+{
+    struct vpn_history *history = entry->history;
+    int i;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->state = -1;
+    if (history == NULL || history->state < 0) {
+        return -1;
+    }
+
+    account(history, now);
+    for (i = 0; i < HISTORY_HOURS; i++) {
+        summary->up_seconds += history->up_seconds[i];
+        summary->flaps += history->flaps[i];
+    }
+    summary->state = history->state;
+    summary->transitions = history->transitions;
+    summary->last_change = history->ring[(history->head + HISTORY_RING_SIZE - 1) % HISTORY_RING_SIZE] >> 1;
+    // The window starts at the oldest bucket, just under HISTORY_HOURS ago
+    summary->window = MIN(now - history->observed_since, now - (history->bucket_hour - HISTORY_HOURS + 1) * 3600);
+    summary->up_seconds = MIN(summary->up_seconds, summary->window);
+    return 0;
+}
+
+// Copy up to max transitions, newest first; returns how many were copied
+int history_transitions(struct vpn_entry *entry, gint64 *times, int *states, int max)
+{
+    struct vpn_history *history = entry->history;
+    int i;
+
+    if (history == NULL) {
+        return 0;
+    }
+    for (i = 0; i < max && i < history->count; i++) {
+        gint64 item = history->ring[(history->head + HISTORY_RING_SIZE - 1 - i) % HISTORY_RING_SIZE];
+
+        times[i] = item >> 1;
+        states[i] = item & 1;
+    }
+    return i;
+}
+
+static void format_duration(GString *out, gint64 seconds)
+{
+    if (seconds >= 86400) {
+        g_string_append_printf(out, "%dd %dh", (int)(seconds / 86400), (int)(seconds % 86400 / 3600));
+    } else if (seconds >= 3600) {
+        g_string_append_printf(out, "%dh %02dm", (int)(seconds / 3600), (int)(seconds % 3600 / 60));
+    } else {
+        g_string_append_printf(out, "%dm", (int)(seconds / 60));
+    }
+}
+
+// One line, e.g. "up 5h 02m, 97% of 24h, 3 flaps"
+void history_format(struct vpn_entry *entry, gint64 now, GString *out)
+{
+    struct history_summary summary;
+
+    if (history_get(entry, now, &summary) != 0) {
+        g_string_append(out, "no history yet");
+        return;
+    }
+
+    g_string_append(out, summary.state ? "up " : "down ");
+    format_duration(out, now - summary.last_change);
+    if (summary.window > 0) {
+        g_string_append_printf(out, ", %d%% of ", (int)(summary.up_seconds * 100 / summary.window));
+        format_duration(out, summary.window);
+    }
+    if (summary.flaps > 0) {
+        g_string_append_printf(out, ", %d flap%s", summary.flaps, summary.flaps == 1 ? "" : "s");
+    }
+}
+
+struct tooltip_line {
+    struct vpn_entry *entry;
+    int flaps;
+};
+
+static gint compare_lines(gconstpointer a, gconstpointer b)
+{
+    const struct tooltip_line *la = a, *lb = b;
+
+    if (la->flaps != lb->flaps) {
+        return lb->flaps - la->flaps;
+    }
+    return strcmp(la->entry->name, lb->entry->name);
+}
+
+/*
+ * Tooltip lines for the VPNs worth showing (ON or changed state within the
+ * window), most flapping first, at most max_lines of them.
+ */
+void history_tooltip_lines(gint64 now, int max_lines, GString *out)
+{
+    GArray *lines = g_array_new(FALSE, FALSE, sizeof(struct tooltip_line));
+    struct history_summary summary;
+    struct vpn_entry *entry;
+    int i;
+
+    registry_foreach(i, entry) {
+        if (history_get(entry, now, &summary) == 0 && (summary.state == 1 || summary.flaps > 0)) {
+            struct tooltip_line line = { entry, summary.flaps };
+
+            g_array_append_val(lines, line);
+        }
+    }
+    g_array_sort(lines, compare_lines);
+
+    for (i = 0; i < lines->len && i < max_lines; i++) {
+        entry = g_array_index(lines, struct tooltip_line, i).entry;
+        g_string_append_printf(out, "\n%s: ", entry->name);
+        history_format(entry, now, out);
+    }
+    if (lines->len > max_lines) {
+        g_string_append_printf(out, "\n+%d more", lines->len - max_lines);
+    }
+    g_array_free(lines, TRUE);
+}
@@ -0,0 +1,34 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <glib.h>
+#include "registry.h"
+#include "changes.h"
+
+// Transitions kept per VPN; older ones are overwritten
+#define HISTORY_RING_SIZE 32
+// Rolling window of the aggregates, in hourly buckets
+#define HISTORY_HOURS 24
+
+// Aggregates over the last HISTORY_HOURS hours
+struct history_summary {
+    int state;              // Current state, -1 if never observed
+    gint64 last_change;     // Real time (seconds) of the last transition
+    gint64 window;          // Seconds of the window actually observed
+    gint64 up_seconds;      // Time up within the window
+    int flaps;              // State changes within the window
+    guint64 transitions;    // State changes since the profile was first seen
+};
+
+void history_attach(int vpn_index);
+void history_detach(int vpn_index);
+void history_record(struct vpn_entry *entry, gint64 now);
+void history_apply_changes(const struct vpn_change *changes, int count, gpointer data);
+int history_get(struct vpn_entry *entry, gint64 now, struct history_summary *summary);
+int history_transitions(struct vpn_entry *entry, gint64 *times, int *states, int max);
+void history_format(struct vpn_entry *entry, gint64 now, GString *out);
+void history_tooltip_lines(gint64 now, int max_lines, GString *out);
+
+#define history_now() (g_get_real_time() / G_USEC_PER_SEC)
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <gtk/gtk.h>
+#include "openvpn-tray.h"
+#include "icons.h"
+
+/*
+ * Cache of the tray icon variants. Each (kind, badge) pair is composited
+ * once from the GResource PNGs at the size the tray actually uses and
+ * kept until that size changes. icons_show() only calls into GTK when
+ * the wanted variant differs from the one on display, so a status update
+ * which changes nothing visible costs no GTK call and no tray repaint.
+ */
+
+static GtkStatusIcon *icon = NULL;
+static GHashTable *cache = NULL;    // kind | badge << 2 -> GdkPixbuf
+static int icon_size = 0;           // Pixel size the cached variants were rendered at
+static int shown_key = -1;          // Variant on display, -1 for none
+
+static gboolean on_size_changed(GtkStatusIcon *tray_icon, gint size, gpointer data);
+static GdkPixbuf *lookup(int key);
+static GdkPixbuf *render(enum icon_kind kind, int badge);
+static GdkPixbuf *load_base(const char *name);
+static void draw_badge(cairo_t *cr, int badge);
+
+void icons_init(GtkStatusIcon *tray_icon)
+{
+    icon = tray_icon;
+    cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+    g_signal_connect(G_OBJECT(tray_icon), "size-changed", G_CALLBACK(on_size_changed), NULL);
+}
+
+/*
+ * Show the variant for kind with the active count as a badge, 0 for none;
+ * counts over ICON_BADGE_MAX share one "9+" variant.
+ */
+void icons_show(enum icon_kind kind, int badge)
+{
+    int key = kind | MIN(badge, ICON_BADGE_MAX + 1) << 2;
+
+    if (key == shown_key || icon == NULL) {
+        return;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    gtk_status_icon_set_from_pixbuf(icon, lookup(key));
+#pragma GCC diagnostic pop
+    shown_key = key;
+}
+
+void icons_cleanup(void)
+{
+    if (cache) {
+        g_hash_table_destroy(cache);
+        cache = NULL;
+    }
+    icon = NULL;
+    shown_key = -1;
+}
+
+// The tray was resized: drop all variants and render the current one anew
+static gboolean on_size_changed(GtkStatusIcon *tray_icon, gint size, gpointer data)
+{
+    int key = shown_key;
+
+    if (size <= 0 || size == icon_size) {
+        return FALSE;
+    }
+    g_hash_table_remove_all(cache);
+    icon_size = size;
+    shown_key = -1;
+    if (key >= 0) {
+        icons_show(key & 3, key >> 2);
+    }
+    return TRUE;
+}
+
+static GdkPixbuf *lookup(int key)
+{
+    GdkPixbuf *pixbuf;
+
+    if (icon_size <= 0) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+        icon_size = gtk_status_icon_get_size(icon);
+#pragma GCC diagnostic pop
+        if (icon_size <= 0) {
+            icon_size = ICON_DEFAULT_SIZE;
+        }
+    }
+
+    pixbuf = g_hash_table_lookup(cache, GINT_TO_POINTER(key));
+    if (pixbuf == NULL) {
+        pixbuf = render(key & 3, key >> 2);
+        g_hash_table_insert(cache, GINT_TO_POINTER(key), pixbuf);
+    }
+    return pixbuf;
+}
+
+/*
+ * Partial is the ON icon washed out, transitioning a cross-fade of OFF
+ * and ON; the badge goes into the bottom right corner.
+ */
+static GdkPixbuf *render(enum icon_kind kind, int badge)
+{
+    GdkPixbuf *on = load_base("openvpn-on.png");
+    GdkPixbuf *off = load_base("openvpn-off.png");
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, icon_size, icon_size);
+    cairo_t *cr = cairo_create(surface);
+    GdkPixbuf *pixbuf;
+
+    switch (kind) {
+    case ICON_ON:
+        gdk_cairo_set_source_pixbuf(cr, on, 0, 0);
+        cairo_paint(cr);
+        break;
+    case ICON_PARTIAL:
+        gdk_pixbuf_saturate_and_pixelate(on, on, 0.35, FALSE);
+        gdk_cairo_set_source_pixbuf(cr, on, 0, 0);
+        cairo_paint(cr);
+        break;
+    case ICON_TRANSITIONING:
+        gdk_cairo_set_source_pixbuf(cr, off, 0, 0);
+        cairo_paint(cr);
+        gdk_cairo_set_source_pixbuf(cr, on, 0, 0);
+        cairo_paint_with_alpha(cr, 0.5);
+        break;
+    default:
+        gdk_cairo_set_source_pixbuf(cr, off, 0, 0);
+        cairo_paint(cr);
+        break;
+    }
+    if (badge > 0) {
+        draw_badge(cr, badge);
+    }
+
+    cairo_destroy(cr);
+    pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, icon_size, icon_size);
+    cairo_surface_destroy(surface);
+    g_object_unref(on);
+    g_object_unref(off);
+
+    return pixbuf;
+}
+
+static GdkPixbuf *load_base(const char *name)
+{
+    char path[64];
+    GdkPixbuf *pixbuf;
+
+    snprintf(path, sizeof(path), "/org/platon/images/%s", name);
+    pixbuf = gdk_pixbuf_new_from_resource_at_scale(path, icon_size, icon_size, TRUE, NULL);
+    if (pixbuf == NULL) {
+        g_print("%s: ERROR: Cannot load icon %s\n", APP_NAME, path);
+        pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, icon_size, icon_size);
+        gdk_pixbuf_fill(pixbuf, 0);
+    }
+    return pixbuf;
+}
+
+static void draw_badge(cairo_t *cr, int badge)
+{
+    double radius = icon_size * 0.27;
+    double x = icon_size - radius;
+    double y = icon_size - radius;
+    cairo_text_extents_t extents;
+    char text[8];
+
+    if (badge > ICON_BADGE_MAX) {
+        snprintf(text, sizeof(text), "%d+", ICON_BADGE_MAX);
+    } else {
+        snprintf(text, sizeof(text), "%d", badge);
+    }
+
+    cairo_arc(cr, x, y, radius, 0, 2 * G_PI);
+    cairo_set_source_rgb(cr, 0.8, 0.1, 0.1);
+    cairo_fill(cr);
+
+    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, radius * (text[1] ? 1.1 : 1.5));
+    cairo_text_extents(cr, text, &extents);
+    cairo_move_to(cr, x - extents.width / 2 - extents.x_bearing, y - extents.height / 2 - extents.y_bearing);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_show_text(cr, text);
+}
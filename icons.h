@@ -0,0 +1,18 @@
+#ifndef ICONS_H
+#define ICONS_H
+
+#include <gtk/gtk.h>
+
+// Tray icon variants
+enum icon_kind {
+    ICON_OFF,               // All VPNs off
+    ICON_ON,                // All VPNs on
+    ICON_PARTIAL,           // Some VPNs on
+    ICON_TRANSITIONING,     // A unit is starting or stopping
+};
+
+void icons_init(GtkStatusIcon *tray_icon);
+void icons_show(enum icon_kind kind, int badge);
+void icons_cleanup(void);
+
+#endif
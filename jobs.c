@@ -0,0 +1,147 @@
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+#include "jobs.h"
+
+/*
+ * Start/stop jobs are handed to the state backend, which runs them without
+ * blocking the main loop. At most max_parallel jobs run at once, further
+ * jobs wait in a FIFO queue. Completion is reported from the main context
+ * once the backend is done, a failed job does not hold up the others.
+ */
+
+struct job {
+    char *vpn_name;
+    enum vpn_job type;
+};
+
+static GHashTable *pending = NULL;      // VPN name -> enum vpn_job, queued or running
+static GQueue queued = G_QUEUE_INIT;
+static int running = 0;
+static int max_parallel = DEFAULT_MAX_PARALLEL_JOBS;
+static struct jobs_progress batch;
+static jobs_done_cb on_done = NULL;
+static gpointer callback_data = NULL;
+
+static void run_queued(void);
+static int start_job(struct job *job);
+static void finish_job(struct job *job, int success);
+static void on_job_exited(int success, gpointer data);
+
+void jobs_init(jobs_done_cb done_cb, gpointer data)
+{
+    pending = g_hash_table_new(g_str_hash, g_str_equal);
+    on_done = done_cb;
+    callback_data = data;
+}
+
+/*
+ * Returns 0 when the job was queued, -1 when a job for the VPN is already
+ * queued or in flight.
+ */
+int jobs_submit(const char *vpn_name, enum vpn_job type)
+{
+    struct job *job;
+
+    if (jobs_pending(vpn_name) != VPN_JOB_NONE) {
+        return -1;
+    }
+
+    if (g_hash_table_size(pending) == 0) {
+        memset(&batch, 0, sizeof(batch));
+        batch.type = type;
+    } else if (batch.type != type) {
+        batch.type = VPN_JOB_NONE;
+    }
+    batch.total++;
+
+    job = g_new0(struct job, 1);
+    job->vpn_name = g_strdup(vpn_name);
+    job->type = type;
+    g_hash_table_insert(pending, job->vpn_name, GINT_TO_POINTER(type));
+    g_queue_push_tail(&queued, job);
+
+    run_queued();
+    return 0;
+}
+
+enum vpn_job jobs_pending(const char *vpn_name)
+{
+    if (!pending) {
+        return VPN_JOB_NONE;
+    }
+    return GPOINTER_TO_INT(g_hash_table_lookup(pending, vpn_name));
+}
+
+int jobs_in_flight(void)
+{
+    return pending ? g_hash_table_size(pending) : 0;
+}
+
+void jobs_get_progress(struct jobs_progress *progress)
+{
+    *progress = batch;
+}
+
+void jobs_set_max_parallel(int max)
+{
+    max_parallel = max > 0 ? max : 1;
+    run_queued();
+}
+
+int jobs_get_max_parallel(void)
+{
+    return max_parallel;
+}
+
+static void run_queued(void)
+{
+    while (running < max_parallel && !g_queue_is_empty(&queued)) {
+        struct job *job = g_queue_pop_head(&queued);
+
+        if (start_job(job) != 0) {
+            finish_job(job, 0);
+        }
+    }
+}
+
+static int start_job(struct job *job)
+{
+    const struct vpn_backend *backend = backend_get();
+    int ret;
+
+    if (job->type == VPN_JOB_STARTING) {
+        ret = backend->start(job->vpn_name, on_job_exited, job);
+    } else {
+        ret = backend->stop(job->vpn_name, on_job_exited, job);
+    }
+    if (ret == 0) {
+        running++;
+    }
+    return ret;
+}
+
+static void finish_job(struct job *job, int success)
+{
+    if (success) {
+        batch.succeeded++;
+    } else {
+        batch.failed++;
+    }
+
+    g_hash_table_remove(pending, job->vpn_name);
+    if (on_done) {
+        on_done(job->vpn_name, job->type, success, callback_data);
+    }
+
+    g_free(job->vpn_name);
+    g_free(job);
+}
+
+static void on_job_exited(int success, gpointer data)
+{
+    running--;
+    finish_job(data, success);
+    run_queued();
+}
@@ -0,0 +1,33 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <glib.h>
+
+enum vpn_job {
+    VPN_JOB_NONE = 0,
+    VPN_JOB_STARTING,
+    VPN_JOB_STOPPING,
+};
+
+/*
+ * Progress of the current batch, i.e. all jobs submitted since the job
+ * pipeline was last idle. type is VPN_JOB_NONE for a mixed batch.
+ */
+struct jobs_progress {
+    int total;
+    int succeeded;
+    int failed;
+    enum vpn_job type;
+};
+
+typedef void (*jobs_done_cb)(const char *vpn_name, enum vpn_job job, int success, gpointer data);
+
+void jobs_init(jobs_done_cb done_cb, gpointer data);
+int jobs_submit(const char *vpn_name, enum vpn_job job);
+enum vpn_job jobs_pending(const char *vpn_name);
+int jobs_in_flight(void);
+void jobs_get_progress(struct jobs_progress *progress);
+void jobs_set_max_parallel(int max);
+int jobs_get_max_parallel(void);
+
+#endif
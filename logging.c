@@ -1,7 +1,39 @@
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "openvpn-tray.h"
 #include "logging.h"
+#include "registry.h"
+#include "stats.h"
+#include "changes.h"
+
+/*
+ * Status output is rendered into one buffer which is kept between calls,
+ * and handed to the kernel with a single write(): a summary of hundreds of
+ * VPNs costs one syscall and, once the buffer has grown, no allocation.
+ * Nothing is formatted through g_string_append_printf(), which allocates;
+ * padding is appended and numbers go through a buffer on the stack.
+ */
+
+int log_level = LOG_LEVEL_INFO;
+
+static enum log_format log_format = LOG_FORMAT_TEXT;
+static GString *out = NULL;         // Render buffer, reused
+static GArray *order = NULL;        // Slots in name order, reused
+
+static const char *level_names[] = { "info", "debug" };
+static const char *format_names[] = { "text", "json" };
+
+static void ensure_buffers(void);
+static void flush_out(void);
+static void append_repeat(char c, int count);
+static void append_padded(const char *str, int width);
+static void append_time(void);
+static void append_json_string(const char *str);
+static void render_table(void);
+static void render_summary_json(void);
+static void render_change(const struct vpn_change *change);
 
 int should_log_status_summary(void)
 {
@@ -14,17 +46,170 @@ void update_log_time(void)
     last_log_time = time(NULL);
 }
 
+// Set the log level by name, returns -1 for an unknown name
+int log_set_level(const char *name)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(level_names); i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            log_level = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Set the status output format by name, returns -1 for an unknown name
+int log_set_format(const char *name)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(format_names); i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            log_format = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 void print_vpn_status_summary(void)
 {
-    if (vpn_count == 0) {
-        printf("No VPNs configured\n");
+    if (log_format == LOG_FORMAT_JSON) {
+        render_summary_json();
+    } else {
+        render_table();
+    }
+    flush_out();
+}
+
+/*
+ * Change set listener: one line per VPN turned ON or OFF (a new profile
+ * counts as turned ON if it is), followed by the status summary.
+ */
+void log_vpn_status_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    int changes_detected = 0;
+    int force_summary = should_log_status_summary();
+    gint64 start = stats_begin();
+    int i;
+
+    if (first_run || force_summary) {
+        changes_detected = 1;
+        first_run = 0;
+    } else {
+        for (i = 0; i < count; i++) {
+            if (changes[i].kind == CHANGE_STATE || (changes[i].kind == CHANGE_ADDED && changes[i].state)) {
+                render_change(&changes[i]);
+                changes_detected = 1;
+            }
+        }
+    }
+
+    if (changes_detected) {
+        print_vpn_status_summary();
+        update_log_time();
+    }
+    stats_end(STATS_LOG, start);
+}
+
+static void ensure_buffers(void)
+{
+    if (!out) {
+        out = g_string_sized_new(4096);
+        order = g_array_new(FALSE, FALSE, sizeof(int));
+    }
+}
+
+static void flush_out(void)
+{
+    const char *pos = out->str;
+    gsize left = out->len;
+
+    // Anything printed with g_print() so far goes first
+    fflush(stdout);
+    while (left > 0) {
+        ssize_t written = write(STDOUT_FILENO, pos, left);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        pos += written;
+        left -= written;
+    }
+    g_string_truncate(out, 0);
+}
+
+// A negative count (title wider than the table) appends nothing
+static void append_repeat(char c, int count)
+{
+    gsize len = out->len;
+
+    if (count <= 0) {
+        return;
+    }
+    g_string_set_size(out, len + count);
+    memset(out->str + len, c, count);
+}
+
+// str left-aligned in a column of width, like "%-*s"
+static void append_padded(const char *str, int width)
+{
+    int len = strlen(str);
+
+    g_string_append_len(out, str, len);
+    append_repeat(' ', width - len);
+}
+
+// Wall clock seconds with milliseconds, independent of the locale
+static void append_time(void)
+{
+    gint64 now = g_get_real_time();
+    char buf[32];
+
+    g_snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT ".%03d", now / G_USEC_PER_SEC,
+               (int)(now % G_USEC_PER_SEC / 1000));
+    g_string_append(out, buf);
+}
+
+static void append_json_string(const char *str)
+{
+    g_string_append_c(out, '"');
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *str);
+        } else if ((unsigned char)*str < 0x20) {
+            char escape[8];
+
+            g_snprintf(escape, sizeof(escape), "\\u%04x", *str);
+            g_string_append(out, escape);
+        } else {
+            g_string_append_c(out, *str);
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+static void render_table(void)
+{
+    struct vpn_entry *entry;
+    int i;
+
+    ensure_buffers();
+    if (registry_count() == 0) {
+        g_string_append(out, "No VPNs configured\n");
         return;
     }
 
     // Calculate maximum VPN name length
     int max_name_len = 8; // Minimum for "VPN Name"
-    for (int i = 0; i < vpn_count; i++) {
-        int len = strlen(vpn_labels[i]);
+    registry_foreach(i, entry) {
+        int len = strlen(entry->name);
         if (len > max_name_len) {
             max_name_len = len;
         }
@@ -33,7 +218,7 @@ void print_vpn_status_summary(void)
     // Table dimensions
     int status_col_width = 6; // "Status"
     int total_width = max_name_len + 3 + status_col_width + 3 + 1; // padding + borders
-    
+
     // Calculate centering for title
     const char *title = " " APP_NAME " status ";
     int title_len = strlen(title);
@@ -42,67 +227,96 @@ void print_vpn_status_summary(void)
     int right_padding = available_space - title_len - left_padding;
 
     // Top border with centered title
-    printf("+");
-    for (int i = 0; i < left_padding; i++) printf("-");
-    printf("%s", title);
-    for (int i = 0; i < right_padding; i++) printf("-");
-    printf("+\n");
+    g_string_append_c(out, '+');
+    append_repeat('-', left_padding);
+    g_string_append(out, title);
+    append_repeat('-', right_padding);
+    g_string_append(out, "+\n");
 
     // Column headers
-    printf("| %-*s | %-*s |\n", max_name_len, "VPN Name", status_col_width, "Status");
+    g_string_append(out, "| ");
+    append_padded("VPN Name", max_name_len);
+    g_string_append(out, " | ");
+    append_padded("Status", status_col_width);
+    g_string_append(out, " |\n");
 
     // Separator row
-    printf("+");
-    for (int i = 0; i < max_name_len + 2; i++) printf("-");
-    printf("+");
-    for (int i = 0; i < status_col_width + 2; i++) printf("-");
-    printf("+\n");
-
-    // VPN entries
-    for (int i = 0; i < vpn_count; i++) {
-        printf("| %-*s | %-*s |\n", 
-                max_name_len, vpn_labels[i], 
-                status_col_width, vpn_states[i] ? "ON" : "OFF");
+    g_string_append_c(out, '+');
+    append_repeat('-', max_name_len + 2);
+    g_string_append_c(out, '+');
+    append_repeat('-', status_col_width + 2);
+    g_string_append(out, "+\n");
+
+    // VPN entries, sorted by name
+    registry_sorted(order);
+    for (guint n = 0; n < order->len; n++) {
+        entry = registry_get(g_array_index(order, int, n));
+        g_string_append(out, "| ");
+        append_padded(entry->name, max_name_len);
+        g_string_append(out, " | ");
+        append_padded(entry->state ? "ON" : "OFF", status_col_width);
+        g_string_append(out, " |\n");
     }
 
     // Bottom border
-    printf("+");
-    for (int i = 0; i < max_name_len + 2; i++) printf("-");
-    printf("+");
-    for (int i = 0; i < status_col_width + 2; i++) printf("-");
-    printf("+\n");
+    g_string_append_c(out, '+');
+    append_repeat('-', max_name_len + 2);
+    g_string_append_c(out, '+');
+    append_repeat('-', status_col_width + 2);
+    g_string_append(out, "+\n");
 }
 
-void log_vpn_status_changes(void)
+// {"event":"summary","time":...,"total":N,"on":["name",...]}
+static void render_summary_json(void)
 {
-    int changes_detected = 0;
-    int force_summary = should_log_status_summary();
-    
-    if (first_run || force_summary) {
-        print_vpn_status_summary();
-        changes_detected = 1;
-        first_run = 0;
-    } else {
-        for (int i = 0; i < vpn_count; i++) {
-            if (previous_vpn_states[i] != vpn_states[i]) {
-                printf("%s: VPN %s changed from %s to %s\n", 
-                       APP_NAME, vpn_labels[i],
-                       previous_vpn_states[i] ? "ON" : "OFF",
-                       vpn_states[i] ? "ON" : "OFF");
-                changes_detected = 1;
+    struct vpn_entry *entry;
+    char total[16];
+    int first = 1;
+
+    ensure_buffers();
+    g_snprintf(total, sizeof(total), "%d", registry_count());
+    g_string_append(out, "{\"event\":\"summary\",\"time\":");
+    append_time();
+    g_string_append(out, ",\"total\":");
+    g_string_append(out, total);
+    g_string_append(out, ",\"on\":[");
+    registry_sorted(order);
+    for (guint n = 0; n < order->len; n++) {
+        entry = registry_get(g_array_index(order, int, n));
+        if (entry->state) {
+            if (!first) {
+                g_string_append_c(out, ',');
             }
+            append_json_string(entry->name);
+            first = 0;
         }
-        
-        if (changes_detected) {
-            print_vpn_status_summary();
-        }
-    }
-    
-    if (changes_detected) {
-        update_log_time();
     }
-    
-    for (int i = 0; i < vpn_count; i++) {
-        previous_vpn_states[i] = vpn_states[i];
+    g_string_append(out, "]}\n");
+}
+
+static void render_change(const struct vpn_change *change)
+{
+    const char *from = change->previous_state ? "ON" : "OFF";
+    const char *to = change->state ? "ON" : "OFF";
+
+    ensure_buffers();
+    if (log_format == LOG_FORMAT_JSON) {
+        g_string_append(out, "{\"event\":\"change\",\"time\":");
+        append_time();
+        g_string_append(out, ",\"vpn\":");
+        append_json_string(change->name);
+        g_string_append(out, ",\"from\":\"");
+        g_string_append(out, from);
+        g_string_append(out, "\",\"to\":\"");
+        g_string_append(out, to);
+        g_string_append(out, "\"}\n");
+    } else {
+        g_string_append(out, APP_NAME ": VPN ");
+        g_string_append(out, change->name);
+        g_string_append(out, " changed from ");
+        g_string_append(out, from);
+        g_string_append(out, " to ");
+        g_string_append(out, to);
+        g_string_append_c(out, '\n');
     }
 }
@@ -2,17 +2,37 @@
 #define LOGGING_H
 
 #include <time.h>
+#include <glib.h>
+#include "changes.h"
+
+// Warnings and errors are always printed, only debug output is filtered
+enum log_level {
+    LOG_LEVEL_INFO = 0,
+    LOG_LEVEL_DEBUG,
+};
+
+enum log_format {
+    LOG_FORMAT_TEXT = 0,    // Status table and one line per change
+    LOG_FORMAT_JSON,        // JSON lines, one record per change plus a summary record
+};
 
-extern char vpn_labels[][32];
-extern int vpn_states[];
-extern int previous_vpn_states[];
-extern int vpn_count;
 extern time_t last_log_time;
 extern int first_run;
+extern int log_level;
+
+// Debug output; below LOG_LEVEL_DEBUG the arguments are not even evaluated
+#define log_debug(...) \
+    do { \
+        if (log_level >= LOG_LEVEL_DEBUG) { \
+            g_print(__VA_ARGS__); \
+        } \
+    } while (0)
 
 void print_vpn_status_summary(void);
-void log_vpn_status_changes(void);
+void log_vpn_status_changes(const struct vpn_change *changes, int count, gpointer data);
 int should_log_status_summary(void);
 void update_log_time(void);
+int log_set_level(const char *name);
+int log_set_format(const char *name);
 
 #endif
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <gtk/gtk.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "jobs.h"
+#include "menu.h"
+#include "stats.h"
+#include "history.h"
+#include "mgmt.h"
+#include "traffic.h"
+#include "conf.h"
+
+/*
+ * The left-click VPN menu is built once and patched in place: rows are
+ * inserted and destroyed as profiles come and go, and a row is only
+ * touched when what it shows (state, pending job) actually changed, as
+ * reported by the change set. Opening the menu does no work proportional
+ * to the number of profiles.
+ */
+
+static GtkWidget *menu = NULL;
+static GSequence *rows = NULL;      // VPN names in menu order, one per check item
+static GtkStatusIcon *menu_tray_icon = NULL;
+static GCallback toggle_handler = NULL;
+static GtkWidget *stale_item = NULL;    // "Last known states..." note below the rows
+
+static gint compare_names(gconstpointer a, gconstpointer b, gpointer data);
+static void patch_item(struct vpn_entry *entry);
+static gboolean on_item_query_tooltip(GtkWidget *item, gint x, gint y, gboolean keyboard_mode,
+                                      GtkTooltip *tooltip, gpointer data);
+static void on_menu_visibility(GtkWidget *widget, gpointer visible);
+static void drain_events(void);
+static long resident_kb(void);
+
+void vpn_menu_init(GtkStatusIcon *tray_icon, GCallback on_toggle,
+                   GCallback on_all_on, GCallback on_all_off)
+{
+    menu = g_object_ref_sink(gtk_menu_new());
+    rows = g_sequence_new(NULL);
+    menu_tray_icon = tray_icon;
+    toggle_handler = on_toggle;
+
+    // Throughput is sampled fast only while the menu is open
+    g_signal_connect(menu, "show", G_CALLBACK(on_menu_visibility), GINT_TO_POINTER(1));
+    g_signal_connect(menu, "hide", G_CALLBACK(on_menu_visibility), GINT_TO_POINTER(0));
+
+    GtkWidget *separator = gtk_separator_menu_item_new();
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), separator);
+
+    stale_item = gtk_menu_item_new_with_label("");
+    gtk_widget_set_sensitive(stale_item, FALSE);
+    gtk_widget_set_no_show_all(stale_item, TRUE);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), stale_item);
+
+    GtkWidget *turn_all_on_item = gtk_menu_item_new_with_label("Turn all VPNs on");
+    gtk_widget_set_sensitive(turn_all_on_item, !read_only_mode);
+    g_signal_connect(turn_all_on_item, "activate", on_all_on, tray_icon);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), turn_all_on_item);
+
+    GtkWidget *turn_all_off_item = gtk_menu_item_new_with_label("Turn all VPNs off");
+    gtk_widget_set_sensitive(turn_all_off_item, !read_only_mode);
+    g_signal_connect(turn_all_off_item, "activate", on_all_off, tray_icon);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), turn_all_off_item);
+
+    gtk_widget_show_all(menu);
+}
+
+// Insert the row of a newly added profile at its sorted position
+void vpn_menu_add(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+    GSequenceIter *row;
+    GtkWidget *item;
+
+    if (!menu || entry->menu_item) {
+        return;
+    }
+
+    row = g_sequence_insert_sorted(rows, entry->name, compare_names, NULL);
+    item = gtk_check_menu_item_new_with_label(entry->name);
+
+    // The item owns a copy of the name, the profile may be gone by the time it is toggled
+    char *vpn_name = g_strdup(entry->name);
+    g_object_set_data_full(G_OBJECT(item), "vpn_name", vpn_name, g_free);
+
+    if (read_only_mode) {
+        gtk_widget_set_sensitive(item, FALSE);
+    } else {
+        g_object_set_data(G_OBJECT(item), "tray_icon", menu_tray_icon);
+        g_signal_connect(item, "toggled", toggle_handler, vpn_name);
+    }
+
+    gtk_widget_set_has_tooltip(item, TRUE);
+    g_signal_connect(item, "query-tooltip", G_CALLBACK(on_item_query_tooltip), vpn_name);
+
+    gtk_menu_shell_insert(GTK_MENU_SHELL(menu), item, g_sequence_iter_get_position(row));
+    gtk_widget_show(item);
+
+    entry->menu_item = item;
+    entry->menu_row = row;
+    entry->menu_state = -1;
+    patch_item(entry);
+}
+
+// Destroy the row of a profile, must be called before it leaves the registry
+void vpn_menu_remove(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+
+    if (!entry->menu_item) {
+        return;
+    }
+
+    gtk_widget_destroy(entry->menu_item);
+    g_sequence_remove(entry->menu_row);
+    entry->menu_item = NULL;
+    entry->menu_row = NULL;
+}
+
+// Force the row to be patched with the next change set, e.g. after a user toggle
+void vpn_menu_invalidate(int vpn_index)
+{
+    registry_get(vpn_index)->menu_state = -1;
+}
+
+// Change set listener: patch the rows of the VPNs which changed
+void vpn_menu_apply_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    gint64 start = stats_begin();
+    int i;
+
+    for (i = 0; i < count; i++) {
+        struct vpn_entry *entry;
+
+        if (changes[i].vpn_index >= 0 && (entry = registry_get(changes[i].vpn_index))->menu_item) {
+            patch_item(entry);
+        }
+    }
+    stats_end(STATS_MENU_REFRESH, start);
+}
+
+// Note below the rows that they show last known states, hidden for NULL
+void vpn_menu_set_stale(const char *text)
+{
+    if (!stale_item) {
+        return;
+    }
+    if (text) {
+        gtk_menu_item_set_label(GTK_MENU_ITEM(stale_item), text);
+        gtk_widget_show(stale_item);
+    } else {
+        gtk_widget_hide(stale_item);
+    }
+}
+
+void vpn_menu_popup(void)
+{
+    gint64 start = stats_begin();
+
+    if (menu) {
+        gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
+    }
+    stats_end(STATS_MENU_POPUP, start);
+}
+
+/*
+ * Open and close the menu opens times for bench/popup.sh (--popup-bench),
+ * printing per tenth of the opens the average and maximum latency of an
+ * open (popup until its events are handled) and the resident memory. Returns 1 if the last tenth is over
+ * MENU_BENCH_LATENCY_FACTOR times slower than the first or memory grew by
+ * over MENU_BENCH_RSS_SLACK_KB after the first tenth, 0 otherwise.
+ */
+int vpn_menu_bench(int opens)
+{
+    int block = MAX(opens / 10, 1);
+    gint64 first_avg = 0, avg = 0, max_us = 0, total_us = 0;
+    long first_rss = 0, rss = 0;
+    int i;
+
+    if (!menu) {
+        return 1;
+    }
+
+    g_print("%s: Opening the VPN menu %d times with %d profiles\n", APP_NAME, opens, registry_count());
+    g_print("%8s %10s %10s %10s\n", "opens", "avg_us", "max_us", "rss_kb");
+    for (i = 1; i <= opens; i++) {
+        gint64 start = g_get_monotonic_time();
+        gint64 elapsed;
+
+        // Headless there is no trigger event, which gtk_menu_popup_at_pointer() wants
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+        gtk_menu_popup(GTK_MENU(menu), NULL, NULL, NULL, NULL, 0, GDK_CURRENT_TIME);
+#pragma GCC diagnostic pop
+        drain_events();
+        elapsed = g_get_monotonic_time() - start;
+        gtk_menu_popdown(GTK_MENU(menu));
+        drain_events();
+
+        total_us += elapsed;
+        max_us = MAX(max_us, elapsed);
+        if (i % block == 0 || i == opens) {
+            avg = total_us / (i % block ? i % block : block);
+            rss = resident_kb();
+            g_print("%8d %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10ld\n", i, avg, max_us, rss);
+            if (i == block) {
+                first_avg = avg;
+                first_rss = rss;
+            }
+            total_us = max_us = 0;
+        }
+    }
+
+    if (avg > first_avg * MENU_BENCH_LATENCY_FACTOR || rss - first_rss > MENU_BENCH_RSS_SLACK_KB) {
+        g_print("%s: ERROR: Menu opens not flat: %" G_GINT64_FORMAT " us after %" G_GINT64_FORMAT
+                " us, resident memory +%ld kB\n", APP_NAME, avg, first_avg, rss - first_rss);
+        return 1;
+    }
+    return 0;
+}
+
+void vpn_menu_cleanup(void)
+{
+    if (menu) {
+        gtk_widget_destroy(menu);
+        g_object_unref(menu);
+        menu = NULL;
+    }
+    if (rows) {
+        g_sequence_free(rows);
+        rows = NULL;
+    }
+    stale_item = NULL;
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b, gpointer data)
+{
+    return strcmp(a, b);
+}
+
+static void patch_item(struct vpn_entry *entry)
+{
+    GtkWidget *item = entry->menu_item;
+    enum vpn_job job = jobs_pending(entry->name);
+    int link_state = entry->state ? entry->link_state : MGMT_STATE_UNKNOWN;
+    int shown = entry->state | job << 1 | link_state << 3;
+
+    if (shown == entry->menu_state) {
+        return;
+    }
+    entry->menu_state = shown;
+
+    if (job == VPN_JOB_NONE && (link_state == MGMT_STATE_UNKNOWN || link_state == MGMT_STATE_CONNECTED)) {
+        gtk_menu_item_set_label(GTK_MENU_ITEM(item), entry->name);
+    } else if (job == VPN_JOB_NONE) {
+        // Unit active, tunnel not up (yet), e.g. "office (RECONNECTING)"
+        char *label = g_strdup_printf("%s (%s)", entry->name, mgmt_state_name(link_state));
+        gtk_menu_item_set_label(GTK_MENU_ITEM(item), label);
+        g_free(label);
+    } else {
+        char *label = g_strdup_printf("%s (%s…)", entry->name,
+                                      job == VPN_JOB_STARTING ? "starting" : "stopping");
+        gtk_menu_item_set_label(GTK_MENU_ITEM(item), label);
+        g_free(label);
+    }
+
+    // Programmatic updates must not be mistaken for user toggles
+    g_signal_handlers_block_matched(item, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, toggle_handler, NULL);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item),
+                                   job == VPN_JOB_NONE ? entry->state : job == VPN_JOB_STARTING);
+    g_signal_handlers_unblock_matched(item, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, toggle_handler, NULL);
+
+    // Disable checkboxes in read-only mode and while a job is in flight
+    gtk_widget_set_sensitive(item, !read_only_mode && job == VPN_JOB_NONE);
+}
+
+/*
+ * Uptime, flaps and the last few transitions of the VPN, built on hover so
+ * the rows themselves only change with state.
+ */
+static gboolean on_item_query_tooltip(GtkWidget *item, gint x, gint y, gboolean keyboard_mode,
+                                      GtkTooltip *tooltip, gpointer data)
+{
+    int vpn_index = registry_lookup(data);
+    gint64 times[MENU_TOOLTIP_TRANSITIONS];
+    int states[MENU_TOOLTIP_TRANSITIONS];
+    double rate_in, rate_out;
+    const struct conf_info *info;
+    struct vpn_entry *entry;
+    GString *text;
+    int count, i;
+
+    if (vpn_index < 0) {
+        return FALSE;
+    }
+
+    entry = registry_get(vpn_index);
+    text = g_string_new(NULL);
+
+    // Where the profile connects to, to tell similar names apart
+    if ((info = conf_lookup(entry->name)) != NULL) {
+        conf_format(info, text);
+        if (text->len > 0) {
+            g_string_append_c(text, '\n');
+        }
+    }
+    history_format(entry, history_now(), text);
+    if (entry->link_state != MGMT_STATE_UNKNOWN) {
+        gchar *in = g_format_size(entry->bytes_in);
+        gchar *out = g_format_size(entry->bytes_out);
+
+        g_string_append_printf(text, "\n%s, %s in, %s out", mgmt_state_name(entry->link_state), in, out);
+        g_free(in);
+        g_free(out);
+    }
+    traffic_poke();
+    if (traffic_rates(entry, &rate_in, &rate_out)) {
+        g_string_append_c(text, '\n');
+        traffic_format(entry, text);
+    }
+
+    count = history_transitions(entry, times, states, MENU_TOOLTIP_TRANSITIONS);
+    for (i = 0; i < count; i++) {
+        time_t when = times[i];
+        char stamp[32];
+        struct tm tm;
+
+        strftime(stamp, sizeof(stamp), "%b %d %H:%M", localtime_r(&when, &tm));
+        g_string_append_printf(text, "\n%s %s", stamp, states[i] ? "ON" : "OFF");
+    }
+
+    gtk_tooltip_set_text(tooltip, text->str);
+    g_string_free(text, TRUE);
+    return TRUE;
+}
+
+static void on_menu_visibility(GtkWidget *widget, gpointer visible)
+{
+    traffic_set_visible(GPOINTER_TO_INT(visible));
+}
+
+// Handle everything the last popup or popdown queued, drawing included
+static void drain_events(void)
+{
+    gdk_display_flush(gdk_display_get_default());
+    while (gtk_events_pending()) {
+        gtk_main_iteration();
+    }
+}
+
+// Resident set size from /proc, 0 if unavailable
+static long resident_kb(void)
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    long pages = 0;
+
+    if (fp) {
+        if (fscanf(fp, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(fp);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
@@ -0,0 +1,18 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include <gtk/gtk.h>
+#include "changes.h"
+
+void vpn_menu_init(GtkStatusIcon *tray_icon, GCallback on_toggle,
+                   GCallback on_all_on, GCallback on_all_off);
+void vpn_menu_add(int vpn_index);
+void vpn_menu_remove(int vpn_index);
+void vpn_menu_invalidate(int vpn_index);
+void vpn_menu_apply_changes(const struct vpn_change *changes, int count, gpointer data);
+void vpn_menu_set_stale(const char *text);
+void vpn_menu_popup(void);
+int vpn_menu_bench(int opens);
+void vpn_menu_cleanup(void);
+
+#endif
@@ -0,0 +1,427 @@
+#include <string.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "changes.h"
+#include "history.h"
+#include "stats.h"
+#include "metrics.h"
+
+/*
+ * Prometheus metrics over HTTP, for --metrics=[HOST:]PORT (loopback
+ * addresses only, 127.0.0.1 by default) or --metrics=unix:PATH. Any GET
+ * is answered with the text exposition; the connection is closed after
+ * every response.
+ *
+ * A scrape never probes. The series of a VPN (up, transitions, last
+ * change) are rendered into a per-slot cache when a change set touches
+ * it, and the per-VPN part of the body is only reassembled after such a
+ * change set; an idle scrape copies that part and renders the few
+ * process-wide series (stats.c) on top.
+ */
+
+#define METRICS_MAX_HEADER_LINES 100
+
+enum vpn_family {
+    FAMILY_UP,
+    FAMILY_TRANSITIONS,
+    FAMILY_LAST_CHANGE,
+    FAMILY_COUNT,
+};
+
+static const char *family_headers[FAMILY_COUNT] = {
+    "# HELP openvpn_tray_vpn_up Whether the VPN's unit is active.\n"
+    "# TYPE openvpn_tray_vpn_up gauge\n",
+    "# HELP openvpn_tray_vpn_transitions_total State changes since the profile was first seen.\n"
+    "# TYPE openvpn_tray_vpn_transitions_total counter\n",
+    "# HELP openvpn_tray_vpn_last_change_timestamp_seconds Last state change, or when the profile was first seen.\n"
+    "# TYPE openvpn_tray_vpn_last_change_timestamp_seconds gauge\n",
+};
+
+// Rendered lines of one registry slot
+struct vpn_series {
+    GString *lines[FAMILY_COUNT];
+    int dirty;
+};
+
+struct metrics_client {
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    GCancellable *cancellable;
+    GString *response;
+    int found;                  // Request line asked for a known path
+    int header_lines;
+};
+
+static GArray *series = NULL;       // struct vpn_series per registry slot
+static GString *body = NULL;        // Per-VPN part of the exposition
+static int body_dirty = 1;
+static GSocketService *service = NULL;
+static gchar *socket_path = NULL;   // Unix socket bound by this instance
+static GList *clients = NULL;       // struct metrics_client
+
+static GSocketAddress *parse_address(const char *address);
+static int is_listening(const char *path);
+static void sync_series(void);
+static void render_vpn(struct vpn_series *vpn, struct vpn_entry *entry, gint64 now);
+static void append_label(GString *out, const char *name, const char *value);
+static gboolean on_incoming(GSocketService *svc, GSocketConnection *connection, GObject *source, gpointer data);
+static void on_line(GObject *source, GAsyncResult *result, gpointer data);
+static void respond(struct metrics_client *client);
+static void on_written(GObject *source, GAsyncResult *result, gpointer data);
+static void free_client(struct metrics_client *client);
+
+// Listen on the given address, returns -1 if it is invalid or cannot be bound
+int metrics_init(const char *address)
+{
+    GSocketAddress *socket_address = parse_address(address);
+    GSocketAddress *bound = NULL;
+    GError *error = NULL;
+    GStatBuf st;
+
+    if (socket_address == NULL) {
+        g_print("%s: WARNING: Invalid metrics address %s, need [LOOPBACK-IP:]PORT or unix:PATH\n",
+                APP_NAME, address);
+        return -1;
+    }
+
+    // A socket left behind by an earlier run is replaced, one in use is not taken over
+    if (socket_path && g_lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (is_listening(socket_path)) {
+            g_print("%s: WARNING: Something already listens on %s, no metrics\n", APP_NAME, socket_path);
+            g_object_unref(socket_address);
+            g_free(socket_path);
+            socket_path = NULL;
+            return -1;
+        }
+        g_unlink(socket_path);
+    }
+
+    service = g_socket_service_new();
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(service), socket_address, G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_DEFAULT, NULL, &bound, &error)) {
+        g_print("%s: WARNING: Unable to serve metrics on %s: %s\n", APP_NAME, address, error->message);
+        g_error_free(error);
+        g_object_unref(socket_address);
+        g_clear_object(&service);
+        g_free(socket_path);
+        socket_path = NULL;
+        return -1;
+    }
+    g_object_unref(socket_address);
+
+    if (G_IS_INET_SOCKET_ADDRESS(bound)) {
+        gchar *ip = g_inet_address_to_string(g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(bound)));
+
+        g_print("%s: Metrics on http://%s:%u/metrics\n", APP_NAME, ip,
+                g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound)));
+        g_free(ip);
+    } else {
+        g_print("%s: Metrics on unix socket %s\n", APP_NAME, socket_path);
+    }
+    g_object_unref(bound);
+
+    g_signal_connect(service, "incoming", G_CALLBACK(on_incoming), NULL);
+    g_socket_service_start(service);
+    return 0;
+}
+
+// Change set listener: note the slots whose series must be rendered again
+void metrics_apply_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (changes[i].kind == CHANGE_DETAIL) {
+            continue;
+        }
+        body_dirty = 1;
+        if (changes[i].vpn_index >= 0 && series != NULL && changes[i].vpn_index < series->len) {
+            g_array_index(series, struct vpn_series, changes[i].vpn_index).dirty = 1;
+        }
+    }
+}
+
+// The whole exposition, appended to out
+void metrics_render(GString *out)
+{
+    struct changes_summary summary;
+    struct vpn_entry *entry;
+    gint64 now = history_now();
+    int i, family;
+
+    if (body_dirty) {
+        sync_series();
+        g_string_truncate(body, 0);
+        for (family = 0; family < FAMILY_COUNT; family++) {
+            g_string_append(body, family_headers[family]);
+            registry_foreach(i, entry) {
+                struct vpn_series *vpn = &g_array_index(series, struct vpn_series, i);
+
+                if (vpn->dirty) {
+                    render_vpn(vpn, entry, now);
+                }
+                g_string_append_len(body, vpn->lines[family]->str, vpn->lines[family]->len);
+            }
+        }
+        body_dirty = 0;
+    }
+    g_string_append_len(out, body->str, body->len);
+
+    changes_get_summary(&summary);
+    g_string_append(out, "# HELP openvpn_tray_vpns Profiles known to the tray.\n"
+                    "# TYPE openvpn_tray_vpns gauge\nopenvpn_tray_vpns ");
+    stats_append_uint(out, summary.total);
+    g_string_append(out, "\n# HELP openvpn_tray_vpns_up VPNs whose unit is active.\n"
+                    "# TYPE openvpn_tray_vpns_up gauge\nopenvpn_tray_vpns_up ");
+    stats_append_uint(out, summary.active);
+    g_string_append_c(out, '\n');
+    stats_prometheus(out);
+}
+
+void metrics_cleanup(void)
+{
+    int i, family;
+
+    // The main loop is done, so the callbacks in flight never run: free the clients here
+    while (clients != NULL) {
+        free_client(clients->data);
+    }
+    if (service) {
+        g_socket_service_stop(service);
+        g_socket_listener_close(G_SOCKET_LISTENER(service));
+        g_clear_object(&service);
+    }
+    if (socket_path) {
+        g_unlink(socket_path);
+        g_free(socket_path);
+        socket_path = NULL;
+    }
+    if (series) {
+        for (i = 0; i < series->len; i++) {
+            for (family = 0; family < FAMILY_COUNT; family++) {
+                g_string_free(g_array_index(series, struct vpn_series, i).lines[family], TRUE);
+            }
+        }
+        g_array_free(series, TRUE);
+        series = NULL;
+    }
+    if (body) {
+        g_string_free(body, TRUE);
+        body = NULL;
+    }
+    body_dirty = 1;
+}
+
+// "unix:PATH", "PORT" (on 127.0.0.1) or "IP:PORT" with a loopback IP
+static GSocketAddress *parse_address(const char *address)
+{
+    const char *colon = strrchr(address, ':');
+    GInetAddress *ip;
+    GSocketAddress *socket_address = NULL;
+    gchar *host, *end;
+    guint64 port;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        if (address[5] == '\0') {
+            return NULL;
+        }
+        socket_path = g_strdup(address + 5);
+        return g_unix_socket_address_new(socket_path);
+    }
+
+    host = colon ? g_strndup(address, colon - address) : g_strdup("127.0.0.1");
+    port = g_ascii_strtoull(colon ? colon + 1 : address, &end, 10);
+    if (host[0] == '[' && strlen(host) > 2 && host[strlen(host) - 1] == ']') {
+        gchar *bare = g_strndup(host + 1, strlen(host) - 2);
+
+        g_free(host);
+        host = bare;
+    }
+    ip = g_inet_address_new_from_string(host);
+    if (ip != NULL && g_inet_address_get_is_loopback(ip) && *end == '\0' && end != (colon ? colon + 1 : address) &&
+        port <= 65535) {
+        socket_address = g_inet_socket_address_new(ip, port);
+    }
+
+    if (ip) {
+        g_object_unref(ip);
+    }
+    g_free(host);
+    return socket_address;
+}
+
+// Something answers on the socket, as opposed to a stale file; same check as control.c
+static int is_listening(const char *path)
+{
+    GSocketAddress *address = g_unix_socket_address_new(path);
+    GSocketClient *socket_client = g_socket_client_new();
+    GSocketConnection *connection;
+
+    connection = g_socket_client_connect(socket_client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+    g_object_unref(socket_client);
+    g_object_unref(address);
+    if (connection == NULL) {
+        return 0;
+    }
+    g_object_unref(connection);
+    return 1;
+}
+
+// One cache entry per registry slot, new slots start dirty
+static void sync_series(void)
+{
+    int family;
+
+    if (series == NULL) {
+        series = g_array_new(FALSE, TRUE, sizeof(struct vpn_series));
+        body = g_string_sized_new(4096);
+    }
+    while (series->len < registry_size()) {
+        struct vpn_series vpn = { .dirty = 1 };
+
+        for (family = 0; family < FAMILY_COUNT; family++) {
+            vpn.lines[family] = g_string_new(NULL);
+        }
+        g_array_append_val(series, vpn);
+    }
+}
+
+static void render_vpn(struct vpn_series *vpn, struct vpn_entry *entry, gint64 now)
+{
+    struct history_summary summary;
+    int family;
+
+    for (family = 0; family < FAMILY_COUNT; family++) {
+        g_string_truncate(vpn->lines[family], 0);
+    }
+
+    g_string_append(vpn->lines[FAMILY_UP], "openvpn_tray_vpn_up");
+    append_label(vpn->lines[FAMILY_UP], "vpn", entry->name);
+    g_string_append(vpn->lines[FAMILY_UP], entry->state ? " 1\n" : " 0\n");
+
+    if (history_get(entry, now, &summary) == 0) {
+        g_string_append(vpn->lines[FAMILY_TRANSITIONS], "openvpn_tray_vpn_transitions_total");
+        append_label(vpn->lines[FAMILY_TRANSITIONS], "vpn", entry->name);
+        g_string_append_c(vpn->lines[FAMILY_TRANSITIONS], ' ');
+        stats_append_uint(vpn->lines[FAMILY_TRANSITIONS], summary.transitions);
+        g_string_append_c(vpn->lines[FAMILY_TRANSITIONS], '\n');
+
+        g_string_append(vpn->lines[FAMILY_LAST_CHANGE], "openvpn_tray_vpn_last_change_timestamp_seconds");
+        append_label(vpn->lines[FAMILY_LAST_CHANGE], "vpn", entry->name);
+        g_string_append_c(vpn->lines[FAMILY_LAST_CHANGE], ' ');
+        stats_append_uint(vpn->lines[FAMILY_LAST_CHANGE], MAX(summary.last_change, 0));
+        g_string_append_c(vpn->lines[FAMILY_LAST_CHANGE], '\n');
+    }
+    vpn->dirty = 0;
+}
+
+// {name="value"} with backslash, quote and newline escaped
+static void append_label(GString *out, const char *name, const char *value)
+{
+    g_string_append_c(out, '{');
+    g_string_append(out, name);
+    g_string_append(out, "=\"");
+    for (; *value; value++) {
+        if (*value == '\\' || *value == '"') {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *value);
+        } else if (*value == '\n') {
+            g_string_append(out, "\\n");
+        } else {
+            g_string_append_c(out, *value);
+        }
+    }
+    g_string_append(out, "\"}");
+}
+
+static gboolean on_incoming(GSocketService *svc, GSocketConnection *connection, GObject *source, gpointer data)
+{
+    struct metrics_client *client = g_new0(struct metrics_client, 1);
+
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+    client->cancellable = g_cancellable_new();
+    clients = g_list_prepend(clients, client);
+
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, client->cancellable, on_line, client);
+    return TRUE;
+}
+
+// The request line, then the headers up to the blank line
+static void on_line(GObject *source, GAsyncResult *result, gpointer data)
+{
+    struct metrics_client *client = data;
+    char *line = g_data_input_stream_read_line_finish(G_DATA_INPUT_STREAM(source), result, NULL, NULL);
+
+    // Freed by metrics_cleanup() meanwhile, only the pointer is compared
+    if (g_list_find(clients, client) == NULL) {
+        g_free(line);
+        return;
+    }
+    if (line == NULL || ++client->header_lines > METRICS_MAX_HEADER_LINES) {
+        g_free(line);
+        free_client(client);
+        return;
+    }
+
+    if (client->header_lines == 1) {
+        client->found = strncmp(line, "GET /metrics ", 13) == 0 || strncmp(line, "GET / ", 6) == 0;
+    } else if (*line == '\0') {
+        g_free(line);
+        respond(client);
+        return;
+    }
+    g_free(line);
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, client->cancellable, on_line, client);
+}
+
+static void respond(struct metrics_client *client)
+{
+    GString *content = g_string_sized_new(body ? body->len + 8192 : 8192);
+
+    if (client->found) {
+        metrics_render(content);
+    } else {
+        g_string_append(content, "Not found, see /metrics\n");
+    }
+
+    client->response = g_string_sized_new(content->len + 256);
+    g_string_append(client->response, client->found ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n");
+    g_string_append(client->response, "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                    "Content-Length: ");
+    stats_append_uint(client->response, content->len);
+    g_string_append(client->response, "\r\nConnection: close\r\n\r\n");
+    g_string_append_len(client->response, content->str, content->len);
+    g_string_free(content, TRUE);
+
+    g_output_stream_write_all_async(g_io_stream_get_output_stream(G_IO_STREAM(client->connection)),
+                                    client->response->str, client->response->len, G_PRIORITY_DEFAULT,
+                                    client->cancellable, on_written, client);
+}
+
+static void on_written(GObject *source, GAsyncResult *result, gpointer data)
+{
+    g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, NULL);
+    if (g_list_find(clients, data) != NULL) {
+        free_client(data);
+    }
+}
+
+static void free_client(struct metrics_client *client)
+{
+    clients = g_list_remove(clients, client);
+    g_cancellable_cancel(client->cancellable);
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_object_unref(client->cancellable);
+    if (client->response) {
+        g_string_free(client->response, TRUE);
+    }
+    g_free(client);
+}
@@ -0,0 +1,12 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+#include "changes.h"
+
+int metrics_init(const char *address);
+void metrics_apply_changes(const struct vpn_change *changes, int count, gpointer data);
+void metrics_render(GString *out);
+void metrics_cleanup(void);
+
+#endif
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "backend.h"
+#include "changes.h"
+#include "conf.h"
+#include "mgmt.h"
+#include "profiles.h"
+
+/*
+ * Client for the OpenVPN management interface of profiles which enable it
+ * ("management <address> <port>" or "management <path> unix"). While the
+ * unit is active, the tray connects and subscribes with "state on" and
+ * "bytecount N", so OpenVPN pushes the tunnel state (CONNECTED,
+ * RECONNECTING, AUTH...) and the traffic counters. All sockets are read
+ * asynchronously on the main loop; a dropped connection is retried with
+ * exponential backoff for as long as the unit stays active, and at once
+ * when it is turned ON again.
+ */
+
+struct mgmt_conn {
+    char *vpn_name;
+    GSocketConnectable *address;    // NULL if the profile has no management interface
+    char *password;                 // Contents of the password file, if any
+    GIOStream *stream;              // Open connection, NULL if none
+    GDataInputStream *input;
+    GCancellable *cancellable;      // Cancels the pending connect or read
+    guint retry_id;                 // Timer of the next connect attempt, 0 if none
+    int backoff;                    // Current retry delay in seconds
+};
+
+// Commands being written to a new connection
+struct mgmt_write {
+    struct mgmt_conn *conn;         // Gone if the write was cancelled
+    GString *commands;
+};
+
+static const char *state_names[MGMT_STATE_COUNT] = {
+    "UNKNOWN", "CONNECTING", "WAIT", "AUTH", "GET_CONFIG", "ASSIGN_IP", "ADD_ROUTES",
+    "CONNECTED", "RECONNECTING", "EXITING", "RESOLVE", "TCP_CONNECT", "AUTH_PENDING",
+};
+
+static GHashTable *conns = NULL;    // VPN name -> struct mgmt_conn, also for profiles without one
+static GSocketClient *client = NULL;
+static mgmt_changed_cb on_changed = NULL;
+static gpointer callback_data = NULL;
+
+static struct mgmt_conn *load_conn(const char *vpn_name);
+static void free_conn(gpointer data);
+static void connect_conn(struct mgmt_conn *conn);
+static void disconnect_conn(struct mgmt_conn *conn);
+static void fail_conn(struct mgmt_conn *conn);
+static gboolean on_retry(gpointer data);
+static void on_connected(GObject *source, GAsyncResult *result, gpointer data);
+static void on_written(GObject *source, GAsyncResult *result, gpointer data);
+static void read_next(struct mgmt_conn *conn);
+static void on_line(GObject *source, GAsyncResult *result, gpointer data);
+static void handle_line(struct mgmt_conn *conn, const char *line);
+static void set_link_state(struct mgmt_conn *conn, int state);
+
+void mgmt_init(mgmt_changed_cb changed_cb, gpointer data)
+{
+    on_changed = changed_cb;
+    callback_data = data;
+}
+
+/*
+ * Change set listener: connect to the management interfaces of the VPNs
+ * which were just turned ON (or added while ON). Unless still connected,
+ * the settings are loaded again each time, so an edited "management" line
+ * or password file is used from the next start on; an unchanged profile
+ * costs one stat() in conf_lookup().
+ */
+void mgmt_apply_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    int i;
+
+    if (conns == NULL) {
+        conns = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_conn);
+    }
+
+    for (i = 0; i < count; i++) {
+        struct mgmt_conn *conn;
+
+        if (changes[i].vpn_index < 0 || !changes[i].state || changes[i].kind == CHANGE_DETAIL) {
+            continue;
+        }
+        conn = g_hash_table_lookup(conns, changes[i].name);
+        if (conn && conn->cancellable) {
+            continue;
+        }
+        // Replaces the key as well, the old one goes with the old conn and its retry timer
+        conn = load_conn(changes[i].name);
+        g_hash_table_replace(conns, conn->vpn_name, conn);
+        if (conn->address) {
+            connect_conn(conn);
+        }
+    }
+}
+
+// Drop the connection and the cached settings of a removed profile
+void mgmt_forget(int vpn_index)
+{
+    if (conns) {
+        g_hash_table_remove(conns, registry_get(vpn_index)->name);
+    }
+}
+
+const char *mgmt_state_name(int state)
+{
+    return state >= 0 && state < MGMT_STATE_COUNT ? state_names[state] : state_names[0];
+}
+
+void mgmt_cleanup(void)
+{
+    if (conns) {
+        g_hash_table_destroy(conns);
+        conns = NULL;
+    }
+    if (client) {
+        g_object_unref(client);
+        client = NULL;
+    }
+}
+
+/*
+ * Address and password of the profile's "management" directive, see conf.c.
+ * Relative paths are resolved against the profile's root, the working
+ * directory of its unit template.
+ */
+static struct mgmt_conn *load_conn(const char *vpn_name)
+{
+    struct mgmt_conn *conn = g_new0(struct mgmt_conn, 1);
+    const struct conf_info *info = conf_lookup(vpn_name);
+    const char *host, *port, *pw_file;
+    gchar *conf_dir;
+
+    conn->vpn_name = g_strdup(vpn_name);
+    if (info == NULL || info->mgmt_address == NULL) {
+        return conn;
+    }
+    conf_dir = g_build_filename(backend_get()->profile_dir(), profiles_root_of(vpn_name)->subdir, NULL);
+    host = info->mgmt_address;
+    port = info->mgmt_port;
+    pw_file = info->mgmt_pw_file;
+
+    if (strcmp(port, "unix") == 0) {
+        gchar *socket_path = g_path_is_absolute(host) ? g_strdup(host) : g_build_filename(conf_dir, host, NULL);
+
+        conn->address = G_SOCKET_CONNECTABLE(g_unix_socket_address_new(socket_path));
+        g_free(socket_path);
+    } else if (atoi(port) > 0) {
+        conn->address = g_network_address_new(host, atoi(port));
+    }
+    if (conn->address && pw_file && strcmp(pw_file, "stdin") != 0) {
+        gchar *pw_path = g_path_is_absolute(pw_file) ? g_strdup(pw_file) : g_build_filename(conf_dir, pw_file, NULL);
+
+        if (g_file_get_contents(pw_path, &conn->password, NULL, NULL)) {
+            g_strchomp(conn->password);
+        }
+        g_free(pw_path);
+    }
+
+    g_free(conf_dir);
+    return conn;
+}
+
+static void free_conn(gpointer data)
+{
+    struct mgmt_conn *conn = data;
+
+    disconnect_conn(conn);
+    if (conn->retry_id) {
+        g_source_remove(conn->retry_id);
+    }
+    if (conn->address) {
+        g_object_unref(conn->address);
+    }
+    g_free(conn->password);
+    g_free(conn->vpn_name);
+    g_free(conn);
+}
+
+static void connect_conn(struct mgmt_conn *conn)
+{
+    if (client == NULL) {
+        client = g_socket_client_new();
+    }
+    conn->cancellable = g_cancellable_new();
+    g_socket_client_connect_async(client, conn->address, conn->cancellable, on_connected, conn);
+}
+
+static void disconnect_conn(struct mgmt_conn *conn)
+{
+    if (conn->cancellable) {
+        g_cancellable_cancel(conn->cancellable);
+        g_object_unref(conn->cancellable);
+        conn->cancellable = NULL;
+    }
+    if (conn->input) {
+        g_object_unref(conn->input);
+        conn->input = NULL;
+    }
+    if (conn->stream) {
+        g_io_stream_close(conn->stream, NULL, NULL);
+        g_object_unref(conn->stream);
+        conn->stream = NULL;
+    }
+}
+
+// Connection lost or refused: forget the link state and retry later
+static void fail_conn(struct mgmt_conn *conn)
+{
+    disconnect_conn(conn);
+    conn->backoff = conn->backoff ? MIN(conn->backoff * 2, MGMT_RETRY_MAX_INTERVAL) : MGMT_RETRY_INTERVAL;
+    if (conn->retry_id == 0) {
+        conn->retry_id = g_timeout_add_seconds(conn->backoff, on_retry, conn);
+    }
+    set_link_state(conn, MGMT_STATE_UNKNOWN);
+}
+
+// Reconnect if the unit is still active, otherwise wait for it to be turned ON
+static gboolean on_retry(gpointer data)
+{
+    struct mgmt_conn *conn = data;
+    int vpn_index = registry_lookup(conn->vpn_name);
+
+    conn->retry_id = 0;
+    if (vpn_index >= 0 && registry_get(vpn_index)->state && !conn->cancellable) {
+        connect_conn(conn);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void on_connected(GObject *source, GAsyncResult *result, gpointer data)
+{
+    GError *error = NULL;
+    GSocketConnection *connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source), result, &error);
+    struct mgmt_conn *conn = data;
+    struct mgmt_write *pending;
+
+    // The connection may have been dropped meanwhile, conn is gone then
+    if (connection == NULL) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            fail_conn(conn);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    conn->stream = G_IO_STREAM(connection);
+    conn->input = g_data_input_stream_new(g_io_stream_get_input_stream(conn->stream));
+    g_data_input_stream_set_newline_type(conn->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+    conn->backoff = 0;
+
+    // Current state first, then the subscriptions; a slow peer must not block the main loop
+    pending = g_new(struct mgmt_write, 1);
+    pending->conn = conn;
+    pending->commands = g_string_new(NULL);
+    if (conn->password) {
+        g_string_append_printf(pending->commands, "%s\n", conn->password);
+    }
+    g_string_append_printf(pending->commands, "state\nstate on\nbytecount %d\n", MGMT_BYTECOUNT_INTERVAL);
+    g_output_stream_write_all_async(g_io_stream_get_output_stream(conn->stream), pending->commands->str,
+                                    pending->commands->len, G_PRIORITY_DEFAULT, conn->cancellable,
+                                    on_written, pending);
+}
+
+static void on_written(GObject *source, GAsyncResult *result, gpointer data)
+{
+    struct mgmt_write *pending = data;
+    struct mgmt_conn *conn = pending->conn;
+    GError *error = NULL;
+
+    if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, &error)) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_print("%s: WARNING: Management interface of VPN %s: %s\n", APP_NAME, conn->vpn_name, error->message);
+            fail_conn(conn);
+        }
+        g_error_free(error);
+    } else {
+        read_next(conn);
+    }
+    g_string_free(pending->commands, TRUE);
+    g_free(pending);
+}
+
+static void read_next(struct mgmt_conn *conn)
+{
+    g_data_input_stream_read_line_async(conn->input, G_PRIORITY_DEFAULT, conn->cancellable, on_line, conn);
+}
+
+static void on_line(GObject *source, GAsyncResult *result, gpointer data)
+{
+    GError *error = NULL;
+    char *line = g_data_input_stream_read_line_finish(G_DATA_INPUT_STREAM(source), result, NULL, &error);
+    struct mgmt_conn *conn = data;
+
+    if (line == NULL) {
+        if (error == NULL || !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            fail_conn(conn);
+        }
+        if (error) {
+            g_error_free(error);
+        }
+        return;
+    }
+
+    handle_line(conn, line);
+    g_free(line);
+    read_next(conn);
+}
+
+/*
+ * Real-time notifications read ">STATE:time,NAME,..." and
+ * ">BYTECOUNT:in,out"; the reply to the "state" command is the same
+ * record without the prefix, followed by "END".
+ */
+static void handle_line(struct mgmt_conn *conn, const char *line)
+{
+    int vpn_index = registry_lookup(conn->vpn_name);
+    struct vpn_entry *entry;
+    const char *record = NULL;
+
+    if (vpn_index < 0) {
+        return;
+    }
+    entry = registry_get(vpn_index);
+
+    if (strncmp(line, ">BYTECOUNT:", 11) == 0) {
+        guint64 bytes_in, bytes_out;
+
+        if (sscanf(line + 11, "%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT, &bytes_in, &bytes_out) == 2) {
+            entry->bytes_in = bytes_in;
+            entry->bytes_out = bytes_out;
+        }
+        return;
+    }
+
+    if (strncmp(line, ">STATE:", 7) == 0) {
+        record = line + 7;
+    } else if (g_ascii_isdigit(line[0]) && strchr(line, ',') != NULL) {
+        record = line;
+    }
+
+    if (record) {
+        const char *name = strchr(record, ',');
+        int state;
+
+        if (name == NULL) {
+            return;
+        }
+        name++;
+        for (state = MGMT_STATE_COUNT - 1; state > MGMT_STATE_UNKNOWN; state--) {
+            size_t len = strlen(state_names[state]);
+
+            if (strncmp(name, state_names[state], len) == 0 && (name[len] == ',' || name[len] == '\0')) {
+                break;
+            }
+        }
+        set_link_state(conn, state);
+    }
+}
+
+static void set_link_state(struct mgmt_conn *conn, int state)
+{
+    int vpn_index = registry_lookup(conn->vpn_name);
+    struct vpn_entry *entry;
+
+    if (vpn_index < 0) {
+        return;
+    }
+    entry = registry_get(vpn_index);
+    if (state == MGMT_STATE_UNKNOWN) {
+        entry->bytes_in = 0;
+        entry->bytes_out = 0;
+    }
+    if (entry->link_state != state) {
+        entry->link_state = state;
+        if (on_changed) {
+            on_changed(vpn_index, callback_data);
+        }
+    }
+}
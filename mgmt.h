@@ -0,0 +1,33 @@
+#ifndef MGMT_H
+#define MGMT_H
+
+#include <glib.h>
+#include "changes.h"
+
+// Connection states reported by the OpenVPN management interface
+enum mgmt_state {
+    MGMT_STATE_UNKNOWN = 0,     // Not connected to the management interface
+    MGMT_STATE_CONNECTING,
+    MGMT_STATE_WAIT,
+    MGMT_STATE_AUTH,
+    MGMT_STATE_GET_CONFIG,
+    MGMT_STATE_ASSIGN_IP,
+    MGMT_STATE_ADD_ROUTES,
+    MGMT_STATE_CONNECTED,
+    MGMT_STATE_RECONNECTING,
+    MGMT_STATE_EXITING,
+    MGMT_STATE_RESOLVE,
+    MGMT_STATE_TCP_CONNECT,
+    MGMT_STATE_AUTH_PENDING,
+    MGMT_STATE_COUNT,
+};
+
+typedef void (*mgmt_changed_cb)(int vpn_index, gpointer data);
+
+void mgmt_init(mgmt_changed_cb changed_cb, gpointer data);
+void mgmt_apply_changes(const struct vpn_change *changes, int count, gpointer data);
+void mgmt_forget(int vpn_index);
+const char *mgmt_state_name(int state);
+void mgmt_cleanup(void);
+
+#endif
@@ -1,149 +1,342 @@
-#include <glob.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <gtk/gtk.h>
 #include "openvpn-tray.h"
 #include "logging.h"
+#include "backend.h"
+#include "jobs.h"
+#include "discovery.h"
+#include "profiles.h"
+#include "registry.h"
+#include "menu.h"
+#include "scheduler.h"
+#include "vpnlist.h"
+#include "stats.h"
+#include "history.h"
+#include "mgmt.h"
+#include "traffic.h"
+#include "icons.h"
+#include "changes.h"
+#include "conf.h"
+#include "snapshot.h"
+#include "startup.h"
+#include "prober.h"
+#include "control.h"
+#include "metrics.h"
 
 //#include "openvpn-on.xpm"
 //#include "openvpn-off.xpm"
 
-char vpn_labels[MAX_VPNS][MAX_VPN_NAME_LEN];
-int vpn_states[MAX_VPNS];
-int previous_vpn_states[MAX_VPNS];
-int vpn_count = 0;
 static int update_interval = 10;
 time_t last_log_time = 0;
 int first_run = 1;
 int read_only_mode = 1;
 static guint timer_id = 0;
-static GdkPixbuf *pixbuf_on = NULL;
-static GdkPixbuf *pixbuf_off = NULL;
+static GtkWidget *right_click_menu = NULL;
+static const char *tooltip_error = NULL;
+static int popup_bench = 0;
+static int popup_bench_failed = 0;
 
 
 void update_icon(GtkStatusIcon *tray_icon);
+void on_vpn_changes(const struct vpn_change *changes, int count, gpointer tray_icon);
+gboolean on_tray_query_tooltip(GtkStatusIcon *tray_icon, gint x, gint y, gboolean keyboard_mode,
+                               GtkTooltip *tooltip, gpointer data);
 void fetch_vpn_list(GtkStatusIcon *tray_icon);
-GtkWidget* create_vpn_list(GtkStatusIcon *tray_icon);
+void on_probe_done(const struct probe_result *result, gpointer tray_icon);
+void show_snapshot(GtkStatusIcon *tray_icon);
+void stage_icons(gpointer tray_icon);
+void stage_probe(gpointer tray_icon);
+void stage_discovery(gpointer tray_icon);
+void on_startup_done(gpointer data);
+void on_probe_due(const int *slots, int count, gpointer tray_icon);
+int add_profile(const char *vpn_name);
+void remove_profile(int vpn_index);
+void profile_attach(int vpn_index, gpointer data);
+void profile_detach(int vpn_index, gpointer data);
+void sync_watched_units(void);
+void on_profile_changed(const char *vpn_name, int added, gpointer tray_icon);
+void on_control_toggle(const char *vpn_name, int on, gpointer tray_icon);
 void on_vpn_toggle(GtkCheckMenuItem *item, gpointer data);
 void on_all_vpn_toggle(GtkMenuItem *item, gpointer tray_icon);
 void turn_on_vpn(const char *vpn_name);
 void turn_off_vpn(const char *vpn_name);
-void turn_on_all_vpns(void);
-void turn_off_all_vpns(void);
+void turn_on_all_vpns(GtkMenuItem *item, gpointer tray_icon);
+void turn_off_all_vpns(GtkMenuItem *item, gpointer tray_icon);
 gboolean refresh_vpn_list(gpointer tray_icon);
+void schedule_refresh(GtkStatusIcon *tray_icon);
+void on_unit_state_changed(const char *vpn_name, int active, int transitioning, gpointer tray_icon);
+void on_backend_ready(gpointer tray_icon);
+void on_link_changed(int vpn_index, gpointer tray_icon);
+void on_vpn_job_done(const char *vpn_name, enum vpn_job job, int success, gpointer tray_icon);
 void on_tray_icon_left_click(GtkStatusIcon *tray_icon);
 void on_tray_icon_right_click(GtkStatusIcon *tray_icon, guint button, guint activate_time);
 GtkWidget* create_right_click_menu(GtkStatusIcon *tray_icon);
 void show_preferences_dialog(GtkStatusIcon *tray_icon);
 void on_reload_clicked(GtkMenuItem *item, gpointer tray_icon);
 
-void load_icons() {
-    pixbuf_on = gdk_pixbuf_new_from_resource("/org/platon/images/openvpn-on.png", NULL);
-    pixbuf_off = gdk_pixbuf_new_from_resource("/org/platon/images/openvpn-off.png", NULL);
+// Pick the icon variant, the tray is only touched if it changed (icons.c)
+void update_icon(GtkStatusIcon *tray_icon) {
+    gint64 start = stats_begin();
+    struct changes_summary summary;
+    enum icon_kind kind;
+
+    changes_get_summary(&summary);
+    if (summary.busy) {
+        kind = ICON_TRANSITIONING;
+    } else if (summary.active == 0) {
+        kind = ICON_OFF;
+    } else if (summary.active == summary.total) {
+        kind = ICON_ON;
+    } else {
+        kind = ICON_PARTIAL;
+    }
+    // With a single profile the badge would say nothing the icon does not
+    icons_show(kind, summary.total > 1 ? summary.active : 0);
+    stats_end(STATS_ICON, start);
 }
 
-void update_icon(GtkStatusIcon *tray_icon) {
-    int any_vpn_on = 0;
+/*
+ * The tooltip is built only when it is about to be shown: the status line,
+ * total throughput and uptime and flaps of the VPNs worth a look, see
+ * history.c.
+ */
+gboolean on_tray_query_tooltip(GtkStatusIcon *tray_icon, gint x, gint y, gboolean keyboard_mode,
+                               GtkTooltip *tooltip, gpointer data) {
+    GString *text;
+    char status[160];
+
+    if (tooltip_error) {
+        gtk_tooltip_set_text(tooltip, tooltip_error);
+        return TRUE;
+    }
+
+    traffic_poke();
+    vpnlist_status_text(status, sizeof(status));
+    text = g_string_new(status);
+    traffic_format_total(text);
+    history_tooltip_lines(history_now(), HISTORY_TOOLTIP_LINES, text);
+    gtk_tooltip_set_text(tooltip, text->str);
+    g_string_free(text, TRUE);
+    return TRUE;
+}
+
+// Change set listener for the tray icon, the summary is kept by changes.c
+void on_vpn_changes(const struct vpn_change *changes, int count, gpointer tray_icon) {
+    if (count > 0) {
+        update_icon(GTK_STATUS_ICON(tray_icon));
+    }
+}
+
+// Full rescan of the VPN profiles and probe, on the worker, see prober.c
+void fetch_vpn_list(GtkStatusIcon *tray_icon) {
+    prober_rescan();
+}
 
-    // Check if any VPN is ON
-    for (int i = 0; i < vpn_count; i++) {
-        if (vpn_states[i] == 1) {
-            any_vpn_on = 1;
+/*
+ * A probe cycle is through: apply it to the registry and commit, all on
+ * the main loop. A rescan also updates the profile list, see
+ * vpnlist_apply().
+ */
+void on_probe_done(const struct probe_result *result, gpointer tray_icon) {
+    const char *error = NULL;
+    int from_snapshot = snapshot_is_stale();
+    gint64 start;
+    int probed;
+    int i;
+
+    // Dropped before timing: the rescan queued at startup probes everything anyway
+    if (!result->rescan && from_snapshot) {
+        return;
+    }
+    start = stats_begin();
+    if (result->rescan) {
+        switch (result->scan_status) {
+        case BACKEND_ERR_NO_DIR:
+            error = "ERROR: OpenVPN directory does not exist";
             break;
+        case BACKEND_ERR_READ_DIR:
+            error = "ERROR: Unable to read OpenVPN directory";
+            break;
+        }
+        tooltip_error = error;
+        startup_interactive();
+        if (error) {
+            stats_end(STATS_FETCH, start);
+            return;
+        }
+        /*
+         * The first scan and probe after startup replace the snapshot:
+         * every profile is reported as new, those gone since are dropped
+         * silently.
+         */
+        if (from_snapshot) {
+            changes_reset();
         }
     }
 
-    // Use the preloaded pixbufs based on VPN state
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    if (any_vpn_on) {
-        gtk_status_icon_set_from_pixbuf(tray_icon, pixbuf_on);
-        if (!read_only_mode) {
-            gtk_status_icon_set_tooltip_text(tray_icon, "OpenVPN - VPN(s) running");
-        } else {
-            gtk_status_icon_set_tooltip_text(tray_icon, "OpenVPN - VPN(s) running (Read-Only - Need sudo)");
-        }
-    } else {
-        gtk_status_icon_set_from_pixbuf(tray_icon, pixbuf_off);
-        if (!read_only_mode) {
-            gtk_status_icon_set_tooltip_text(tray_icon, "OpenVPN - All VPNs off");
-        } else {
-            gtk_status_icon_set_tooltip_text(tray_icon, "OpenVPN - All VPNs off (Read-Only - Need sudo)");
+    // A failed probe changed nothing, so there is nothing to kick either
+    probed = vpnlist_apply(result, profile_attach, profile_detach, NULL) == BACKEND_OK;
+
+    // Probe what moved closely, the scheduler saw the old states
+    for (i = 0; probed && i < result->count; i++) {
+        int vpn_index = registry_lookup(result->units[i].name);
+
+        if (vpn_index >= 0 && (result->units[i].transitioning ||
+                               registry_get(vpn_index)->state != registry_get(vpn_index)->previous_state)) {
+            scheduler_kick(vpn_index);
         }
     }
-#pragma GCC diagnostic pop
-}
 
-void cleanup_icons() {
-    // Free the pixbufs during program cleanup
-    if (pixbuf_on) {
-        g_object_unref(pixbuf_on);
+    if (result->rescan && from_snapshot) {
+        snapshot_set_fresh();
+        vpn_menu_set_stale(NULL);
     }
-    if (pixbuf_off) {
-        g_object_unref(pixbuf_off);
+    changes_commit();
+    if (result->rescan) {
+        sync_watched_units();
     }
+    stats_end(STATS_FETCH, start);
 }
 
-void fetch_vpn_list(GtkStatusIcon *tray_icon) {
-    glob_t glob_result;
-    int i;
-
-    if (access(OPENVPN_CONF_DIR, F_OK) != 0) {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-        gtk_status_icon_set_tooltip_text(tray_icon, "ERROR: OpenVPN directory does not exist");
-#pragma GCC diagnostic pop
-        g_print("%s: ERROR: OpenVPN directory does not exist: %s\n", APP_NAME, OPENVPN_CONF_DIR);
+/*
+ * Show the profiles and states saved by the last run until the first probe
+ * is through, see snapshot.c. Called before the change set listeners are
+ * registered: the commit only settles the summary for the icon, so stale
+ * states are neither logged nor recorded in the history.
+ */
+void show_snapshot(GtkStatusIcon *tray_icon) {
+    int count = snapshot_load(profile_attach, NULL);
+    time_t saved = snapshot_saved_at();
+    char stamp[32], label[96];
+    struct tm tm;
+
+    if (count <= 0) {
         return;
     }
+    changes_commit();
+    update_icon(tray_icon);
 
-    if (chdir(OPENVPN_CONF_DIR) != 0) {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-        gtk_status_icon_set_tooltip_text(tray_icon, "ERROR: Unable to change to OpenVPN directory");
-#pragma GCC diagnostic pop
-        g_print("%s: ERROR: Unable to change to OpenVPN directory: %s\n", APP_NAME, OPENVPN_CONF_DIR);
-        return;
+    strftime(stamp, sizeof(stamp), "%b %d %H:%M", localtime_r(&saved, &tm));
+    snprintf(label, sizeof(label), "Last known states (%s), checking…", stamp);
+    vpn_menu_set_stale(label);
+    g_print("%s: Showing %d VPN states of %s after %.1f ms, probing\n", APP_NAME, count, stamp,
+            startup_elapsed_ms());
+}
+
+/*
+ * Startup stages run from the main loop once the tray is up, see
+ * startup.c. Until the icons are decoded the tray shows ICON_PLACEHOLDER
+ * from the icon theme.
+ */
+void stage_icons(gpointer tray_icon) {
+    icons_init(tray_icon);
+    update_icon(tray_icon);
+}
+
+// Queue the first full scan and probe, the menu shows real states once it is through
+void stage_probe(gpointer tray_icon) {
+    fetch_vpn_list(GTK_STATUS_ICON(tray_icon));
+}
+
+void stage_discovery(gpointer tray_icon) {
+    if (backend_get()->profile_dir()) {
+        discovery_watch(backend_get()->profile_dir(), on_profile_changed, tray_icon);
     }
+    schedule_refresh(GTK_STATUS_ICON(tray_icon));
+}
 
-    char glob_pattern[256];
-    snprintf(glob_pattern, sizeof(glob_pattern), "%s*.conf", OPENVPN_CONF_DIR);
-    glob(glob_pattern, 0, NULL, &glob_result);
+// --startup-trace=exit: quit once started, for bench/startup.sh; --popup-bench=N first opens the menu N times
+void on_startup_done(gpointer data) {
+    if (popup_bench > 0) {
+        popup_bench_failed = vpn_menu_bench(popup_bench);
+    }
+    gtk_main_quit();
+}
 
-    vpn_count = 0;
+// Add a profile to the registry, the VPN menu and the probe scheduler
+int add_profile(const char *vpn_name) {
+    int vpn_index = registry_add(vpn_name);
 
-    for (i = 0; i < glob_result.gl_pathc && vpn_count < MAX_VPNS; i++) {
-        char *filename = strrchr(glob_result.gl_pathv[i], '/') + 1;
-        size_t len = strlen(filename) - 5;
-        if (len > MAX_VPN_NAME_LEN - 1) {
-            len = MAX_VPN_NAME_LEN - 1;
-        }
+    if (vpn_index >= 0) {
+        changes_added(vpn_index);
+        profile_attach(vpn_index, NULL);
+    }
+    return vpn_index;
+}
 
-        strncpy(vpn_labels[vpn_count], filename, len);
-        vpn_labels[vpn_count][len] = '\0';
+void remove_profile(int vpn_index) {
+    profile_detach(vpn_index, NULL);
+    changes_removed(vpn_index);
+    registry_remove(registry_get(vpn_index)->name);
+}
 
-        char command[256];
-        snprintf(command, sizeof(command), "systemctl is-active openvpn@%s > /dev/null 2>&1", vpn_labels[vpn_count]);
+void profile_attach(int vpn_index, gpointer data) {
+    history_attach(vpn_index);
+    traffic_attach(vpn_index);
+    vpn_menu_add(vpn_index);
+    scheduler_add(vpn_index);
+}
 
-        int return_code = system(command);
+void profile_detach(int vpn_index, gpointer data) {
+    vpn_menu_remove(vpn_index);
+    scheduler_remove(vpn_index);
+    mgmt_forget(vpn_index);
+    traffic_detach(vpn_index);
+    conf_forget(registry_get(vpn_index)->name);
+    history_detach(vpn_index);
+}
 
-        if (WIFEXITED(return_code) && WEXITSTATUS(return_code) == 0) {
-            vpn_states[vpn_count] = 1;
-        } else {
-            vpn_states[vpn_count] = 0;
-        }
+void sync_watched_units(void) {
+    const char **names = g_new(const char *, registry_count());
+    struct vpn_entry *entry;
+    int count = 0;
+    int i;
 
-        vpn_count++;
+    registry_foreach(i, entry) {
+        names[count++] = entry->name;
     }
+    backend_get()->watch_units(names, count);
+    g_free(names);
+}
 
-    globfree(&glob_result);
-    
-    log_vpn_status_changes();
-    update_icon(tray_icon);
+/*
+ * Apply a single profile change reported by the directory monitor. Only a
+ * newly added profile is probed, the rest of the list is left untouched;
+ * its state arrives with the probe result. A profile root that appeared or
+ * vanished as a whole is rescanned.
+ */
+void on_profile_changed(const char *vpn_name, int added, gpointer tray_icon) {
+    int vpn_index;
+
+    if (vpn_name == NULL) {
+        fetch_vpn_list(GTK_STATUS_ICON(tray_icon));
+        return;
+    }
+    if (added) {
+        if ((vpn_index = add_profile(vpn_name)) < 0) {
+            return;
+        }
+        g_print("%s: VPN profile added: %s\n", APP_NAME, vpn_name);
+        prober_request(&vpn_index, 1);
+    } else {
+        if ((vpn_index = registry_lookup(vpn_name)) < 0) {
+            return;
+        }
+        remove_profile(vpn_index);
+        g_print("%s: VPN profile removed: %s\n", APP_NAME, vpn_name);
+    }
+
+    changes_commit();
+    sync_watched_units();
+}
+
+// The states arrive in on_probe_done()
+void on_probe_due(const int *slots, int count, gpointer tray_icon) {
+    prober_request(slots, count);
 }
 
 void turn_on_vpn(const char *vpn_name) {
@@ -152,36 +345,83 @@ void turn_on_vpn(const char *vpn_name) {
         update_log_time();
         return;
     }
-    char command[256];
-    snprintf(command, sizeof(command), "systemctl start openvpn@%s", vpn_name);
-    system(command);
-    g_print("%s: Turned ON VPN: %s\n", APP_NAME, vpn_name);
+    if (jobs_submit(vpn_name, VPN_JOB_STARTING) == 0) {
+        int vpn_index = registry_lookup(vpn_name);
+
+        g_print("%s: Turning ON VPN: %s\n", APP_NAME, vpn_name);
+        scheduler_kick(vpn_index);
+        changes_touch(vpn_index);
+    }
     update_log_time();
 }
 
+// Start or stop requested over the control socket, which commits the batch
+void on_control_toggle(const char *vpn_name, int on, gpointer tray_icon) {
+    if (on) {
+        turn_on_vpn(vpn_name);
+    } else {
+        turn_off_vpn(vpn_name);
+    }
+}
+
 void turn_off_vpn(const char *vpn_name) {
     if (read_only_mode) {
         g_print("%s: Cannot turn OFF VPN %s - need sudo privileges (read-only mode)\n", APP_NAME, vpn_name);
         update_log_time();
         return;
     }
-    char command[256];
-    snprintf(command, sizeof(command), "systemctl stop openvpn@%s", vpn_name);
-    system(command);
-    g_print("%s: Turned OFF VPN: %s\n", APP_NAME, vpn_name);
+    if (jobs_submit(vpn_name, VPN_JOB_STOPPING) == 0) {
+        int vpn_index = registry_lookup(vpn_name);
+
+        g_print("%s: Turning OFF VPN: %s\n", APP_NAME, vpn_name);
+        scheduler_kick(vpn_index);
+        changes_touch(vpn_index);
+    }
     update_log_time();
 }
 
-void turn_on_all_vpns(void) {
-    for (int i = 0; i < vpn_count; i++) {
-        turn_on_vpn(vpn_labels[i]);
+/*
+ * Bulk operations only queue jobs for VPNs not already in the requested
+ * state; the job pipeline runs up to jobs_get_max_parallel() of them at once.
+ */
+void turn_on_all_vpns(GtkMenuItem *item, gpointer tray_icon) {
+    struct vpn_entry *entry;
+    int i;
+
+    registry_foreach(i, entry) {
+        if (!entry->state) {
+            turn_on_vpn(entry->name);
+        }
     }
+    changes_commit();
 }
 
-void turn_off_all_vpns(void) {
-    for (int i = 0; i < vpn_count; i++) {
-        turn_off_vpn(vpn_labels[i]);
+void turn_off_all_vpns(GtkMenuItem *item, gpointer tray_icon) {
+    struct vpn_entry *entry;
+    int i;
+
+    registry_foreach(i, entry) {
+        if (entry->state) {
+            turn_off_vpn(entry->name);
+        }
     }
+    changes_commit();
+}
+
+void on_vpn_job_done(const char *vpn_name, enum vpn_job job, int success, gpointer tray_icon) {
+    if (success) {
+        g_print("%s: Turned %s VPN: %s\n", APP_NAME, job == VPN_JOB_STARTING ? "ON" : "OFF", vpn_name);
+    }
+    update_log_time();
+
+    // Probe just this VPN and keep watching it closely while it settles
+    int vpn_index = registry_lookup(vpn_name);
+    if (vpn_index >= 0) {
+        prober_request(&vpn_index, 1);
+        changes_touch(vpn_index);
+        scheduler_kick(vpn_index);
+    }
+    changes_commit();
 }
 
 gboolean refresh_vpn_list(gpointer tray_icon) {
@@ -189,28 +429,84 @@ gboolean refresh_vpn_list(gpointer tray_icon) {
         g_print("%s: ERROR: Invalid tray icon in timer callback\n", APP_NAME);
         return FALSE; // Stop the timer
     }
+
     fetch_vpn_list(GTK_STATUS_ICON(tray_icon));
     return TRUE;
 }
 
+/*
+ * Apply the probe intervals to the scheduler. Stable units are probed every
+ * update_interval seconds, backing off up to PROBE_MAX_INTERVAL; while
+ * backend events (systemd D-Bus) keep the states current, up to DBUS_RESYNC_INTERVAL.
+ * Without a directory monitor the whole list is also rescanned every
+ * update_interval seconds.
+ */
+void schedule_refresh(GtkStatusIcon *tray_icon) {
+    scheduler_set_intervals(update_interval,
+                            backend_get()->is_subscribed() ? DBUS_RESYNC_INTERVAL : PROBE_MAX_INTERVAL);
+
+    if (timer_id > 0) {
+        g_source_remove(timer_id);
+        timer_id = 0;
+    }
+    if (!discovery_is_watching()) {
+        timer_id = g_timeout_add_seconds(update_interval, refresh_vpn_list, tray_icon);
+    }
+}
+
+void on_unit_state_changed(const char *vpn_name, int active, int transitioning, gpointer tray_icon) {
+    int vpn_index = registry_lookup(vpn_name);
+    struct vpn_entry *entry;
+
+    if (vpn_index < 0) {
+        return;
+    }
+
+    // activating/deactivating show up as busy right away, not at the next probe
+    entry = registry_get(vpn_index);
+    if (entry->state != active || entry->transitioning != transitioning) {
+        entry->state = active;
+        entry->transitioning = transitioning;
+        changes_check(vpn_index);
+        changes_commit();
+    }
+}
+
+void on_backend_ready(gpointer tray_icon) {
+    g_print("%s: Using %s state events, stable VPNs resync up to every %d seconds\n", APP_NAME,
+            backend_get()->name, DBUS_RESYNC_INTERVAL);
+    schedule_refresh(GTK_STATUS_ICON(tray_icon));
+}
+
+// The management interface reported a new tunnel state
+void on_link_changed(int vpn_index, gpointer tray_icon) {
+    struct vpn_entry *entry = registry_get(vpn_index);
+
+    g_print("%s: VPN %s link %s\n", APP_NAME, entry->name, mgmt_state_name(entry->link_state));
+    changes_touch(vpn_index);
+    changes_commit();
+}
+
 void on_vpn_toggle(GtkCheckMenuItem *item, gpointer data) {
-    int vpn_index = GPOINTER_TO_INT(data);
+    const char *vpn_name = data;
     gboolean active = gtk_check_menu_item_get_active(item);
+    int vpn_index;
 
+    // The state itself is updated by the next probe once the job is done
     if (active) {
-        turn_on_vpn(vpn_labels[vpn_index]);
-        vpn_states[vpn_index] = 1;
+        turn_on_vpn(vpn_name);
     } else {
-        turn_off_vpn(vpn_labels[vpn_index]);
-        vpn_states[vpn_index] = 0;
+        turn_off_vpn(vpn_name);
     }
 
-    GtkStatusIcon *tray_icon = (GtkStatusIcon *)g_object_get_data(G_OBJECT(item), "tray_icon");
-    if (tray_icon && GTK_IS_STATUS_ICON(tray_icon)) {
-        update_icon(tray_icon);
+    // The item now shows the user's click, let the refresh correct it
+    if ((vpn_index = registry_lookup(vpn_name)) >= 0) {
+        vpn_menu_invalidate(vpn_index);
+        changes_touch(vpn_index);
     }
+    changes_commit();
 
-    g_print("%s: VPN %s toggled to %s\n", APP_NAME, vpn_labels[vpn_index], active ? "ON" : "OFF");
+    log_debug("%s: VPN %s toggled to %s\n", APP_NAME, vpn_name, active ? "ON" : "OFF");
     update_log_time();
 }
 
@@ -218,6 +514,7 @@ void show_preferences_dialog(GtkStatusIcon *tray_icon) {
     GtkWidget *dialog;
     GtkWidget *content_area;
     GtkWidget *entry;
+    GtkWidget *jobs_entry;
     GtkWidget *label;
     GtkWidget *grid;
 
@@ -240,6 +537,14 @@ void show_preferences_dialog(GtkStatusIcon *tray_icon) {
     gtk_entry_set_text(GTK_ENTRY(entry), interval_str);
     gtk_grid_attach(GTK_GRID(grid), entry, 1, 0, 1, 1);
 
+    label = gtk_label_new("Maximum parallel start/stop jobs:");
+    gtk_grid_attach(GTK_GRID(grid), label, 0, 1, 1, 1);
+
+    jobs_entry = gtk_entry_new();
+    snprintf(interval_str, sizeof(interval_str), "%d", jobs_get_max_parallel());
+    gtk_entry_set_text(GTK_ENTRY(jobs_entry), interval_str);
+    gtk_grid_attach(GTK_GRID(grid), jobs_entry, 1, 1, 1, 1);
+
     gtk_widget_show_all(dialog);
 
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_OK) {
@@ -248,64 +553,28 @@ void show_preferences_dialog(GtkStatusIcon *tray_icon) {
         g_print("%s: VPN list update interval updated to: %d seconds\n", APP_NAME, update_interval);
         update_log_time();
 
-        // Remove old timer before creating new one
-        if (timer_id > 0) {
-            g_source_remove(timer_id);
-        }
-        timer_id = g_timeout_add_seconds(update_interval, refresh_vpn_list, tray_icon);
-    }
-
-    gtk_widget_destroy(dialog);
-}
+        schedule_refresh(tray_icon);
 
-GtkWidget* create_vpn_list(GtkStatusIcon *tray_icon) {
-    GtkWidget *menu = gtk_menu_new();
-
-    for (int i = 0; i < vpn_count; i++) {
-        GtkWidget *vpn_item = gtk_check_menu_item_new_with_label(vpn_labels[i]);
-        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(vpn_item), vpn_states[i]);
-        
-        // Disable checkboxes in read-only mode
-        if (read_only_mode) {
-            gtk_widget_set_sensitive(vpn_item, FALSE);
-        } else {
-            g_signal_connect(vpn_item, "toggled", G_CALLBACK(on_vpn_toggle), GINT_TO_POINTER(i));
-            g_object_set_data(G_OBJECT(vpn_item), "tray_icon", tray_icon);
-        }
-        
-        gtk_menu_shell_append(GTK_MENU_SHELL(menu), vpn_item);
+        jobs_set_max_parallel(atoi(gtk_entry_get_text(GTK_ENTRY(jobs_entry))));
+        g_print("%s: Maximum parallel jobs updated to: %d\n", APP_NAME, jobs_get_max_parallel());
     }
 
-    GtkWidget *separator = gtk_separator_menu_item_new();
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), separator);
-
-    GtkWidget *turn_all_on_item = gtk_menu_item_new_with_label("Turn all VPNs on");
-    gtk_widget_set_sensitive(turn_all_on_item, !read_only_mode);
-    g_signal_connect(turn_all_on_item, "activate", G_CALLBACK(turn_on_all_vpns), NULL);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), turn_all_on_item);
-
-    GtkWidget *turn_all_off_item = gtk_menu_item_new_with_label("Turn all VPNs off");
-    gtk_widget_set_sensitive(turn_all_off_item, !read_only_mode);
-    g_signal_connect(turn_all_off_item, "activate", G_CALLBACK(turn_off_all_vpns), NULL);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), turn_all_off_item);
-
-    gtk_widget_show_all(menu);
-    
-    return menu;
+    gtk_widget_destroy(dialog);
 }
 
 void on_tray_icon_left_click(GtkStatusIcon *tray_icon) {
-    g_print("%s: Left-click detected\n", APP_NAME);
+    log_debug("%s: Left-click detected\n", APP_NAME);
     update_log_time();
-    GtkWidget *menu = create_vpn_list(tray_icon);
-    gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
+    vpn_menu_popup();
 }
 
 void on_tray_icon_right_click(GtkStatusIcon *tray_icon, guint button, guint activate_time) {
-    g_print("%s: Right-click detected\n", APP_NAME);
+    log_debug("%s: Right-click detected\n", APP_NAME);
     update_log_time();
-    GtkWidget *menu = create_right_click_menu(tray_icon);
-    gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
+    if (!right_click_menu) {
+        right_click_menu = g_object_ref_sink(create_right_click_menu(tray_icon));
+    }
+    gtk_menu_popup_at_pointer(GTK_MENU(right_click_menu), NULL);
 }
 
 GtkWidget* create_right_click_menu(GtkStatusIcon *tray_icon) {
@@ -336,42 +605,137 @@ int check_privileges(void)
 
 int main(int argc, char *argv[]) {
     GtkStatusIcon *tray_icon;
+    const char *stats_path = NULL;
+    const char *metrics_address = NULL;
+    int dump_stats = 0;
+    int startup_trace = 0;      // 1 to print the startup timeline, 2 to quit after it
+    int status;
+    int i;
+
+    // A second launch hands its command line to the instance already running
+    if ((status = control_forward(argc, argv)) >= 0) {
+        return status;
+    }
 
+    startup_init();
     gtk_init(&argc, &argv);
-	    gtk_init(&argc, &argv);
+    startup_mark("gtk_init");
 
     g_print("%s: Starting %s version %s\n", APP_NAME, APP_NAME, APP_VERSION);
 
+    /*
+     * --stats[=FILE]: dump stats on SIGUSR1, JSON snapshot to FILE
+     * --log-level=info|debug: debug adds click/toggle traces
+     * --log-format=text|json: status table or JSON lines
+     * --startup-trace[=exit]: print the startup timeline, then quit with =exit
+     *   (exit status 1 if over STARTUP_TTI_BUDGET_MS)
+     * --metrics=[IP:]PORT|unix:PATH: serve Prometheus metrics, loopback only
+     * --popup-bench=N: once started, open the VPN menu N times and quit
+     *   (exit status 1 if latency or memory grew, see vpn_menu_bench())
+     * status|start|stop|watch ARGS: only for a running instance, see control.c
+     */
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            dump_stats = 1;
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            dump_stats = 1;
+            stats_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--log-level=", 12) == 0) {
+            if (log_set_level(argv[i] + 12) != 0) {
+                g_print("%s: WARNING: Unknown log level: %s\n", APP_NAME, argv[i] + 12);
+            }
+        } else if (strncmp(argv[i], "--log-format=", 13) == 0) {
+            if (log_set_format(argv[i] + 13) != 0) {
+                g_print("%s: WARNING: Unknown log format: %s\n", APP_NAME, argv[i] + 13);
+            }
+        } else if (strcmp(argv[i], "--startup-trace") == 0) {
+            startup_trace = 1;
+        } else if (strcmp(argv[i], "--startup-trace=exit") == 0) {
+            startup_trace = 2;
+        } else if (strncmp(argv[i], "--metrics=", 10) == 0) {
+            metrics_address = argv[i] + 10;
+        } else if (strncmp(argv[i], "--popup-bench=", 14) == 0) {
+            popup_bench = atoi(argv[i] + 14);
+        } else {
+            g_print("%s: WARNING: Unknown argument: %s\n", APP_NAME, argv[i]);
+        }
+    }
+    startup_configure(startup_trace > 0, startup_trace > 1 || popup_bench > 0 ? on_startup_done : NULL, NULL);
+    stats_init(dump_stats, stats_path);
+
     // Check privileges
     read_only_mode = check_privileges();
     if (read_only_mode) {
         g_print("%s: WARNING: VPN control disabled - need sudo for read-write mode\n", APP_NAME);
     }
 
-    // Initialize the pixbufs
-    load_icons();
+    startup_mark("setup");
 
-    // Create the tray icon and set the initial state
+    // The tray icon comes first, with a themed placeholder until the icons are decoded
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    tray_icon = gtk_status_icon_new();
-    update_icon(tray_icon);  // Set initial icon
-
+    tray_icon = gtk_status_icon_new_from_icon_name(ICON_PLACEHOLDER);
+    gtk_status_icon_set_has_tooltip(tray_icon, TRUE);
     gtk_status_icon_set_visible(tray_icon, TRUE);
 #pragma GCC diagnostic pop
 
-    fetch_vpn_list(tray_icon);
-
     g_signal_connect(G_OBJECT(tray_icon), "activate", G_CALLBACK(on_tray_icon_left_click), NULL);
     g_signal_connect(G_OBJECT(tray_icon), "popup-menu", G_CALLBACK(on_tray_icon_right_click), NULL);
+    g_signal_connect(G_OBJECT(tray_icon), "query-tooltip", G_CALLBACK(on_tray_query_tooltip), NULL);
+    startup_mark("tray icon");
+
+    scheduler_init(on_probe_due, tray_icon);
+    prober_init(on_probe_done, tray_icon);
+    vpn_menu_init(tray_icon, G_CALLBACK(on_vpn_toggle),
+                  G_CALLBACK(turn_on_all_vpns), G_CALLBACK(turn_off_all_vpns));
+    show_snapshot(tray_icon);
+
+    // Consumers of the per-tick change set, in this order
+    changes_listen(log_vpn_status_changes, NULL);
+    changes_listen(history_apply_changes, NULL);
+    changes_listen(on_vpn_changes, tray_icon);
+    changes_listen(vpn_menu_apply_changes, NULL);
+    changes_listen(mgmt_apply_changes, NULL);
+    changes_listen(snapshot_apply_changes, NULL);
+    changes_listen(control_apply_changes, NULL);
+    changes_listen(metrics_apply_changes, NULL);
+    startup_mark("menu");
+
+    backend_get()->subscribe(on_unit_state_changed, on_backend_ready, tray_icon);
+    jobs_init(on_vpn_job_done, tray_icon);
+    mgmt_init(on_link_changed, tray_icon);
+    traffic_init();
+    control_init(on_control_toggle, tray_icon);
+    if (metrics_address) {
+        metrics_init(metrics_address);
+    }
+    startup_mark("backend");
 
-    timer_id = g_timeout_add_seconds(update_interval, refresh_vpn_list, tray_icon);
+    // Off the critical path, one stage per main loop iteration
+    startup_defer("icons", stage_icons, tray_icon);
+    startup_defer("probe", stage_probe, tray_icon);
+    startup_defer("discovery", stage_discovery, tray_icon);
 
     gtk_main();
 
-    cleanup_icons();
-
-    return 0;
+    prober_cleanup();
+    control_cleanup();
+    metrics_cleanup();
+    discovery_cleanup();
+    mgmt_cleanup();
+    traffic_cleanup();
+    snapshot_cleanup();
+    backend_get()->cleanup();
+    scheduler_cleanup();
+    vpn_menu_cleanup();
+    icons_cleanup();
+    registry_clear();
+    changes_cleanup();
+    conf_cleanup();
+    profiles_cleanup();
+    stats_cleanup();
+
+    return (startup_trace > 1 && startup_over_budget()) || popup_bench_failed ? 1 : 0;
 }
 
 
@@ -379,7 +743,7 @@ int main(int argc, char *argv[]) {
 
 void on_reload_clicked(GtkMenuItem *item, gpointer tray_icon)
 {
-    g_print("%s: Reload clicked\n", APP_NAME);
+    log_debug("%s: Reload clicked\n", APP_NAME);
     update_log_time();
     fetch_vpn_list(GTK_STATUS_ICON(tray_icon));
 }
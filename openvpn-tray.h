@@ -4,9 +4,38 @@
 #define APP_NAME "openvpn-tray"
 #define APP_VERSION "0.7"
 #define OPENVPN_CONF_DIR "/etc/openvpn/"
-#define MAX_VPNS 100
-#define MAX_VPN_NAME_LEN 32
+#define OPENVPN_UNIT_PREFIX "openvpn@"
+#define OPENVPN_CLIENT_UNIT_PREFIX "openvpn-client@"
+#define OPENVPN_SERVER_UNIT_PREFIX "openvpn-server@"
+#define OPENVPN_UNIT_SUFFIX ".service"
+#define OPENVPN_CGROUP_ROOT "/sys/fs/cgroup/system.slice"
 #define STATUS_SUMMARY_INTERVAL 600
+#define DBUS_RESYNC_INTERVAL 300
+#define DEFAULT_MAX_PARALLEL_JOBS 8
+#define PROBE_FAST_INTERVAL 1
+#define PROBE_MAX_INTERVAL 120
+#define PROBE_BATCH_SLACK_MS 250
+#define STATS_HEARTBEAT_MS 1000
+#define STATS_STALL_THRESHOLD_MS 200
+#define HISTORY_TOOLTIP_LINES 8
+#define MENU_TOOLTIP_TRANSITIONS 5
+#define MGMT_BYTECOUNT_INTERVAL 5
+#define MGMT_RETRY_INTERVAL 2
+#define MGMT_RETRY_MAX_INTERVAL 60
+#define TRAFFIC_SYSFS_ROOT "/sys/class/net"
+#define TRAFFIC_FAST_INTERVAL_MS 1000
+#define TRAFFIC_IDLE_INTERVAL_MS 30000
+#define TRAFFIC_POKE_HOLD 10
+#define TRAFFIC_EWMA_SECONDS 3
+#define ICON_DEFAULT_SIZE 22
+#define ICON_BADGE_MAX 9
+#define SNAPSHOT_SAVE_DELAY 10
+#define STARTUP_TTI_BUDGET_MS 300
+#define MENU_BENCH_LATENCY_FACTOR 2
+#define MENU_BENCH_RSS_SLACK_KB 1024
+#define ICON_PLACEHOLDER "network-vpn"
+#define CONTROL_SOCKET_NAME "control.sock"
+#define CONTROL_MAX_BACKLOG (1024 * 1024)
 
 extern int read_only_mode;
 
@@ -0,0 +1,184 @@
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "backend.h"
+#include "prober.h"
+
+/*
+ * Probing off the main loop. Enumerating the profiles and probing the
+ * units can take seconds when systemd is slow, so both run on a single
+ * worker thread and the main loop only sees the outcome: one immutable
+ * struct probe_result per cycle, delivered with one idle callback, which
+ * the done callback applies to the registry (see vpnlist_apply()).
+ *
+ * One cycle is in flight at a time. Requests made meanwhile are merged,
+ * by name, into the next cycle, which starts as soon as the current one
+ * has been delivered; a rescan covers every probe request.
+ */
+
+struct cycle {
+    struct probe_result result;
+    gchar **names;          // Names to probe, NULL for all found by the rescan
+    guint idle_id;          // Delivery of the result, set by the worker
+};
+
+static GThreadPool *pool = NULL;
+static struct cycle *in_flight = NULL;
+static int want_rescan = 0;
+static GHashTable *wanted = NULL;   // Names to probe in the next cycle
+static prober_done_cb on_done = NULL;
+static gpointer callback_data = NULL;
+
+static void dispatch(void);
+static void run_cycle(gpointer data, gpointer unused);
+static gboolean on_cycle_done(gpointer data);
+static void free_cycle(struct cycle *cycle);
+
+void prober_init(prober_done_cb done_cb, gpointer data)
+{
+    pool = g_thread_pool_new(run_cycle, NULL, 1, FALSE, NULL);
+    wanted = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    on_done = done_cb;
+    callback_data = data;
+}
+
+// Enumerate the profiles and probe all of them
+void prober_rescan(void)
+{
+    want_rescan = 1;
+    dispatch();
+}
+
+// Probe the given slots, all of them when count < 0
+void prober_request(const int *slots, int count)
+{
+    struct vpn_entry *entry;
+    int i;
+
+    if (count < 0) {
+        registry_foreach(i, entry) {
+            g_hash_table_add(wanted, g_strdup(entry->name));
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            if ((entry = registry_get(slots[i]))->name != NULL) {
+                g_hash_table_add(wanted, g_strdup(entry->name));
+            }
+        }
+    }
+    dispatch();
+}
+
+int prober_busy(void)
+{
+    return in_flight != NULL;
+}
+
+// Wait for the cycle in flight and drop its result
+void prober_cleanup(void)
+{
+    if (pool) {
+        g_thread_pool_free(pool, TRUE, TRUE);
+        pool = NULL;
+    }
+    if (in_flight) {
+        if (in_flight->idle_id) {
+            g_source_remove(in_flight->idle_id);
+        }
+        free_cycle(in_flight);
+        in_flight = NULL;
+    }
+    if (wanted) {
+        g_hash_table_destroy(wanted);
+        wanted = NULL;
+    }
+    want_rescan = 0;
+}
+
+// Start the next cycle from what was asked for, unless one is in flight
+static void dispatch(void)
+{
+    struct cycle *cycle;
+
+    if (in_flight || pool == NULL || (!want_rescan && g_hash_table_size(wanted) == 0)) {
+        return;
+    }
+
+    cycle = g_new0(struct cycle, 1);
+    cycle->result.rescan = want_rescan;
+    if (!want_rescan) {
+        GHashTableIter iter;
+        gpointer name;
+        int i = 0;
+
+        cycle->names = g_new(gchar *, g_hash_table_size(wanted) + 1);
+        g_hash_table_iter_init(&iter, wanted);
+        while (g_hash_table_iter_next(&iter, &name, NULL)) {
+            cycle->names[i++] = name;
+            g_hash_table_iter_steal(&iter);
+        }
+        cycle->names[i] = NULL;
+    }
+    g_hash_table_remove_all(wanted);
+    want_rescan = 0;
+
+    in_flight = cycle;
+    g_thread_pool_push(pool, cycle, NULL);
+}
+
+// Worker thread: nothing in here may touch the registry
+static void run_cycle(gpointer data, gpointer unused)
+{
+    struct cycle *cycle = data;
+    struct probe_result *result = &cycle->result;
+    const struct vpn_backend *backend = backend_get();
+    gint64 start;
+    int i;
+
+    if (result->rescan) {
+        result->names = g_ptr_array_new_with_free_func(g_free);
+        result->scan_status = backend->enumerate(result->names);
+        result->count = result->scan_status == BACKEND_OK ? result->names->len : 0;
+    } else {
+        result->count = g_strv_length(cycle->names);
+    }
+
+    result->units = g_new0(struct vpn_probe, result->count);
+    for (i = 0; i < result->count; i++) {
+        result->units[i].name = result->rescan ? g_ptr_array_index(result->names, i) : cycle->names[i];
+    }
+
+    start = g_get_monotonic_time();
+    result->probe_status = BACKEND_OK;
+    if (result->count > 0) {
+        result->probe_status = backend->probe(result->units, result->count, result->rescan);
+    }
+    result->probe_us = g_get_monotonic_time() - start;
+
+    cycle->idle_id = g_idle_add(on_cycle_done, cycle);
+}
+
+static gboolean on_cycle_done(gpointer data)
+{
+    struct cycle *cycle = data;
+
+    in_flight = NULL;
+    if (on_done) {
+        on_done(&cycle->result, callback_data);
+    }
+    free_cycle(cycle);
+
+    dispatch();
+    return G_SOURCE_REMOVE;
+}
+
+static void free_cycle(struct cycle *cycle)
+{
+    if (cycle->result.names) {
+        g_ptr_array_free(cycle->result.names, TRUE);
+    }
+    g_free(cycle->result.units);
+    g_strfreev(cycle->names);
+    g_free(cycle);
+}
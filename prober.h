@@ -0,0 +1,29 @@
+#ifndef PROBER_H
+#define PROBER_H
+
+#include <glib.h>
+#include "backend.h"
+
+/*
+ * Outcome of one probe cycle, built on the worker and handed to the main
+ * loop as is; nothing in it changes once published.
+ */
+struct probe_result {
+    int rescan;             // Profiles were enumerated, names holds them
+    int scan_status;        // BACKEND_* of the enumeration
+    GPtrArray *names;       // char *, all profiles found by the rescan
+    int probe_status;       // BACKEND_* of the probe, units are void unless BACKEND_OK
+    struct vpn_probe *units;
+    int count;
+    gint64 probe_us;        // Time spent in the backend probe
+};
+
+typedef void (*prober_done_cb)(const struct probe_result *result, gpointer data);
+
+void prober_init(prober_done_cb done_cb, gpointer data);
+void prober_rescan(void);
+void prober_request(const int *slots, int count);
+int prober_busy(void);
+void prober_cleanup(void);
+
+#endif
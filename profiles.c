@@ -0,0 +1,236 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+#include "profiles.h"
+
+/*
+ * Profile discovery over several roots, each mapped to its systemd
+ * template: *.conf in the profile directory run as openvpn@, those in
+ * client/ and server/ as openvpn-client@ and openvpn-server@. The roots
+ * are read through directory file descriptors (openat() and readdir()),
+ * never by changing the working directory or globbing.
+ *
+ * The names found in a root are kept with the directory's device, inode
+ * and mtime; as long as those match, a rescan of the root costs one
+ * fstat(). A directory modified within PROFILES_MTIME_SLACK of the scan
+ * is not cached, since an entry added within the same mtime tick would
+ * go unnoticed.
+ *
+ * profiles_scan() runs on the probe worker, one scan at a time.
+ */
+
+#define PROFILES_MTIME_SLACK 1      // Seconds
+
+struct root_cache {
+    int valid;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    GPtrArray *names;       // char *, VPN names found in the root
+};
+
+static const struct profile_root roots[] = {
+    { "", OPENVPN_UNIT_PREFIX, "system-openvpn.slice" },
+    { "client", OPENVPN_CLIENT_UNIT_PREFIX, "system-openvpn\\x2dclient.slice" },
+    { "server", OPENVPN_SERVER_UNIT_PREFIX, "system-openvpn\\x2dserver.slice" },
+};
+
+static struct root_cache caches[G_N_ELEMENTS(roots)];
+static gchar *cached_dir = NULL;    // Profile directory the caches are for
+
+static int scan_root(int base_fd, int root, GPtrArray *names);
+static void read_root(int fd, const struct profile_root *profile_root, GPtrArray *found);
+static void invalidate(void);
+
+/*
+ * Append the names of all profiles below conf_dir to names (char *, owned
+ * by the array). Missing subdirectories are skipped. Returns BACKEND_OK,
+ * BACKEND_ERR_NO_DIR or BACKEND_ERR_READ_DIR for conf_dir itself.
+ */
+int profiles_scan(const char *conf_dir, GPtrArray *names)
+{
+    int base_fd, ret;
+    int i;
+
+    if (cached_dir == NULL || strcmp(cached_dir, conf_dir) != 0) {
+        invalidate();
+        g_free(cached_dir);
+        cached_dir = g_strdup(conf_dir);
+    }
+
+    if ((base_fd = open(conf_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        invalidate();
+        return errno == ENOENT || errno == ENOTDIR ? BACKEND_ERR_NO_DIR : BACKEND_ERR_READ_DIR;
+    }
+
+    ret = BACKEND_OK;
+    for (i = 0; i < G_N_ELEMENTS(roots); i++) {
+        if (scan_root(base_fd, i, names) < 0 && i == 0) {
+            ret = BACKEND_ERR_READ_DIR;
+            break;
+        }
+    }
+    close(base_fd);
+    return ret;
+}
+
+const struct profile_root *profiles_roots(int *count)
+{
+    *count = G_N_ELEMENTS(roots);
+    return roots;
+}
+
+// The root a VPN name belongs to, the profile directory itself if none matches
+const struct profile_root *profiles_root_of(const char *vpn_name)
+{
+    const char *slash = strchr(vpn_name, '/');
+    int i;
+
+    if (slash != NULL) {
+        for (i = 1; i < G_N_ELEMENTS(roots); i++) {
+            if (strlen(roots[i].subdir) == slash - vpn_name &&
+                strncmp(vpn_name, roots[i].subdir, slash - vpn_name) == 0) {
+                return &roots[i];
+            }
+        }
+    }
+    return &roots[0];
+}
+
+// "client/office" -> "office", the instance of the unit template
+const char *profiles_instance(const char *vpn_name)
+{
+    const struct profile_root *root = profiles_root_of(vpn_name);
+
+    return root->subdir[0] ? vpn_name + strlen(root->subdir) + 1 : vpn_name;
+}
+
+// "client/office" -> "openvpn-client@office.service", freed with g_free()
+gchar *profiles_unit_name(const char *vpn_name)
+{
+    return g_strconcat(profiles_root_of(vpn_name)->unit_prefix, profiles_instance(vpn_name),
+                       OPENVPN_UNIT_SUFFIX, NULL);
+}
+
+// "openvpn-client@office.service" -> "client/office", NULL for other units
+gchar *profiles_name_of_unit(const char *unit)
+{
+    size_t suffix_len = strlen(OPENVPN_UNIT_SUFFIX);
+    size_t len = strlen(unit);
+    int i;
+
+    if (len <= suffix_len || strcmp(unit + len - suffix_len, OPENVPN_UNIT_SUFFIX) != 0) {
+        return NULL;
+    }
+    for (i = 0; i < G_N_ELEMENTS(roots); i++) {
+        size_t prefix_len = strlen(roots[i].unit_prefix);
+
+        if (len > prefix_len + suffix_len && strncmp(unit, roots[i].unit_prefix, prefix_len) == 0) {
+            gchar *instance = g_strndup(unit + prefix_len, len - prefix_len - suffix_len);
+            gchar *name;
+
+            if (!roots[i].subdir[0]) {
+                return instance;
+            }
+            name = g_strconcat(roots[i].subdir, "/", instance, NULL);
+            g_free(instance);
+            return name;
+        }
+    }
+    return NULL;
+}
+
+void profiles_cleanup(void)
+{
+    invalidate();
+    g_free(cached_dir);
+    cached_dir = NULL;
+}
+
+// Returns -1 if the root cannot be read, 0 if it does not exist or was read
+static int scan_root(int base_fd, int root, GPtrArray *names)
+{
+    struct root_cache *cache = &caches[root];
+    struct timespec now;
+    struct stat st;
+    int fd, i;
+
+    fd = openat(base_fd, roots[root].subdir[0] ? roots[root].subdir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        cache->valid = 0;
+        return errno == ENOENT || errno == ENOTDIR ? 0 : -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        cache->valid = 0;
+        return -1;
+    }
+
+    if (!cache->valid || cache->dev != st.st_dev || cache->ino != st.st_ino ||
+        cache->mtime.tv_sec != st.st_mtim.tv_sec || cache->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        if (cache->names == NULL) {
+            cache->names = g_ptr_array_new_with_free_func(g_free);
+        }
+        g_ptr_array_set_size(cache->names, 0);
+        read_root(fd, &roots[root], cache->names);      // Closes fd
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        cache->valid = now.tv_sec - st.st_mtim.tv_sec > PROFILES_MTIME_SLACK;
+        cache->dev = st.st_dev;
+        cache->ino = st.st_ino;
+        cache->mtime = st.st_mtim;
+    } else {
+        close(fd);
+    }
+
+    for (i = 0; i < cache->names->len; i++) {
+        g_ptr_array_add(names, g_strdup(g_ptr_array_index(cache->names, i)));
+    }
+    return 0;
+}
+
+// All *.conf entries of the directory fd, which is closed
+static void read_root(int fd, const struct profile_root *profile_root, GPtrArray *found)
+{
+    DIR *dir = fdopendir(fd);
+    struct dirent *entry;
+
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+
+        if (len <= 5 || strcmp(entry->d_name + len - 5, ".conf") != 0 ||
+            (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)) {
+            continue;
+        }
+        if (profile_root->subdir[0]) {
+            g_ptr_array_add(found, g_strdup_printf("%s/%.*s", profile_root->subdir, (int)(len - 5), entry->d_name));
+        } else {
+            g_ptr_array_add(found, g_strndup(entry->d_name, len - 5));
+        }
+    }
+    closedir(dir);
+}
+
+static void invalidate(void)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(caches); i++) {
+        caches[i].valid = 0;
+        if (caches[i].names) {
+            g_ptr_array_free(caches[i].names, TRUE);
+            caches[i].names = NULL;
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef PROFILES_H
+#define PROFILES_H
+
+#include <glib.h>
+
+/*
+ * A directory of *.conf profiles below the profile directory and the
+ * systemd template its profiles run under. The VPN name of a profile in a
+ * subdirectory is "<subdir>/<instance>", so "<profile dir>/<name>.conf"
+ * is its file in every root.
+ */
+struct profile_root {
+    const char *subdir;         // Relative to the profile directory, "" for the directory itself
+    const char *unit_prefix;    // Template, e.g. "openvpn-client@"
+    const char *slice;          // cgroup of the template's instances below system.slice
+};
+
+int profiles_scan(const char *conf_dir, GPtrArray *names);
+const struct profile_root *profiles_roots(int *count);
+const struct profile_root *profiles_root_of(const char *vpn_name);
+const char *profiles_instance(const char *vpn_name);
+gchar *profiles_unit_name(const char *vpn_name);
+gchar *profiles_name_of_unit(const char *unit);
+void profiles_cleanup(void);
+
+#endif
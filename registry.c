@@ -0,0 +1,140 @@
+#include <string.h>
+#include <glib.h>
+#include "registry.h"
+
+static GArray *entries = NULL;          // struct vpn_entry, indexed by slot
+static GArray *free_slots = NULL;       // int, slots of removed entries
+static GHashTable *slot_by_name = NULL; // name -> slot + 1
+static int live_count = 0;
+
+static void ensure_init(void);
+static gint compare_by_name(gconstpointer a, gconstpointer b);
+
+static void ensure_init(void)
+{
+    if (entries) {
+        return;
+    }
+    entries = g_array_new(FALSE, TRUE, sizeof(struct vpn_entry));
+    free_slots = g_array_new(FALSE, FALSE, sizeof(int));
+    slot_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+/*
+ * Add a profile and return its slot, or -1 if a profile of that name
+ * already exists.
+ */
+int registry_add(const char *name)
+{
+    struct vpn_entry entry = { 0 };
+    int slot;
+
+    ensure_init();
+    if (g_hash_table_contains(slot_by_name, name)) {
+        return -1;
+    }
+
+    entry.name = g_strdup(name);
+    if (free_slots->len > 0) {
+        slot = g_array_index(free_slots, int, free_slots->len - 1);
+        g_array_set_size(free_slots, free_slots->len - 1);
+        g_array_index(entries, struct vpn_entry, slot) = entry;
+    } else {
+        slot = entries->len;
+        g_array_append_val(entries, entry);
+    }
+
+    g_hash_table_insert(slot_by_name, entry.name, GINT_TO_POINTER(slot + 1));
+    live_count++;
+    return slot;
+}
+
+/*
+ * Remove a profile and return the slot it occupied, or -1 if there is no
+ * profile of that name.
+ */
+int registry_remove(const char *name)
+{
+    struct vpn_entry *entry;
+    int slot = registry_lookup(name);
+
+    if (slot < 0) {
+        return -1;
+    }
+
+    entry = registry_get(slot);
+    g_hash_table_remove(slot_by_name, entry->name);
+    g_free(entry->name);
+    memset(entry, 0, sizeof(*entry));
+
+    g_array_append_val(free_slots, slot);
+    live_count--;
+    return slot;
+}
+
+int registry_lookup(const char *name)
+{
+    if (!slot_by_name) {
+        return -1;
+    }
+    return GPOINTER_TO_INT(g_hash_table_lookup(slot_by_name, name)) - 1;
+}
+
+struct vpn_entry *registry_get(int index)
+{
+    return &g_array_index(entries, struct vpn_entry, index);
+}
+
+// Number of slots, the upper bound for iterating with registry_get()
+int registry_size(void)
+{
+    return entries ? entries->len : 0;
+}
+
+// Number of live profiles
+int registry_count(void)
+{
+    return live_count;
+}
+
+/*
+ * Fill order (an array of int) with the slots of all live entries sorted
+ * by name, for display. The array can be reused between calls.
+ */
+void registry_sorted(GArray *order)
+{
+    struct vpn_entry *entry;
+    int i;
+
+    g_array_set_size(order, 0);
+    registry_foreach(i, entry) {
+        g_array_append_val(order, i);
+    }
+    g_array_sort(order, compare_by_name);
+}
+
+void registry_clear(void)
+{
+    struct vpn_entry *entry;
+    int i;
+
+    if (!entries) {
+        return;
+    }
+
+    registry_foreach(i, entry) {
+        g_free(entry->name);
+    }
+    g_array_free(entries, TRUE);
+    g_array_free(free_slots, TRUE);
+    g_hash_table_destroy(slot_by_name);
+    entries = NULL;
+    free_slots = NULL;
+    slot_by_name = NULL;
+    live_count = 0;
+}
+
+static gint compare_by_name(gconstpointer a, gconstpointer b)
+{
+    return strcmp(registry_get(*(const int *)a)->name, registry_get(*(const int *)b)->name);
+}
@@ -0,0 +1,46 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <glib.h>
+
+/*
+ * One record per VPN profile. Records live in a contiguous array and are
+ * addressed by a slot index which stays the same for as long as the
+ * profile exists; removed slots are reused. Pointers returned by
+ * registry_get() are only valid until the next registry_add().
+ */
+struct vpn_entry {
+    char *name;             // Profile name, NULL for a free slot
+    int state;              // 1 if the unit is active
+    int previous_state;     // State at the last changes_commit()
+    int transitioning;      // Unit is activating, deactivating or reloading
+    int previous_busy;      // Transitioning or job pending at the last changes_commit()
+    int change_pos;         // Position in the pending change set + 1, 0 if not noted, see changes.c
+    int probe_interval;     // Current probe period in seconds, see scheduler.c
+    gint64 next_probe;      // Monotonic time of the next probe
+    int heap_pos;           // Position in the scheduler heap + 1, 0 if not queued
+    gpointer menu_item;     // Check item in the VPN menu, owned by menu.c
+    gpointer menu_row;      // GSequenceIter of the item's position, owned by menu.c
+    int menu_state;         // What the menu item currently shows, -1 if stale
+    gpointer history;       // Transition ring and aggregates, owned by history.c
+    int link_state;         // enum mgmt_state from the management interface
+    guint64 bytes_in;       // Traffic counters pushed by the management interface
+    guint64 bytes_out;
+    gpointer traffic;       // Throughput sampler state, owned by traffic.c
+};
+
+int registry_add(const char *name);
+int registry_remove(const char *name);
+int registry_lookup(const char *name);
+struct vpn_entry *registry_get(int index);
+int registry_size(void);
+int registry_count(void);
+void registry_sorted(GArray *order);
+void registry_clear(void);
+
+// Iterate over all live entries, i is the slot index
+#define registry_foreach(i, entry) \
+    for ((i) = 0; (i) < registry_size(); (i)++) \
+        if (((entry) = registry_get(i))->name != NULL)
+
+#endif
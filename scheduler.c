@@ -0,0 +1,251 @@
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "scheduler.h"
+
+/*
+ * Per-unit probe scheduler. Every VPN has its own "next probe" deadline
+ * kept in a binary min-heap, and a single main-loop timer is armed for the
+ * earliest one. Units that are transitioning, changed state or were just
+ * toggled are probed every PROBE_FAST_INTERVAL seconds; stable units back
+ * off exponentially from the base interval up to the maximum interval.
+ * All units due at the same time are handed to the probe callback as one
+ * batch. A callback which probes asynchronously reports the units that
+ * moved with scheduler_kick() once the states are in.
+ */
+
+static GArray *heap = NULL;         // slots, ordered by next_probe
+static GArray *due = NULL;          // slots of the current batch, reused by every tick
+static guint timer_id = 0;
+static gint64 timer_deadline = 0;
+static int base_interval = 10;
+static int max_interval = PROBE_MAX_INTERVAL;
+static scheduler_probe_cb on_probe = NULL;
+static gpointer callback_data = NULL;
+
+static gint64 deadline_of(int pos);
+static void heap_swap(int a, int b);
+static void sift_up(int pos);
+static void sift_down(int pos);
+static void heap_push(int vpn_index);
+static void heap_remove(int vpn_index);
+static void reschedule(int vpn_index, int interval);
+static void arm_timer(void);
+static gboolean on_timer(gpointer data);
+
+void scheduler_init(scheduler_probe_cb probe_cb, gpointer data)
+{
+    heap = g_array_new(FALSE, FALSE, sizeof(int));
+    due = g_array_new(FALSE, FALSE, sizeof(int));
+    on_probe = probe_cb;
+    callback_data = data;
+}
+
+void scheduler_add(int vpn_index)
+{
+    reschedule(vpn_index, base_interval);
+    arm_timer();
+}
+
+// Must be called before the profile leaves the registry
+void scheduler_remove(int vpn_index)
+{
+    heap_remove(vpn_index);
+    arm_timer();
+}
+
+// Probe a VPN within a second and keep probing it fast until it settles
+void scheduler_kick(int vpn_index)
+{
+    reschedule(vpn_index, PROBE_FAST_INTERVAL);
+    arm_timer();
+}
+
+void scheduler_set_intervals(int base, int max)
+{
+    base_interval = MAX(base, PROBE_FAST_INTERVAL);
+    max_interval = MAX(max, base_interval);
+}
+
+void scheduler_cleanup(void)
+{
+    if (timer_id > 0) {
+        g_source_remove(timer_id);
+        timer_id = 0;
+    }
+    if (heap) {
+        g_array_free(heap, TRUE);
+        heap = NULL;
+    }
+    if (due) {
+        g_array_free(due, TRUE);
+        due = NULL;
+    }
+}
+
+static gint64 deadline_of(int pos)
+{
+    return registry_get(g_array_index(heap, int, pos))->next_probe;
+}
+
+static void heap_swap(int a, int b)
+{
+    int slot_a = g_array_index(heap, int, a);
+    int slot_b = g_array_index(heap, int, b);
+
+    g_array_index(heap, int, a) = slot_b;
+    g_array_index(heap, int, b) = slot_a;
+    registry_get(slot_b)->heap_pos = a + 1;
+    registry_get(slot_a)->heap_pos = b + 1;
+}
+
+static void sift_up(int pos)
+{
+    while (pos > 0 && deadline_of(pos) < deadline_of((pos - 1) / 2)) {
+        heap_swap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void sift_down(int pos)
+{
+    int len = heap->len;
+
+    for (;;) {
+        int smallest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+
+        if (left < len && deadline_of(left) < deadline_of(smallest)) {
+            smallest = left;
+        }
+        if (right < len && deadline_of(right) < deadline_of(smallest)) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            return;
+        }
+        heap_swap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+static void heap_push(int vpn_index)
+{
+    g_array_append_val(heap, vpn_index);
+    registry_get(vpn_index)->heap_pos = heap->len;
+    sift_up(heap->len - 1);
+}
+
+static void heap_remove(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+    int pos = entry->heap_pos - 1;
+    int last = heap->len - 1;
+
+    if (pos < 0) {
+        return;
+    }
+
+    if (pos != last) {
+        heap_swap(pos, last);
+    }
+    g_array_set_size(heap, last);
+    entry->heap_pos = 0;
+
+    if (pos < last) {
+        sift_down(pos);
+        sift_up(pos);
+    }
+}
+
+static void reschedule(int vpn_index, int interval)
+{
+    struct vpn_entry *entry;
+
+    if (!heap || vpn_index < 0) {
+        return;
+    }
+
+    entry = registry_get(vpn_index);
+    heap_remove(vpn_index);
+    entry->probe_interval = interval;
+    entry->next_probe = g_get_monotonic_time() + (gint64)interval * G_USEC_PER_SEC;
+    heap_push(vpn_index);
+}
+
+// Keep the single timer armed for the earliest deadline
+static void arm_timer(void)
+{
+    gint64 deadline;
+    gint64 delay;
+
+    if (!heap) {
+        return;
+    }
+
+    if (heap->len == 0) {
+        if (timer_id > 0) {
+            g_source_remove(timer_id);
+            timer_id = 0;
+        }
+        return;
+    }
+
+    deadline = deadline_of(0);
+    if (timer_id > 0 && timer_deadline == deadline) {
+        return;
+    }
+    if (timer_id > 0) {
+        g_source_remove(timer_id);
+    }
+
+    delay = (deadline - g_get_monotonic_time()) / 1000;
+    timer_deadline = deadline;
+    timer_id = g_timeout_add(delay > 0 ? delay : 0, on_timer, NULL);
+}
+
+static gboolean on_timer(gpointer data)
+{
+    // Units due within PROBE_BATCH_SLACK_MS are folded into this batch
+    gint64 horizon = g_get_monotonic_time() + PROBE_BATCH_SLACK_MS * 1000;
+
+    timer_id = 0;
+    g_array_set_size(due, 0);
+
+    while (heap->len > 0 && deadline_of(0) <= horizon) {
+        int vpn_index = g_array_index(heap, int, 0);
+
+        heap_remove(vpn_index);
+        g_array_append_val(due, vpn_index);
+    }
+
+    if (due->len > 0) {
+        on_probe((const int *)due->data, due->len, callback_data);
+    }
+
+    for (guint n = 0; n < due->len; n++) {
+        int vpn_index = g_array_index(due, int, n);
+        struct vpn_entry *entry = registry_get(vpn_index);
+        int interval;
+
+        // The probe callback may have removed or re-queued the profile
+        if (!entry->name || entry->heap_pos > 0) {
+            continue;
+        }
+
+        // States arrive later, units that moved are then kicked with scheduler_kick()
+        if (entry->transitioning) {
+            interval = PROBE_FAST_INTERVAL;
+        } else if (entry->probe_interval < base_interval) {
+            interval = base_interval;
+        } else {
+            interval = MIN(entry->probe_interval * 2, max_interval);
+        }
+        reschedule(vpn_index, interval);
+    }
+
+    arm_timer();
+
+    return G_SOURCE_REMOVE;
+}
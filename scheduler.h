@@ -0,0 +1,15 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <glib.h>
+
+typedef void (*scheduler_probe_cb)(const int *slots, int count, gpointer data);
+
+void scheduler_init(scheduler_probe_cb probe_cb, gpointer data);
+void scheduler_add(int vpn_index);
+void scheduler_remove(int vpn_index);
+void scheduler_kick(int vpn_index);
+void scheduler_set_intervals(int base_interval, int max_interval);
+void scheduler_cleanup(void);
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "backend.h"
+#include "changes.h"
+#include "snapshot.h"
+
+/*
+ * Last known profiles and states, kept in $XDG_CACHE_HOME/openvpn-tray/state
+ * so the icon and the menu have something to show right after login,
+ * before the first probe has run. The loaded states are stale until
+ * snapshot_set_fresh() is called after that probe; meanwhile nothing is
+ * written back. A changed state is saved SNAPSHOT_SAVE_DELAY seconds later,
+ * so a burst of changes costs one write.
+ *
+ * The file is plain text, the entries are "<0|1> <name>":
+ *
+ *     openvpn-tray-snapshot 1
+ *     backend systemctl
+ *     dir /etc/openvpn/
+ *     saved 1760000000
+ *     1 office
+ *     0 home
+ *
+ * A snapshot of another backend or profile directory is ignored.
+ */
+
+#define SNAPSHOT_MAGIC "openvpn-tray-snapshot 1"
+
+static int stale = 0;
+static int dirty = 0;
+static time_t saved_at = 0;
+static guint save_id = 0;
+
+static gchar *snapshot_path(void);
+static const char *header_value(const char *line, const char *key);
+static gboolean on_save_timer(gpointer data);
+
+/*
+ * Add the profiles of the snapshot to the registry with their last known
+ * states and note them in the change set; added_cb is called after the
+ * state is set. Returns the number of profiles loaded, -1 if there is no
+ * usable snapshot.
+ */
+int snapshot_load(vpnlist_profile_cb added_cb, gpointer data)
+{
+    const char *dir = backend_get()->profile_dir();
+    gchar *path = snapshot_path();
+    gchar *contents = NULL;
+    gchar **lines;
+    const char *value;
+    int count = 0;
+    int i;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        g_free(path);
+        return -1;
+    }
+    g_free(path);
+
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    if (g_strv_length(lines) < 4 || strcmp(lines[0], SNAPSHOT_MAGIC) != 0 ||
+        (value = header_value(lines[1], "backend")) == NULL || strcmp(value, backend_get()->name) != 0 ||
+        (value = header_value(lines[2], "dir")) == NULL || strcmp(value, dir ? dir : "") != 0 ||
+        (value = header_value(lines[3], "saved")) == NULL) {
+        g_strfreev(lines);
+        return -1;
+    }
+    saved_at = g_ascii_strtoll(value, NULL, 10);
+
+    for (i = 4; lines[i] != NULL; i++) {
+        const char *line = lines[i];
+        int vpn_index;
+
+        if ((line[0] != '0' && line[0] != '1') || line[1] != ' ' || line[2] == '\0') {
+            continue;
+        }
+        if ((vpn_index = registry_add(line + 2)) < 0) {
+            continue;
+        }
+        registry_get(vpn_index)->state = line[0] == '1';
+        changes_added(vpn_index);
+        if (added_cb != NULL) {
+            added_cb(vpn_index, data);
+        }
+        count++;
+    }
+    g_strfreev(lines);
+
+    stale = count > 0;
+    return count;
+}
+
+int snapshot_is_stale(void)
+{
+    return stale;
+}
+
+// When the loaded snapshot was written, 0 if none was loaded
+time_t snapshot_saved_at(void)
+{
+    return saved_at;
+}
+
+// The registry holds probed states again
+void snapshot_set_fresh(void)
+{
+    stale = 0;
+}
+
+// Change set listener: save a while after profiles or states changed
+void snapshot_apply_changes(const struct vpn_change *changes, int count, gpointer data)
+{
+    int i;
+
+    if (stale) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        if (changes[i].kind != CHANGE_DETAIL) {
+            dirty = 1;
+            break;
+        }
+    }
+    if (dirty && !save_id) {
+        save_id = g_timeout_add_seconds(SNAPSHOT_SAVE_DELAY, on_save_timer, NULL);
+    }
+}
+
+// Write the registry out now, returns -1 on failure
+int snapshot_save(void)
+{
+    const char *dir = backend_get()->profile_dir();
+    gchar *path = snapshot_path();
+    gchar *cache_dir = g_path_get_dirname(path);
+    GError *error = NULL;
+    struct vpn_entry *entry;
+    GString *out;
+    int ret = 0;
+    int i;
+
+    if (stale) {
+        // Nothing learned since the load
+        g_free(cache_dir);
+        g_free(path);
+        return 0;
+    }
+
+    out = g_string_sized_new(128 + registry_count() * 32);
+    g_string_append_printf(out, SNAPSHOT_MAGIC "\nbackend %s\ndir %s\nsaved %" G_GINT64_FORMAT "\n",
+                           backend_get()->name, dir ? dir : "", (gint64)time(NULL));
+    registry_foreach(i, entry) {
+        if (strchr(entry->name, '\n') == NULL) {
+            g_string_append_printf(out, "%d %s\n", entry->state ? 1 : 0, entry->name);
+        }
+    }
+
+    if (g_mkdir_with_parents(cache_dir, 0700) < 0 ||
+        !g_file_set_contents(path, out->str, out->len, &error)) {
+        g_print("%s: WARNING: Unable to save state snapshot %s: %s\n", APP_NAME, path,
+                error ? error->message : g_strerror(errno));
+        g_clear_error(&error);
+        ret = -1;
+    } else {
+        dirty = 0;
+    }
+
+    g_string_free(out, TRUE);
+    g_free(cache_dir);
+    g_free(path);
+    return ret;
+}
+
+// Write a pending save and drop the timer
+void snapshot_cleanup(void)
+{
+    if (save_id) {
+        g_source_remove(save_id);
+        save_id = 0;
+    }
+    if (dirty) {
+        snapshot_save();
+    }
+    stale = 0;
+    saved_at = 0;
+}
+
+static gchar *snapshot_path(void)
+{
+    return g_build_filename(g_get_user_cache_dir(), APP_NAME, "state", NULL);
+}
+
+// "key value" -> value, NULL if the line is not for key
+static const char *header_value(const char *line, const char *key)
+{
+    size_t len = strlen(key);
+
+    if (strncmp(line, key, len) != 0 || line[len] != ' ') {
+        return NULL;
+    }
+    return line + len + 1;
+}
+
+static gboolean on_save_timer(gpointer data)
+{
+    save_id = 0;
+    snapshot_save();
+    return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,17 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <time.h>
+#include <glib.h>
+#include "changes.h"
+#include "vpnlist.h"
+
+int snapshot_load(vpnlist_profile_cb added_cb, gpointer data);
+int snapshot_is_stale(void);
+time_t snapshot_saved_at(void);
+void snapshot_set_fresh(void);
+void snapshot_apply_changes(const struct vpn_change *changes, int count, gpointer data);
+int snapshot_save(void);
+void snapshot_cleanup(void);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "startup.h"
+
+/*
+ * Staged startup. What it takes for the tray to appear (GTK, the status
+ * icon, the menu with the snapshot) runs in main() and is timestamped with
+ * startup_mark(). Everything else (decoding the icons, the first probe,
+ * watching the profile directory) is queued with startup_defer() and run
+ * one stage per main loop iteration at idle priority, so the tray gets
+ * drawn and clicks are handled in between. The result of the first probe
+ * makes the tray interactive; that time is checked against
+ * STARTUP_TTI_BUDGET_MS. With --startup-trace the whole timeline is printed
+ * once the last stage ran and the tray is interactive.
+ */
+
+#define STARTUP_MAX_STAGES 16
+
+struct stage {
+    const char *name;
+    startup_stage_fn fn;    // NULL for a stage which already ran in main()
+    gpointer data;
+    gint64 begin;           // Monotonic times, begin is the end of the previous stage for marks
+    gint64 end;
+};
+
+static struct stage stages[STARTUP_MAX_STAGES];
+static int stage_count = 0;
+static int next_deferred = 0;       // Where to look for the next queued stage
+static gint64 start_time = 0;
+static gint64 last_end = 0;
+static gint64 interactive_at = 0;
+static int stages_done = 0;
+static int finished = 0;
+static int trace = 0;
+static guint idle_id = 0;
+static startup_done_cb on_done = NULL;
+static gpointer callback_data = NULL;
+
+static struct stage *add_stage(const char *name);
+static int find_deferred(void);
+static gboolean on_idle(gpointer data);
+static void maybe_finish(void);
+static void report(void);
+
+// Call first thing in main(), times are relative to this
+void startup_init(void)
+{
+    start_time = g_get_monotonic_time();
+    last_end = start_time;
+}
+
+// Print the timeline if trace is set; done_cb runs after the last deferred stage
+void startup_configure(int trace_enabled, startup_done_cb done_cb, gpointer data)
+{
+    trace = trace_enabled;
+    on_done = done_cb;
+    callback_data = data;
+}
+
+// A stage of main() ended just now
+void startup_mark(const char *name)
+{
+    struct stage *stage = add_stage(name);
+
+    if (stage) {
+        stage->begin = last_end;
+        stage->end = last_end = g_get_monotonic_time();
+    }
+}
+
+// Run fn from the main loop once the stages queued before it are done
+void startup_defer(const char *name, startup_stage_fn fn, gpointer data)
+{
+    struct stage *stage = add_stage(name);
+
+    if (stage == NULL) {
+        fn(data);
+        return;
+    }
+    stage->fn = fn;
+    stage->data = data;
+    if (!idle_id) {
+        idle_id = g_idle_add(on_idle, NULL);
+    }
+}
+
+// The menu shows probed states
+void startup_interactive(void)
+{
+    if (!interactive_at) {
+        interactive_at = g_get_monotonic_time();
+        maybe_finish();
+    }
+}
+
+double startup_elapsed_ms(void)
+{
+    return (g_get_monotonic_time() - start_time) / 1000.0;
+}
+
+int startup_over_budget(void)
+{
+    return interactive_at && interactive_at - start_time > (gint64)STARTUP_TTI_BUDGET_MS * 1000;
+}
+
+static struct stage *add_stage(const char *name)
+{
+    struct stage *stage;
+
+    if (stage_count == STARTUP_MAX_STAGES) {
+        return NULL;
+    }
+    stage = &stages[stage_count++];
+    stage->name = name;
+    stage->fn = NULL;
+    return stage;
+}
+
+// Advance next_deferred to the next queued stage, 0 if there is none
+static int find_deferred(void)
+{
+    while (next_deferred < stage_count && stages[next_deferred].fn == NULL) {
+        next_deferred++;
+    }
+    return next_deferred < stage_count;
+}
+
+static gboolean on_idle(gpointer data)
+{
+    if (find_deferred()) {
+        struct stage *stage = &stages[next_deferred++];
+
+        stage->begin = g_get_monotonic_time();
+        stage->fn(stage->data);
+        stage->end = last_end = g_get_monotonic_time();
+    }
+    if (find_deferred()) {
+        return G_SOURCE_CONTINUE;
+    }
+    idle_id = 0;
+    stages_done = 1;
+    maybe_finish();
+    return G_SOURCE_REMOVE;
+}
+
+// Report and call done_cb once, after both the last stage and interactivity
+static void maybe_finish(void)
+{
+    if (finished || !stages_done || !interactive_at) {
+        return;
+    }
+    finished = 1;
+    report();
+    if (on_done) {
+        on_done(callback_data);
+    }
+}
+
+static void report(void)
+{
+    double tti = interactive_at - start_time;
+    int i;
+
+    if (trace) {
+        g_print("%s: Startup trace, ms since start:\n", APP_NAME);
+        for (i = 0; i < stage_count; i++) {
+            g_print("%s:   %8.1f %+8.1f  %s%s\n", APP_NAME, (stages[i].begin - start_time) / 1000.0,
+                    (stages[i].end - stages[i].begin) / 1000.0, stages[i].name, stages[i].fn ? " (deferred)" : "");
+        }
+    }
+    if (startup_over_budget()) {
+        g_print("%s: WARNING: Interactive after %.1f ms, over the budget of %d ms\n", APP_NAME,
+                tti / 1000.0, STARTUP_TTI_BUDGET_MS);
+    } else {
+        g_print("%s: Interactive after %.1f ms (budget %d ms)\n", APP_NAME, tti / 1000.0, STARTUP_TTI_BUDGET_MS);
+    }
+}
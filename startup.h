@@ -0,0 +1,17 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <glib.h>
+
+typedef void (*startup_stage_fn)(gpointer data);
+typedef void (*startup_done_cb)(gpointer data);
+
+void startup_init(void);
+void startup_configure(int trace, startup_done_cb done_cb, gpointer data);
+void startup_mark(const char *stage);
+void startup_defer(const char *stage, startup_stage_fn fn, gpointer data);
+void startup_interactive(void);
+double startup_elapsed_ms(void);
+int startup_over_budget(void);
+
+#endif
@@ -0,0 +1,310 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "openvpn-tray.h"
+#include "backend.h"
+#include "stats.h"
+
+/*
+ * Always-on instrumentation of the hot paths. Recording a sample is a
+ * clock read and a few increments, no allocation and no locking (all
+ * paths run on the main loop). With --stats, SIGUSR1 prints the numbers
+ * and writes a JSON snapshot of them.
+ *
+ * A heartbeat timer notices when the main loop was blocked: every tick
+ * that fires more than STATS_STALL_THRESHOLD_MS late is a stall and its
+ * delay goes into the STATS_STALL histogram. The delay of every tick goes
+ * into STATS_LOOP_LATENCY, which shows how long an event such as a click
+ * on the tray waits for the main loop.
+ */
+
+struct histogram {
+    guint64 count;
+    guint64 total_us;
+    guint64 max_us;
+    guint64 buckets[STATS_BUCKETS];
+};
+
+static const char *metric_names[STATS_METRIC_COUNT] = {
+    "fetch", "probe", "icon", "menu_popup", "menu_refresh", "log", "traffic", "stall",
+    "loop_latency",
+};
+static const char *counter_names[STATS_COUNTER_COUNT] = {
+    "units_probed",
+};
+static const char *counter_help[STATS_COUNTER_COUNT] = {
+    "Units covered by probes.",
+};
+
+static struct histogram metrics[STATS_METRIC_COUNT];
+static guint64 counters[STATS_COUNTER_COUNT];
+static gint64 start_time = 0;
+static gint64 heartbeat_due = 0;
+static guint heartbeat_id = 0;
+static guint signal_id = 0;
+static gchar *snapshot_path = NULL;
+
+static void record(struct histogram *hist, guint64 us);
+static guint64 percentile(const struct histogram *hist, double fraction);
+static void append_counter(GString *out, const char *name, const char *help, guint64 value);
+static void append_seconds(GString *out, guint64 us);
+static gboolean on_heartbeat(gpointer data);
+static gboolean on_sigusr1(gpointer data);
+
+void stats_init(int dump_on_signal, const char *json_path)
+{
+    start_time = g_get_monotonic_time();
+    heartbeat_due = start_time + STATS_HEARTBEAT_MS * 1000;
+    heartbeat_id = g_timeout_add(STATS_HEARTBEAT_MS, on_heartbeat, NULL);
+
+    if (dump_on_signal) {
+        snapshot_path = json_path ? g_strdup(json_path)
+            : g_build_filename(g_get_user_runtime_dir(), APP_NAME ".stats.json", NULL);
+        signal_id = g_unix_signal_add(SIGUSR1, on_sigusr1, NULL);
+        g_print("%s: Stats dump on SIGUSR1, JSON snapshot in %s\n", APP_NAME, snapshot_path);
+    }
+}
+
+void stats_end(enum stats_metric metric, gint64 start)
+{
+    record(&metrics[metric], g_get_monotonic_time() - start);
+}
+
+void stats_count(enum stats_counter counter, guint64 n)
+{
+    counters[counter] += n;
+}
+
+// A duration measured elsewhere, e.g. on a worker thread
+void stats_record(enum stats_metric metric, gint64 us)
+{
+    record(&metrics[metric], us > 0 ? us : 0);
+}
+
+static void record(struct histogram *hist, guint64 us)
+{
+    int bucket = us > 0 ? g_bit_storage(us) - 1 : 0;
+
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->buckets[MIN(bucket, STATS_BUCKETS - 1)]++;
+}
+
+// Upper bound of the bucket holding the given fraction of the samples
+static guint64 percentile(const struct histogram *hist, double fraction)
+{
+    guint64 target = hist->count * fraction;
+    guint64 seen = 0;
+    int k;
+
+    for (k = 0; k < STATS_BUCKETS - 1; k++) {
+        seen += hist->buckets[k];
+        if (seen > target) {
+            return MIN(((guint64)2 << k) - 1, hist->max_us);
+        }
+    }
+    return hist->max_us;
+}
+
+// Human readable table on stdout
+void stats_dump(void)
+{
+    GString *out = g_string_sized_new(1024);
+    int i;
+
+    g_string_append_printf(out, "%s: Stats after %" G_GINT64_FORMAT " s\n", APP_NAME,
+                           (g_get_monotonic_time() - start_time) / G_USEC_PER_SEC);
+    g_string_append_printf(out, "  %-14s %10s %10s %10s %10s %10s\n",
+                           "path", "count", "avg us", "p50 us", "p99 us", "max us");
+    for (i = 0; i < STATS_METRIC_COUNT; i++) {
+        const struct histogram *hist = &metrics[i];
+
+        g_string_append_printf(out, "  %-14s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+                               " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT "\n",
+                               metric_names[i], hist->count, hist->count ? hist->total_us / hist->count : 0,
+                               percentile(hist, 0.5), percentile(hist, 0.99), hist->max_us);
+    }
+    for (i = 0; i < STATS_COUNTER_COUNT; i++) {
+        g_string_append_printf(out, "  %-14s %10" G_GUINT64_FORMAT "\n", counter_names[i], counters[i]);
+    }
+    g_string_append_printf(out, "  %-14s %10lu\n", "spawned", backend_spawn_count);
+
+    fwrite(out->str, 1, out->len, stdout);
+    fflush(stdout);
+    g_string_free(out, TRUE);
+}
+
+// Snapshot of all metrics as one JSON object, freed with g_free()
+gchar *stats_json(void)
+{
+    GString *out = g_string_sized_new(2048);
+    int i, k;
+
+    g_string_append_printf(out, "{\"uptime_us\":%" G_GINT64_FORMAT ",\"metrics\":{",
+                           g_get_monotonic_time() - start_time);
+    for (i = 0; i < STATS_METRIC_COUNT; i++) {
+        const struct histogram *hist = &metrics[i];
+
+        g_string_append_printf(out, "%s\"%s\":{\"count\":%" G_GUINT64_FORMAT ",\"total_us\":%" G_GUINT64_FORMAT
+                               ",\"max_us\":%" G_GUINT64_FORMAT ",\"buckets\":[",
+                               i ? "," : "", metric_names[i], hist->count, hist->total_us, hist->max_us);
+        for (k = 0; k < STATS_BUCKETS; k++) {
+            g_string_append_printf(out, "%s%" G_GUINT64_FORMAT, k ? "," : "", hist->buckets[k]);
+        }
+        g_string_append(out, "]}");
+    }
+    g_string_append(out, "},\"counters\":{");
+    for (i = 0; i < STATS_COUNTER_COUNT; i++) {
+        g_string_append_printf(out, "\"%s\":%" G_GUINT64_FORMAT ",", counter_names[i], counters[i]);
+    }
+    g_string_append_printf(out, "\"spawned\":%lu}}\n", backend_spawn_count);
+
+    return g_string_free(out, FALSE);
+}
+
+/*
+ * Prometheus text exposition, appended to out: the histograms as one
+ * family labelled by path (bucket bounds are the powers of two in
+ * microseconds, the last bucket is +Inf), the counters and the processes
+ * spawned by the backend.
+ */
+void stats_prometheus(GString *out)
+{
+    static char bounds[STATS_BUCKETS - 1][24];
+    int i, k;
+
+    // Scraped periodically: the bounds are formatted once, nothing per scrape goes through printf
+    if (bounds[0][0] == '\0') {
+        for (k = 0; k < STATS_BUCKETS - 1; k++) {
+            g_snprintf(bounds[k], sizeof(bounds[k]), "%u.%06u",
+                       (unsigned)((2u << k) / G_USEC_PER_SEC), (unsigned)((2u << k) % G_USEC_PER_SEC));
+        }
+    }
+
+    g_string_append(out, "# HELP openvpn_tray_duration_seconds Time taken by the timed paths of the tray.\n"
+                    "# TYPE openvpn_tray_duration_seconds histogram\n");
+    for (i = 0; i < STATS_METRIC_COUNT; i++) {
+        const struct histogram *hist = &metrics[i];
+        guint64 cumulative = 0;
+
+        for (k = 0; k < STATS_BUCKETS - 1; k++) {
+            cumulative += hist->buckets[k];
+            g_string_append(out, "openvpn_tray_duration_seconds_bucket{path=\"");
+            g_string_append(out, metric_names[i]);
+            g_string_append(out, "\",le=\"");
+            g_string_append(out, bounds[k]);
+            g_string_append(out, "\"} ");
+            stats_append_uint(out, cumulative);
+            g_string_append_c(out, '\n');
+        }
+        g_string_append(out, "openvpn_tray_duration_seconds_bucket{path=\"");
+        g_string_append(out, metric_names[i]);
+        g_string_append(out, "\",le=\"+Inf\"} ");
+        stats_append_uint(out, hist->count);
+        g_string_append(out, "\nopenvpn_tray_duration_seconds_sum{path=\"");
+        g_string_append(out, metric_names[i]);
+        g_string_append(out, "\"} ");
+        append_seconds(out, hist->total_us);
+        g_string_append(out, "\nopenvpn_tray_duration_seconds_count{path=\"");
+        g_string_append(out, metric_names[i]);
+        g_string_append(out, "\"} ");
+        stats_append_uint(out, hist->count);
+        g_string_append_c(out, '\n');
+    }
+
+    for (i = 0; i < STATS_COUNTER_COUNT; i++) {
+        append_counter(out, counter_names[i], counter_help[i], counters[i]);
+    }
+    append_counter(out, "spawned_processes", "Processes spawned by the backend.", backend_spawn_count);
+}
+
+// "# HELP", "# TYPE" and the sample of counter openvpn_tray_<name>_total
+static void append_counter(GString *out, const char *name, const char *help, guint64 value)
+{
+    g_string_append(out, "# HELP openvpn_tray_");
+    g_string_append(out, name);
+    g_string_append(out, "_total ");
+    g_string_append(out, help);
+    g_string_append(out, "\n# TYPE openvpn_tray_");
+    g_string_append(out, name);
+    g_string_append(out, "_total counter\nopenvpn_tray_");
+    g_string_append(out, name);
+    g_string_append(out, "_total ");
+    stats_append_uint(out, value);
+    g_string_append_c(out, '\n');
+}
+
+// n in decimal, without printf: the exposition is rendered on every scrape, see metrics.c
+void stats_append_uint(GString *out, guint64 n)
+{
+    char digits[20];
+    int len = 0;
+
+    do {
+        digits[sizeof(digits) - ++len] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    g_string_append_len(out, digits + sizeof(digits) - len, len);
+}
+
+// Microseconds as decimal seconds, independent of the locale's decimal point
+static void append_seconds(GString *out, guint64 us)
+{
+    char fraction[7];
+    unsigned rest = us % G_USEC_PER_SEC;
+    int k;
+
+    fraction[0] = '.';
+    for (k = 6; k > 0; k--) {
+        fraction[k] = '0' + rest % 10;
+        rest /= 10;
+    }
+    stats_append_uint(out, us / G_USEC_PER_SEC);
+    g_string_append_len(out, fraction, sizeof(fraction));
+}
+
+static gboolean on_heartbeat(gpointer data)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 late = now - heartbeat_due;
+
+    record(&metrics[STATS_LOOP_LATENCY], late > 0 ? late : 0);
+    if (late > STATS_STALL_THRESHOLD_MS * 1000) {
+        record(&metrics[STATS_STALL], late);
+    }
+    heartbeat_due = now + STATS_HEARTBEAT_MS * 1000;
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_sigusr1(gpointer data)
+{
+    GError *error = NULL;
+    gchar *json = stats_json();
+
+    stats_dump();
+    if (!g_file_set_contents(snapshot_path, json, -1, &error)) {
+        g_print("%s: ERROR: Unable to write stats snapshot: %s\n", APP_NAME, error->message);
+        g_error_free(error);
+    }
+    g_free(json);
+    return G_SOURCE_CONTINUE;
+}
+
+void stats_cleanup(void)
+{
+    if (heartbeat_id) {
+        g_source_remove(heartbeat_id);
+        heartbeat_id = 0;
+    }
+    if (signal_id) {
+        g_source_remove(signal_id);
+        signal_id = 0;
+    }
+    g_free(snapshot_path);
+    snapshot_path = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <glib.h>
+
+// Timed hot paths, each with a latency histogram
+enum stats_metric {
+    STATS_FETCH,            // on_probe_done(), applying a rescan or probe result
+    STATS_PROBE,            // One backend probe call, on the probe worker
+    STATS_ICON,             // update_icon()
+    STATS_MENU_POPUP,       // vpn_menu_popup()
+    STATS_MENU_REFRESH,     // vpn_menu_apply_changes()
+    STATS_LOG,              // log_vpn_status_changes() for one change set
+    STATS_TRAFFIC,          // One throughput sampling pass over the active VPNs
+    STATS_STALL,            // Main-loop stalls over STATS_STALL_THRESHOLD_MS
+    STATS_LOOP_LATENCY,     // How late every heartbeat was dispatched
+    STATS_METRIC_COUNT,
+};
+
+// Plain event counters
+enum stats_counter {
+    STATS_UNITS_PROBED,     // Units covered by probes, over STATS_PROBE calls
+    STATS_COUNTER_COUNT,
+};
+
+// Bucket k counts durations in [2^k, 2^(k+1)) microseconds, the last one is open
+#define STATS_BUCKETS 24
+
+#define stats_begin() g_get_monotonic_time()
+
+void stats_init(int dump_on_signal, const char *json_path);
+void stats_end(enum stats_metric metric, gint64 start);
+void stats_record(enum stats_metric metric, gint64 us);
+void stats_count(enum stats_counter counter, guint64 n);
+void stats_dump(void);
+gchar *stats_json(void);
+void stats_prometheus(GString *out);
+void stats_append_uint(GString *out, guint64 n);
+void stats_cleanup(void);
+
+#endif
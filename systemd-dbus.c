@@ -0,0 +1,279 @@
+#include <string.h>
+#include <gio/gio.h>
+#include "openvpn-tray.h"
+#include "systemd-dbus.h"
+#include "profiles.h"
+
+#define SYSTEMD_BUS_NAME "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_PATH "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_IFACE "org.freedesktop.systemd1.Manager"
+#define SYSTEMD_UNIT_IFACE "org.freedesktop.systemd1.Unit"
+#define DBUS_PROPERTIES_IFACE "org.freedesktop.DBus.Properties"
+
+/*
+ * Environment variable selecting the bus systemd is looked up on:
+ * "system" (default), "session" (e.g. a mock systemd on a private
+ * session bus started by dbus-run-session) or "none" to disable events.
+ */
+#define SYSTEMD_BUS_ENV "OPENVPN_TRAY_SYSTEMD_BUS"
+
+struct unit_watch {
+    char *name;             // VPN name, without unit prefix and suffix
+    char *path;             // Unit object path, NULL until resolved
+    guint subscription;     // PropertiesChanged subscription, 0 if none
+    int seen;               // Mark used by systemd_dbus_sync_units()
+};
+
+static GDBusConnection *connection = NULL;
+static GHashTable *watches = NULL;
+static systemd_dbus_state_cb on_state = NULL;
+static systemd_dbus_ready_cb on_ready = NULL;
+static gpointer callback_data = NULL;
+static int subscribed = 0;             // Subscribe call succeeded
+
+static void free_watch(gpointer data);
+static void resolve_unit(struct unit_watch *watch);
+static void on_bus_ready(GObject *source, GAsyncResult *result, gpointer data);
+static void on_subscribed(GObject *source, GAsyncResult *result, gpointer data);
+static void on_unit_loaded(GObject *source, GAsyncResult *result, gpointer data);
+static void on_active_state(GObject *source, GAsyncResult *result, gpointer data);
+static void on_properties_changed(GDBusConnection *conn, const gchar *sender,
+                                  const gchar *path, const gchar *iface,
+                                  const gchar *signal, GVariant *params, gpointer data);
+static void report_state(const char *vpn_name, const char *active_state);
+
+void systemd_dbus_init(systemd_dbus_state_cb state_cb, systemd_dbus_ready_cb ready_cb, gpointer data)
+{
+    const char *bus = g_getenv(SYSTEMD_BUS_ENV);
+    GBusType bus_type = G_BUS_TYPE_SYSTEM;
+
+    on_state = state_cb;
+    on_ready = ready_cb;
+    callback_data = data;
+    watches = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_watch);
+
+    if (bus && strcmp(bus, "none") == 0) {
+        g_print("%s: systemd D-Bus events disabled, polling only\n", APP_NAME);
+        return;
+    }
+    if (bus && strcmp(bus, "session") == 0) {
+        bus_type = G_BUS_TYPE_SESSION;
+    }
+
+    g_bus_get(bus_type, NULL, on_bus_ready, NULL);
+}
+
+int systemd_dbus_is_active(void)
+{
+    return subscribed;
+}
+
+/*
+ * Make the set of watched units match the given VPN names. New names are
+ * resolved and subscribed, names no longer present are unsubscribed.
+ */
+void systemd_dbus_sync_units(const char *names[], int count)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if (!watches) {
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, watches);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        ((struct unit_watch *)value)->seen = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct unit_watch *watch = g_hash_table_lookup(watches, names[i]);
+
+        if (!watch) {
+            watch = g_new0(struct unit_watch, 1);
+            watch->name = g_strdup(names[i]);
+            g_hash_table_insert(watches, watch->name, watch);
+            if (connection) {
+                resolve_unit(watch);
+            }
+        }
+        watch->seen = 1;
+    }
+
+    g_hash_table_iter_init(&iter, watches);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        if (!((struct unit_watch *)value)->seen) {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+}
+
+void systemd_dbus_cleanup(void)
+{
+    if (watches) {
+        g_hash_table_destroy(watches);
+        watches = NULL;
+    }
+    g_clear_object(&connection);
+    subscribed = 0;
+}
+
+static void free_watch(gpointer data)
+{
+    struct unit_watch *watch = data;
+
+    if (watch->subscription && connection) {
+        g_dbus_connection_signal_unsubscribe(connection, watch->subscription);
+    }
+    g_free(watch->path);
+    g_free(watch->name);
+    g_free(watch);
+}
+
+static void on_bus_ready(GObject *source, GAsyncResult *result, gpointer data)
+{
+    GError *error = NULL;
+    GHashTableIter iter;
+    gpointer value;
+
+    connection = g_bus_get_finish(result, &error);
+    if (!connection) {
+        g_print("%s: WARNING: systemd D-Bus unavailable, polling only: %s\n", APP_NAME, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    // systemd only emits unit signals while at least one client is subscribed
+    g_dbus_connection_call(connection, SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH,
+                           SYSTEMD_MANAGER_IFACE, "Subscribe", NULL, NULL,
+                           G_DBUS_CALL_FLAGS_NONE, -1, NULL, on_subscribed, NULL);
+
+    g_hash_table_iter_init(&iter, watches);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        resolve_unit(value);
+    }
+}
+
+static void on_subscribed(GObject *source, GAsyncResult *result, gpointer data)
+{
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+
+    if (!reply) {
+        g_print("%s: WARNING: Unable to subscribe to systemd signals, polling only: %s\n", APP_NAME,
+                error->message);
+        g_error_free(error);
+        return;
+    }
+    g_variant_unref(reply);
+
+    // Only now are signals actually emitted
+    subscribed = 1;
+    if (on_ready) {
+        on_ready(callback_data);
+    }
+}
+
+static void resolve_unit(struct unit_watch *watch)
+{
+    char *unit = profiles_unit_name(watch->name);
+
+    // LoadUnit, unlike GetUnit, also resolves units which are not running
+    g_dbus_connection_call(connection, SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH,
+                           SYSTEMD_MANAGER_IFACE, "LoadUnit", g_variant_new("(s)", unit),
+                           G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                           on_unit_loaded, g_strdup(watch->name));
+    g_free(unit);
+}
+
+static void on_unit_loaded(GObject *source, GAsyncResult *result, gpointer data)
+{
+    char *vpn_name = data;
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    struct unit_watch *watch;
+
+    if (!reply) {
+        g_print("%s: WARNING: Unable to resolve unit for VPN %s: %s\n", APP_NAME, vpn_name, error->message);
+        g_error_free(error);
+        g_free(vpn_name);
+        return;
+    }
+
+    // The VPN may have been removed while the call was in flight
+    watch = g_hash_table_lookup(watches, vpn_name);
+    if (watch && !watch->path) {
+        g_variant_get(reply, "(o)", &watch->path);
+        watch->subscription = g_dbus_connection_signal_subscribe(
+            connection, SYSTEMD_BUS_NAME, DBUS_PROPERTIES_IFACE, "PropertiesChanged",
+            watch->path, SYSTEMD_UNIT_IFACE, G_DBUS_SIGNAL_FLAGS_NONE,
+            on_properties_changed, g_strdup(vpn_name), g_free);
+
+        // Fetch the current state once, afterwards signals keep it up to date
+        g_dbus_connection_call(connection, SYSTEMD_BUS_NAME, watch->path,
+                               DBUS_PROPERTIES_IFACE, "Get",
+                               g_variant_new("(ss)", SYSTEMD_UNIT_IFACE, "ActiveState"),
+                               G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                               on_active_state, g_strdup(vpn_name));
+    }
+
+    g_variant_unref(reply);
+    g_free(vpn_name);
+}
+
+static void on_active_state(GObject *source, GAsyncResult *result, gpointer data)
+{
+    char *vpn_name = data;
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    GVariant *value;
+
+    if (!reply) {
+        g_print("%s: WARNING: Unable to get state of VPN %s: %s\n", APP_NAME, vpn_name, error->message);
+        g_error_free(error);
+        g_free(vpn_name);
+        return;
+    }
+
+    g_variant_get(reply, "(v)", &value);
+    if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        report_state(vpn_name, g_variant_get_string(value, NULL));
+    }
+
+    g_variant_unref(value);
+    g_variant_unref(reply);
+    g_free(vpn_name);
+}
+
+static void on_properties_changed(GDBusConnection *conn, const gchar *sender,
+                                  const gchar *path, const gchar *iface,
+                                  const gchar *signal, GVariant *params, gpointer data)
+{
+    const char *vpn_name = data;
+    const char *interface;
+    const char *active_state;
+    GVariant *changed;
+
+    if (!g_variant_is_of_type(params, G_VARIANT_TYPE("(sa{sv}as)"))) {
+        return;
+    }
+
+    // Only ActiveState is tracked, SubState changes arrive in the same signal
+    g_variant_get(params, "(&s@a{sv}@as)", &interface, &changed, NULL);
+    if (g_variant_lookup(changed, "ActiveState", "&s", &active_state)) {
+        report_state(vpn_name, active_state);
+    }
+    g_variant_unref(changed);
+}
+
+// Same mapping as the systemctl probe, so events and probes agree
+static void report_state(const char *vpn_name, const char *active_state)
+{
+    int active = strcmp(active_state, "active") == 0 || strcmp(active_state, "reloading") == 0;
+    int transitioning = strcmp(active_state, "activating") == 0
+        || strcmp(active_state, "deactivating") == 0 || strcmp(active_state, "reloading") == 0;
+
+    if (g_hash_table_contains(watches, vpn_name) && on_state) {
+        on_state(vpn_name, active, transitioning, callback_data);
+    }
+}
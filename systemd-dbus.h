@@ -0,0 +1,14 @@
+#ifndef SYSTEMD_DBUS_H
+#define SYSTEMD_DBUS_H
+
+#include <glib.h>
+
+typedef void (*systemd_dbus_state_cb)(const char *vpn_name, int active, int transitioning, gpointer data);
+typedef void (*systemd_dbus_ready_cb)(gpointer data);
+
+void systemd_dbus_init(systemd_dbus_state_cb state_cb, systemd_dbus_ready_cb ready_cb, gpointer data);
+void systemd_dbus_sync_units(const char *names[], int count);
+int systemd_dbus_is_active(void);
+void systemd_dbus_cleanup(void);
+
+#endif
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "conf.h"
+#include "stats.h"
+#include "traffic.h"
+
+/*
+ * Per-VPN throughput from the interface counters in sysfs. Each profile
+ * is mapped to the device of its "dev" directive (tun0, tap1...), whose
+ * statistics/rx_bytes and tx_bytes stay open while the VPN is active, so
+ * a sample is one pread() per counter. Rates are smoothed with an EWMA
+ * over TRAFFIC_EWMA_SECONDS. Sampling runs every TRAFFIC_FAST_INTERVAL_MS
+ * while a menu is open or a tooltip was asked for recently and every
+ * TRAFFIC_IDLE_INTERVAL_MS otherwise.
+ *
+ * A bare "dev tun" or "dev tap" lets OpenVPN pick the next free unit,
+ * which the profile does not tell. Such a VPN is matched to the tun* or
+ * tap* interface in sysfs that no other VPN claims, as long as that is
+ * unambiguous: one active VPN of the type still unmatched and one
+ * unclaimed interface. Otherwise it shows no rate until one of them goes.
+ */
+
+struct vpn_traffic {
+    char dev[IFNAMSIZ];
+    int resolved;           // 1 if dev is known, -1 if the profile has none, 0 not looked up yet
+    int bare;               // "dev tun"/"dev tap": 1 until matched (dev holds the type), 2 once matched
+    int rx_fd;              // statistics/rx_bytes, -1 if not open
+    int tx_fd;
+    guint64 rx_bytes;       // Counters at the last sample
+    guint64 tx_bytes;
+    gint64 sampled_at;      // Monotonic time of the last sample, 0 if none
+    double rate_in;         // Smoothed bytes per second
+    double rate_out;
+    int have_rate;
+};
+
+static const char *sysfs_root = TRAFFIC_SYSFS_ROOT;
+static guint timer_id = 0;
+static guint timer_interval = 0;
+static int visible_count = 0;       // Open menus
+static gint64 poke_until = 0;       // Fast sampling after a tooltip query, monotonic
+
+static void schedule(void);
+static gboolean on_sample_timer(gpointer data);
+static void sample_all(void);
+static void sample_resolved(struct vpn_traffic *traffic, gint64 now);
+static void sample(struct vpn_traffic *traffic, gint64 now);
+static int open_dev(struct vpn_traffic *traffic);
+static void close_dev(struct vpn_traffic *traffic);
+static int read_counter(int fd, guint64 *value);
+static int read_dev(const char *vpn_name, struct vpn_traffic *traffic);
+static void match_bare(GPtrArray *unmatched);
+static int is_claimed(const char *dev);
+static void smooth(double *rate, guint64 delta, double seconds, int first);
+
+// OPENVPN_TRAY_SYSFS_ROOT points the sampler at a fake /sys/class/net
+void traffic_init(void)
+{
+    const char *root = getenv("OPENVPN_TRAY_SYSFS_ROOT");
+
+    if (root && *root) {
+        sysfs_root = root;
+    }
+    schedule();
+}
+
+void traffic_attach(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+
+    if (entry->traffic == NULL) {
+        struct vpn_traffic *traffic = g_new0(struct vpn_traffic, 1);
+
+        traffic->rx_fd = -1;
+        traffic->tx_fd = -1;
+        entry->traffic = traffic;
+    }
+}
+
+void traffic_detach(int vpn_index)
+{
+    struct vpn_entry *entry = registry_get(vpn_index);
+
+    if (entry->traffic) {
+        close_dev(entry->traffic);
+        g_free(entry->traffic);
+        entry->traffic = NULL;
+    }
+}
+
+// A menu was shown (1) or hidden (0); take a fresh sample on show
+void traffic_set_visible(int visible)
+{
+    if (visible) {
+        visible_count++;
+        sample_all();
+    } else if (visible_count > 0) {
+        visible_count--;
+    }
+    schedule();
+}
+
+// A tooltip was asked for: sample fast for the next TRAFFIC_POKE_HOLD seconds
+void traffic_poke(void)
+{
+    poke_until = g_get_monotonic_time() + (gint64)TRAFFIC_POKE_HOLD * G_USEC_PER_SEC;
+    schedule();
+}
+
+int traffic_rates(struct vpn_entry *entry, double *rate_in, double *rate_out)
+{
+    struct vpn_traffic *traffic = entry->traffic;
+
+    if (traffic == NULL || !traffic->have_rate) {
+        return 0;
+    }
+    *rate_in = traffic->rate_in;
+    *rate_out = traffic->rate_out;
+    return 1;
+}
+
+// Append "1.2 MB/s in, 30.0 kB/s out"; returns 0 and appends nothing without a rate
+int traffic_format(struct vpn_entry *entry, GString *out)
+{
+    double rate_in, rate_out;
+    gchar *in, *out_size;
+
+    if (!traffic_rates(entry, &rate_in, &rate_out)) {
+        return 0;
+    }
+    in = g_format_size((guint64)rate_in);
+    out_size = g_format_size((guint64)rate_out);
+    g_string_append_printf(out, "%s/s in, %s/s out", in, out_size);
+    g_free(in);
+    g_free(out_size);
+    return 1;
+}
+
+// Append a "Traffic: ..." line summing up all VPNs with a rate
+void traffic_format_total(GString *out)
+{
+    double total_in = 0, total_out = 0, rate_in, rate_out;
+    struct vpn_entry *entry;
+    int count = 0;
+    int i;
+
+    registry_foreach(i, entry) {
+        if (traffic_rates(entry, &rate_in, &rate_out)) {
+            total_in += rate_in;
+            total_out += rate_out;
+            count++;
+        }
+    }
+    if (count) {
+        gchar *in = g_format_size((guint64)total_in);
+        gchar *out_size = g_format_size((guint64)total_out);
+
+        g_string_append_printf(out, "\nTraffic: %s/s in, %s/s out", in, out_size);
+        g_free(in);
+        g_free(out_size);
+    }
+}
+
+void traffic_cleanup(void)
+{
+    struct vpn_entry *entry;
+    int i;
+
+    if (timer_id) {
+        g_source_remove(timer_id);
+        timer_id = 0;
+    }
+    registry_foreach(i, entry) {
+        if (entry->traffic) {
+            close_dev(entry->traffic);
+        }
+    }
+}
+
+// (Re)arm the timer if the wanted sampling interval changed
+static void schedule(void)
+{
+    int fast = visible_count > 0 || g_get_monotonic_time() < poke_until;
+    guint interval = fast ? TRAFFIC_FAST_INTERVAL_MS : TRAFFIC_IDLE_INTERVAL_MS;
+
+    if (timer_id && timer_interval == interval) {
+        return;
+    }
+    if (timer_id) {
+        g_source_remove(timer_id);
+    }
+    timer_interval = interval;
+    timer_id = g_timeout_add(interval, on_sample_timer, NULL);
+}
+
+static gboolean on_sample_timer(gpointer data)
+{
+    sample_all();
+
+    // Drop back to the idle rate once the tooltip hold has run out
+    if (timer_interval == TRAFFIC_FAST_INTERVAL_MS && visible_count == 0 &&
+        g_get_monotonic_time() >= poke_until) {
+        timer_id = 0;
+        schedule();
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static void sample_all(void)
+{
+    gint64 start = stats_begin();
+    struct vpn_entry *entry;
+    int i;
+
+    GPtrArray *unmatched = NULL;
+
+    registry_foreach(i, entry) {
+        struct vpn_traffic *traffic = entry->traffic;
+
+        if (traffic == NULL) {
+            continue;
+        }
+        if (!entry->state) {
+            // The device goes away with the tunnel; look it up again on the next start
+            if (traffic->resolved || traffic->have_rate) {
+                close_dev(traffic);
+                traffic->resolved = 0;
+            }
+            continue;
+        }
+        if (traffic->resolved == 0) {
+            traffic->resolved = read_dev(entry->name, traffic) ? 1 : -1;
+        }
+        if (traffic->resolved > 0 && traffic->bare == 1) {
+            if (unmatched == NULL) {
+                unmatched = g_ptr_array_new();
+            }
+            g_ptr_array_add(unmatched, traffic);
+        } else if (traffic->resolved > 0) {
+            sample_resolved(traffic, start);
+        }
+    }
+
+    // Only VPNs with a bare "dev tun" or "dev tap" not matched yet get here
+    if (unmatched) {
+        match_bare(unmatched);
+        for (i = 0; i < unmatched->len; i++) {
+            struct vpn_traffic *traffic = g_ptr_array_index(unmatched, i);
+
+            if (traffic->bare == 2) {
+                sample_resolved(traffic, start);
+            }
+        }
+        g_ptr_array_free(unmatched, TRUE);
+    }
+    stats_end(STATS_TRAFFIC, start);
+}
+
+// A matched unit may come back under another number with the tunnel, match it again then
+static void sample_resolved(struct vpn_traffic *traffic, gint64 now)
+{
+    sample(traffic, now);
+    if (traffic->bare && traffic->rx_fd < 0) {
+        traffic->resolved = 0;
+    }
+}
+
+static void sample(struct vpn_traffic *traffic, gint64 now)
+{
+    guint64 rx_bytes, tx_bytes;
+
+    if (traffic->rx_fd < 0 && !open_dev(traffic)) {
+        return;
+    }
+    if (!read_counter(traffic->rx_fd, &rx_bytes) || !read_counter(traffic->tx_fd, &tx_bytes)) {
+        // Device gone, e.g. the tunnel restarted; reopen on the next sample
+        close_dev(traffic);
+        return;
+    }
+
+    // Skip the first sample and counter resets, there is nothing to diff against
+    if (traffic->sampled_at && now > traffic->sampled_at &&
+        rx_bytes >= traffic->rx_bytes && tx_bytes >= traffic->tx_bytes) {
+        double seconds = (now - traffic->sampled_at) / (double)G_USEC_PER_SEC;
+
+        smooth(&traffic->rate_in, rx_bytes - traffic->rx_bytes, seconds, !traffic->have_rate);
+        smooth(&traffic->rate_out, tx_bytes - traffic->tx_bytes, seconds, !traffic->have_rate);
+        traffic->have_rate = 1;
+    }
+    traffic->rx_bytes = rx_bytes;
+    traffic->tx_bytes = tx_bytes;
+    traffic->sampled_at = now;
+}
+
+static int open_dev(struct vpn_traffic *traffic)
+{
+    gchar *path;
+
+    path = g_strdup_printf("%s/%s/statistics/rx_bytes", sysfs_root, traffic->dev);
+    traffic->rx_fd = open(path, O_RDONLY | O_CLOEXEC);
+    g_free(path);
+
+    path = g_strdup_printf("%s/%s/statistics/tx_bytes", sysfs_root, traffic->dev);
+    traffic->tx_fd = open(path, O_RDONLY | O_CLOEXEC);
+    g_free(path);
+
+    if (traffic->rx_fd < 0 || traffic->tx_fd < 0) {
+        close_dev(traffic);
+        return 0;
+    }
+    return 1;
+}
+
+static void close_dev(struct vpn_traffic *traffic)
+{
+    if (traffic->rx_fd >= 0) {
+        close(traffic->rx_fd);
+    }
+    if (traffic->tx_fd >= 0) {
+        close(traffic->tx_fd);
+    }
+    traffic->rx_fd = -1;
+    traffic->tx_fd = -1;
+    traffic->sampled_at = 0;
+    traffic->rate_in = 0;
+    traffic->rate_out = 0;
+    traffic->have_rate = 0;
+}
+
+// sysfs regenerates the attribute on every read at offset 0
+static int read_counter(int fd, guint64 *value)
+{
+    char buf[32];
+    char *end;
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    *value = g_ascii_strtoull(buf, &end, 10);
+    return end != buf;
+}
+
+/*
+ * Device of the profile's "dev" directive, see conf.c. For a bare "tun"
+ * or "tap" only the type is known, match_bare() finds the unit.
+ */
+static int read_dev(const char *vpn_name, struct vpn_traffic *traffic)
+{
+    const struct conf_info *info = conf_lookup(vpn_name);
+
+    if (info == NULL || info->dev == NULL || strchr(info->dev, '/') != NULL ||
+        strlen(info->dev) >= sizeof(traffic->dev)) {
+        return 0;
+    }
+    g_strlcpy(traffic->dev, info->dev, sizeof(traffic->dev));
+    traffic->bare = strcmp(info->dev, "tun") == 0 || strcmp(info->dev, "tap") == 0;
+    return 1;
+}
+
+// Give each type's unmatched VPN the one unclaimed interface of that type, if unambiguous
+static void match_bare(GPtrArray *unmatched)
+{
+    static const char *types[] = { "tun", "tap" };
+    struct vpn_traffic *pending[G_N_ELEMENTS(types)] = { NULL };
+    char found[G_N_ELEMENTS(types)][IFNAMSIZ];
+    int vpns[G_N_ELEMENTS(types)] = { 0 };
+    int devs[G_N_ELEMENTS(types)] = { 0 };
+    struct dirent *ent;
+    DIR *dir;
+    int i, t;
+
+    for (i = 0; i < unmatched->len; i++) {
+        struct vpn_traffic *traffic = g_ptr_array_index(unmatched, i);
+
+        t = strcmp(traffic->dev, "tap") == 0;
+        pending[t] = traffic;
+        vpns[t]++;
+    }
+
+    if ((dir = opendir(sysfs_root)) == NULL) {
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        for (t = 0; t < G_N_ELEMENTS(types); t++) {
+            if (vpns[t] == 1 && strncmp(ent->d_name, types[t], 3) == 0 && g_ascii_isdigit(ent->d_name[3]) &&
+                strlen(ent->d_name) < IFNAMSIZ && !is_claimed(ent->d_name)) {
+                g_strlcpy(found[t], ent->d_name, IFNAMSIZ);
+                devs[t]++;
+            }
+        }
+    }
+    closedir(dir);
+
+    for (t = 0; t < G_N_ELEMENTS(types); t++) {
+        if (vpns[t] == 1 && devs[t] == 1) {
+            g_strlcpy(pending[t]->dev, found[t], IFNAMSIZ);
+            pending[t]->bare = 2;
+        }
+    }
+}
+
+// An active VPN already samples dev, named in its profile or matched
+static int is_claimed(const char *dev)
+{
+    struct vpn_entry *entry;
+    int i;
+
+    registry_foreach(i, entry) {
+        struct vpn_traffic *traffic = entry->traffic;
+
+        if (traffic && entry->state && traffic->resolved > 0 && traffic->bare != 1 &&
+            strcmp(traffic->dev, dev) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Time-aware EWMA: a longer gap between samples weighs the new rate more
+static void smooth(double *rate, guint64 delta, double seconds, int first)
+{
+    double current = delta / seconds;
+    double alpha = seconds / (seconds + TRAFFIC_EWMA_SECONDS);
+
+    *rate = first ? current : *rate + alpha * (current - *rate);
+}
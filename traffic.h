@@ -0,0 +1,17 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <glib.h>
+#include "registry.h"
+
+void traffic_init(void);
+void traffic_attach(int vpn_index);
+void traffic_detach(int vpn_index);
+void traffic_set_visible(int visible);
+void traffic_poke(void);
+int traffic_rates(struct vpn_entry *entry, double *rate_in, double *rate_out);
+int traffic_format(struct vpn_entry *entry, GString *out);
+void traffic_format_total(GString *out);
+void traffic_cleanup(void);
+
+#endif
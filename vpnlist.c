@@ -0,0 +1,229 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "openvpn-tray.h"
+#include "registry.h"
+#include "jobs.h"
+#include "backend.h"
+#include "stats.h"
+#include "changes.h"
+#include "snapshot.h"
+#include "prober.h"
+#include "vpnlist.h"
+
+/*
+ * VPN list management on top of the state backend. Nothing in here touches
+ * GTK, so the poll path can be driven headless, see bench/bench-poll.c.
+ */
+
+static void apply_names(GPtrArray *names, vpnlist_profile_cb added_cb, vpnlist_profile_cb removed_cb,
+                        gpointer data);
+static void apply_states(const struct vpn_probe *units, int count);
+static size_t append_text(char *buf, size_t size, size_t len, const char *format, ...) G_GNUC_PRINTF(4, 5);
+
+/*
+ * Full rescan of the profiles known to the backend. Profiles which
+ * disappeared are removed from the registry and new ones are added, entries
+ * which are still present keep their slot and state. added_cb is called
+ * after a new entry is in the registry, removed_cb before an entry is
+ * dropped from it; both are noted in the change set. Returns the
+ * backend's BACKEND_* code.
+ */
+int vpnlist_scan(vpnlist_profile_cb added_cb, vpnlist_profile_cb removed_cb, gpointer data)
+{
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    int ret;
+
+    if ((ret = backend_get()->enumerate(names)) == BACKEND_OK) {
+        apply_names(names, added_cb, removed_cb, data);
+    }
+    g_ptr_array_free(names, TRUE);
+    return ret;
+}
+
+/*
+ * Probe the given slots (all when count < 0) through the backend, timed,
+ * blocking the caller. Probed VPNs whose state changed are noted in the
+ * change set. The tray probes through prober.c instead, this is for
+ * headless callers such as bench/bench-poll.c.
+ */
+void vpnlist_probe(const int *slots, int count)
+{
+    gint64 start = stats_begin();
+    struct vpn_probe *units;
+    struct vpn_entry *entry;
+    int status = BACKEND_OK;
+    int n = 0;
+    int i;
+
+    units = g_new0(struct vpn_probe, count < 0 ? registry_count() : count);
+    if (count < 0) {
+        registry_foreach(i, entry) {
+            units[n++].name = entry->name;
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            if ((entry = registry_get(slots[i]))->name != NULL) {
+                units[n++].name = entry->name;
+            }
+        }
+    }
+
+    if (n > 0) {
+        status = backend_get()->probe(units, n, count < 0);
+    }
+    stats_end(STATS_PROBE, start);
+    stats_count(STATS_UNITS_PROBED, n);
+
+    if (status == BACKEND_OK) {
+        apply_states(units, n);
+    }
+    g_free(units);
+}
+
+/*
+ * Apply the outcome of a prober.c cycle on the main loop: on a rescan the
+ * profile list is updated as by vpnlist_scan(), then the probed states go
+ * to the entries which still exist. A failed probe leaves every state as
+ * it was. Returns the scan's BACKEND_* code, else the probe's.
+ */
+int vpnlist_apply(const struct probe_result *result, vpnlist_profile_cb added_cb,
+                  vpnlist_profile_cb removed_cb, gpointer data)
+{
+    if (result->rescan) {
+        if (result->scan_status != BACKEND_OK) {
+            return result->scan_status;
+        }
+        apply_names(result->names, added_cb, removed_cb, data);
+    }
+
+    stats_record(STATS_PROBE, result->probe_us);
+    stats_count(STATS_UNITS_PROBED, result->count);
+    if (result->probe_status != BACKEND_OK) {
+        return result->probe_status;
+    }
+    apply_states(result->units, result->count);
+    return BACKEND_OK;
+}
+
+static void apply_names(GPtrArray *names, vpnlist_profile_cb added_cb, vpnlist_profile_cb removed_cb,
+                        gpointer data)
+{
+    GHashTable *found = g_hash_table_new(g_str_hash, g_str_equal);
+    struct vpn_entry *entry;
+    int i;
+
+    for (i = 0; i < names->len; i++) {
+        char *name = g_ptr_array_index(names, i);
+        int vpn_index;
+
+        g_hash_table_add(found, name);
+        if ((vpn_index = registry_add(name)) >= 0) {
+            changes_added(vpn_index);
+            if (added_cb != NULL) {
+                added_cb(vpn_index, data);
+            }
+        }
+    }
+
+    registry_foreach(i, entry) {
+        if (!g_hash_table_contains(found, entry->name)) {
+            if (removed_cb != NULL) {
+                removed_cb(i, data);
+            }
+            changes_removed(i);
+            registry_remove(entry->name);
+        }
+    }
+    g_hash_table_destroy(found);
+}
+
+// Copy probed states into the registry, noting changed VPNs
+static void apply_states(const struct vpn_probe *units, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        int vpn_index = registry_lookup(units[i].name);
+        struct vpn_entry *entry;
+
+        if (vpn_index < 0) {
+            // Removed while the probe was running
+            continue;
+        }
+        entry = registry_get(vpn_index);
+        entry->state = units[i].state;
+        entry->transitioning = units[i].transitioning;
+        changes_check(vpn_index);
+    }
+}
+
+// As of the last changes_commit()
+int vpnlist_any_active(void)
+{
+    struct changes_summary summary;
+
+    changes_get_summary(&summary);
+    return summary.active > 0;
+}
+
+/*
+ * Format the tray tooltip, e.g. "OpenVPN - VPN(s) running (12/30 up)".
+ * Returns 1 when any VPN is ON.
+ */
+int vpnlist_status_text(char *buf, size_t size)
+{
+    int any_vpn_on = vpnlist_any_active();
+    size_t len;
+
+    if (size == 0) {
+        return any_vpn_on;
+    }
+    buf[0] = '\0';
+    len = append_text(buf, size, 0, "OpenVPN - %s", any_vpn_on ? "VPN(s) running" : "All VPNs off");
+
+    // States from the snapshot until the first probe is through
+    if (snapshot_is_stale()) {
+        len = append_text(buf, size, len, " (last known, checking…)");
+    }
+
+    // Aggregate progress of start/stop jobs, e.g. "12/30 up"
+    if (jobs_in_flight() > 0) {
+        struct jobs_progress progress;
+
+        jobs_get_progress(&progress);
+        len = append_text(buf, size, len, " (%d/%d %s", progress.succeeded, progress.total,
+                          progress.type == VPN_JOB_STARTING ? "up" :
+                          progress.type == VPN_JOB_STOPPING ? "down" : "done");
+        if (progress.failed > 0) {
+            len = append_text(buf, size, len, ", %d failed", progress.failed);
+        }
+        len = append_text(buf, size, len, ")");
+    }
+
+    if (read_only_mode) {
+        append_text(buf, size, len, " (Read-Only - Need sudo)");
+    }
+
+    return any_vpn_on;
+}
+
+// Append at len, truncating; returns the new length, never past size - 1
+static size_t append_text(char *buf, size_t size, size_t len, const char *format, ...)
+{
+    va_list args;
+    int written;
+
+    if (len >= size - 1) {
+        return len;
+    }
+    va_start(args, format);
+    written = vsnprintf(buf + len, size - len, format, args);
+    va_end(args);
+    if (written < 0) {
+        buf[len] = '\0';
+        return len;
+    }
+    return MIN(len + written, size - 1);
+}
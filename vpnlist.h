@@ -0,0 +1,18 @@
+#ifndef VPNLIST_H
+#define VPNLIST_H
+
+#include <stddef.h>
+#include <glib.h>
+
+struct probe_result;
+
+typedef void (*vpnlist_profile_cb)(int vpn_index, gpointer data);
+
+int vpnlist_scan(vpnlist_profile_cb added_cb, vpnlist_profile_cb removed_cb, gpointer data);
+void vpnlist_probe(const int *slots, int count);
+int vpnlist_apply(const struct probe_result *result, vpnlist_profile_cb added_cb,
+                  vpnlist_profile_cb removed_cb, gpointer data);
+int vpnlist_any_active(void);
+int vpnlist_status_text(char *buf, size_t size);
+
+#endif